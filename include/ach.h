@@ -132,6 +132,10 @@
  *   |        |
  *   |--------|
  *   | GUARDD |
+ *   |--------|
+ *   |  Subs  |
+ *   |--------|
+ *   | GUARDS |
  *   |________|
  */
 
@@ -184,14 +188,20 @@ extern "C" {
 /** prefix to apply to channel names to get the shared memory file name */
 #define ACH_CHAN_NAME_PREFIX "/achshm-"
 
+/** Alignment of the data slots of a fixed-size channel, see
+ * ach_create_attr_t::fixed_size */
+#define ACH_SLOT_ALIGN 8
+
 /** Number of times to retry a syscall on EINTR before giving up */
 #define ACH_INTR_RETRY 8
 
     /** magic number that appears the the beginning of our mmaped files.
 
-        This is just to be used as a check.
+        This is just to be used as a check.  It changes whenever the
+        layout of the file does, so a library built for another layout
+        refuses the channel rather than misreading it.
     */
-#define ACH_SHM_MAGIC_NUM 0xb07511f3
+#define ACH_SHM_MAGIC_NUM 0xb07511f4
 
 
     /** A separator between different shm sections.
@@ -215,6 +225,14 @@ extern "C" {
     */
 #define ACH_SHM_GUARD_DATA_NUM ((uint64_t)0x1C2C3C4C5C6C7C8CLLU)
 
+    /** A separator between different shm sections.
+
+        This one comes after the subscriber table (at the very end of
+        the file).  Should aid debugging by showing we don't overstep
+        and bounds.  64-bit for alignment.
+    */
+#define ACH_SHM_GUARD_SUB_NUM ((uint64_t)0x1D2D3D4D5D6D7D8DLLU)
+
     /** return status codes for ach functions */
     typedef enum ach_status {
         ACH_OK = 0,             /**< Call successful */
@@ -227,12 +245,13 @@ extern "C" {
         ACH_TIMEOUT = 7,        /**< timeout before frame received */
         ACH_EEXIST = 8,         /**< channel file already exists */
         ACH_ENOENT = 9,         /**< channel file doesn't exist */
-        ACH_CLOSED = 10,        /**< unused */
+        ACH_CLOSED = 10,        /**< peer closed the socket in ach_recv_fd() */
         ACH_BUG = 11,           /**< internal ach error */
         ACH_EINVAL = 12,        /**< invalid channel */
         ACH_CORRUPT = 13,       /**< channel memory has been corrupted */
         ACH_BAD_HEADER = 14,    /**< an invalid header was given */
-        ACH_EACCES = 15         /**< permission denied */
+        ACH_EACCES = 15,        /**< permission denied */
+        ACH_EAGAIN = 16         /**< reliable channel is full */
     } ach_status_t;
 
 
@@ -278,6 +297,15 @@ extern "C" {
                 size_t index_head;       /**< index into index array of first unused index entry */
                 size_t index_free;       /**< number of unused index entries */
                 int anon;                /**< is channel in the heap? */
+                clockid_t clock;         /**< clock used to timestamp frames */
+                size_t sub_cnt;          /**< number of subscriber slots */
+                int reliable;            /**< don't overwrite frames unread by subscribers */
+                size_t slot_size;        /**< data bytes owned by each index entry
+                                          *   of a fixed-size channel, 0 otherwise */
+                int dedup;               /**< drop puts identical to the last frame */
+                uint64_t write_gen;      /**< anonymous channels: odd while a
+                                          *   writer changes the channel */
+                size_t refcnt;           /**< anonymous channels: open handles */
             };
             uint64_t reserved[16];  /**< Reserve to compatibly add future variables */
         };
@@ -296,14 +324,49 @@ extern "C" {
         size_t size;      /**< size of frame */
         size_t offset;    /**< byte offset of entry from beginning of data array */
         uint64_t seq_num; /**< number of frame */
+        struct timespec time; /**< when the frame was written, by the channel clock,
+                               *   or last refreshed in a dedup channel */
+        size_t range_cnt; /**< changed ranges stored after the frame by
+                           *   ach_put_patch(), 0 for whole frames */
     } ach_index_t ;
 
+    /** Entry in shared memory subscriber table
+     */
+    typedef struct {
+        pid_t pid;            /**< process holding the slot, 0 if the slot is free */
+        uint64_t seq_num;     /**< last sequence number read by the subscriber */
+        uint64_t missed;      /**< frames skipped over by the subscriber's reads */
+        struct timespec time; /**< when the subscriber last read, by the channel clock */
+    } ach_sub_t;
+
+    /** Description of one frame copied out by ach_get_window() */
+    typedef struct {
+        uint64_t seq_num;      /**< sequence number of the frame */
+        size_t size;           /**< size of the frame */
+        size_t offset;         /**< byte offset of the frame in the output buffer */
+        struct timespec time;  /**< when the frame was written */
+    } ach_frame_info_t;
+
+    /** A byte range of a frame */
+    typedef struct {
+        size_t offset;         /**< first byte of the range */
+        size_t size;           /**< number of bytes in the range */
+    } ach_range_t;
+
+    /** Bytes to write into a frame with ach_put_patch() */
+    typedef struct {
+        size_t offset;         /**< where in the frame to write */
+        size_t size;           /**< number of bytes to write */
+        const void *data;      /**< the new bytes */
+    } ach_patch_t;
+
 
     /** Attributes to pass to ach_open */
     typedef struct {
         union {
             struct{
-                int map_anon;        /**< anonymous channel (put it in process heap, not shm) */
+                int map_anon;        /**< anonymous channel (put it in process heap, not shm).
+                                      *   The last ach_close() frees it. */
                 ach_header_t *shm;   /**< the memory buffer used by anonymous channels */
             };
             uint64_t reserved_size[8]; /**< Reserve space to compatibly add future options */
@@ -314,12 +377,43 @@ extern "C" {
     typedef struct {
         union {
             struct{
-                int map_anon;      /**< allocate channel in heap, rather than shm */
+                int map_anon;      /**< allocate channel in heap, rather than
+                                    *   shm, for threads of this process.
+                                    *   It uses process-private locks and
+                                    *   non-waiting gets don't lock. */
                 ach_header_t *shm; /**< pointer to channel, set on output of create iff map_anon */
                 int truncate;      /**< remove and recreate an existing shm file */
                 int set_clock;     /**< if true, set the clock of the condition variable */
                 clockid_t clock;   /**< Which clock to use if set_clock is true.
-                                    *   The default is defined by ACH_DEFAULT_CLOCK. */
+                                    *   The default is defined by ACH_DEFAULT_CLOCK.
+                                    *   Frames are also timestamped by this clock. */
+                int reliable;      /**< if true, ach_put() won't overwrite
+                                    *   frames a registered subscriber has
+                                    *   not read, see ach_subscribe() */
+                size_t sub_cnt;    /**< Number of subscriber slots.  The
+                                    *   default is ACH_DEFAULT_SUB_COUNT
+                                    *   for reliable channels and 0
+                                    *   otherwise.  Give a non-reliable
+                                    *   channel slots to monitor
+                                    *   subscriber lag. */
+                int fixed_size;    /**< if true, frames are at most
+                                    *   frame_size bytes and each index
+                                    *   entry owns a data slot aligned
+                                    *   to ACH_SLOT_ALIGN,
+                                    *   making ach_put() a single copy */
+                int dedup;         /**< if true, a put identical to the
+                                    *   newest frame only refreshes that
+                                    *   frame's timestamp: it gets no new
+                                    *   sequence number and wakes no
+                                    *   subscribers */
+                int map_memfd;     /**< create the channel in an unnamed
+                                    *   memfd rather than /dev/shm.  The
+                                    *   name is only a label; share the
+                                    *   channel by passing fd, see
+                                    *   ach_open_fd() and ach_send_fd() */
+                int fd;            /**< descriptor of the channel, set on
+                                    *   output of create iff map_memfd.
+                                    *   The caller must close it. */
             };
             uint64_t reserved[16]; /**< Reserve space to compatibly add future options */
         };
@@ -336,6 +430,7 @@ extern "C" {
                 uint64_t seq_num;    /**< last sequence number read */
                 size_t next_index;   /**< next index entry to try get from */
                 ach_attr_t attr;     /**< attributes used to create this channel */
+                size_t sub_slot;     /**< one plus the index of our subscriber slot, 0 if unregistered */
             };
             uint64_t reserved[16]; /**< Reserve space to compatibly add future options */
         };
@@ -363,6 +458,13 @@ extern "C" {
 #define ACH_SHM_GUARD_DATA( shm )                                       \
     ((uint64_t*)(ACH_SHM_DATA(shm) + ((ach_header_t*)(shm))->data_size))
 
+/** Gets the pointer to the subscriber table in the shm block */
+#define ACH_SHM_SUB( shm ) ((ach_sub_t*)(ACH_SHM_GUARD_DATA(shm) + 1))
+
+/** Gets the pointer to the guard following the subscriber table in the shm block */
+#define ACH_SHM_GUARD_SUB( shm )                                        \
+    ((uint64_t*)(ACH_SHM_SUB(shm) + ((ach_header_t*)(shm))->sub_cnt))
+
 
     /** Initialize attributes for opening channels. */
     void ach_attr_init( ach_attr_t *attr );
@@ -387,6 +489,9 @@ extern "C" {
 /** Default nominal frame size for a channel */
 #define ACH_DEFAULT_FRAME_SIZE 512
 
+/** Default number of subscriber slots for a reliable channel */
+#define ACH_DEFAULT_SUB_COUNT 8
+
     /** Opens a handle to channel.
 
         \post A file descriptor for the named channel is opened, and
@@ -399,6 +504,38 @@ extern "C" {
     ach_open( ach_channel_t *chan, const char *channel_name,
               ach_attr_t *attr );
 
+    /** Opens a handle to the channel in file descriptor fd.
+
+        fd is typically a memfd channel from ach_create() with
+        map_memfd set, or one received with ach_recv_fd().  The
+        channel keeps its own duplicate of fd, so the caller may close
+        fd after this returns.
+
+        \return ACH_OK on success, ACH_BAD_SHM_FILE if fd does not hold
+        an ach channel.
+     */
+    enum ach_status
+    ach_open_fd( ach_channel_t *chan, int fd, ach_attr_t *attr );
+
+    /** Sends channel descriptor fd over UNIX domain socket sock.
+
+        The receiving process gets its own descriptor for the channel
+        with ach_recv_fd().
+     */
+    enum ach_status
+    ach_send_fd( int sock, int fd );
+
+    /** Receives a channel descriptor sent with ach_send_fd().
+
+        \param sock a UNIX domain socket
+        \param fd on success, the received descriptor.  Open it with
+        ach_open_fd() and then close it.
+        \return ACH_OK on success, ACH_CLOSED if the peer closed sock,
+        ACH_EINVAL if the message carried no descriptor.
+     */
+    enum ach_status
+    ach_recv_fd( int sock, int *fd );
+
     /** Pulls a message from the channel.
         \pre chan has been opened with ach_open()
 
@@ -424,6 +561,129 @@ extern "C" {
              const struct timespec *ACH_RESTRICT abstime,
              int options );
 
+    /** One channel of an ach_get_snapshot() */
+    typedef struct {
+        ach_channel_t *chan;    /**< channel to read */
+        void *buf;              /**< buffer for the frame */
+        size_t size;            /**< length of buf in bytes */
+        size_t frame_size;      /**< output, as for ach_get() */
+        enum ach_status result; /**< output, as for ach_get() */
+    } ach_snapshot_t;
+
+    /** Gets the latest frame of several channels at one instant.
+
+        The channels are locked together, in order of channel name,
+        and then each is read as by ach_get() with ACH_O_LAST, so no
+        put to any of them can land between the reads.  Hold the
+        locks only briefly: puts to all the channels wait meanwhile.
+
+        \param snap Channels to read, and their buffers and results
+        \param cnt Number of elements in snap
+        \param options Option flags as for ach_get(), ACH_O_LAST is
+        implied and ACH_O_WAIT is not allowed.  Pass ACH_O_COPY to
+        get the latest frames even if already seen.
+        \return ACH_OK if every channel gives ACH_OK or
+        ACH_MISSED_FRAME, otherwise the first other result.
+        ACH_EINVAL if a channel is repeated.
+    */
+    enum ach_status
+    ach_get_snapshot( ach_snapshot_t *snap, size_t cnt, int options );
+
+    /** Buffer allocator for ach_get_alloc().
+
+        \param cx The context pointer given to ach_get_alloc()
+        \param size Size of the frame about to be copied
+        \return A buffer of at least size bytes, or NULL if none is
+        available.
+    */
+    typedef void *(*ach_alloc_fun_t)( void *cx, size_t size );
+
+    /** Pulls a message from the channel into a buffer from alloc.
+
+        Behaves like ach_get(), except that the destination is
+        obtained by calling alloc with the size of the frame once it
+        has been located.  The frame is copied in the same pass, so a
+        large frame is never lost to a newer put between an
+        ACH_OVERFLOW and a retry.
+
+        alloc is called while holding the channel lock.  It should
+        only provide memory, e.g. by growing a buffer kept in cx, and
+        must not call back into ach on this channel.
+
+        \param chan The previously opened channel handle
+        \param alloc Allocator for the destination buffer
+        \param cx Context pointer passed to alloc
+        \param frame_size The number of bytes copied
+        \param abstime An absolute timeout if ACH_O_WAIT is specified.
+        \param options Option flags, as for ach_get()
+        \return As ach_get(), or ACH_OVERFLOW if alloc returns NULL,
+        in which case chan is not advanced.
+    */
+    enum ach_status
+    ach_get_alloc( ach_channel_t *chan, ach_alloc_fun_t alloc, void *cx,
+                   size_t *frame_size,
+                   const struct timespec *ACH_RESTRICT abstime,
+                   int options );
+
+    /** Reader for ach_get_view().
+
+        \param cx The context pointer given to ach_get_view()
+        \param frame The frame, in place in the channel
+        \param size Size of the frame
+    */
+    typedef void (*ach_view_fun_t)( void *cx, const void *frame, size_t size );
+
+    /** Reads a message of a fixed-size channel in place.
+
+        Picks a frame like ach_get() and calls fun on it while
+        holding the channel lock, rather than copying it out.  Frames
+        of a fixed-size channel are never split by the end of the
+        ring, see ach_create_attr_t::fixed_size.
+
+        fun should be short, since it blocks writers, and must not
+        call back into ach on this channel.
+
+        \return As ach_get(), or ACH_EINVAL if chan is not a
+        fixed-size channel.
+    */
+    enum ach_status
+    ach_get_view( ach_channel_t *chan, ach_view_fun_t fun, void *cx,
+                  const struct timespec *ACH_RESTRICT abstime,
+                  int options );
+
+    /** A frame in place in the channel, from ach_get_ref(). */
+    typedef struct ach_frame_ref {
+        uint64_t seq_num;       /**< sequence number of the frame */
+        const void *data[2];    /**< the frame, split where it wraps
+                                 *   around the end of the ring */
+        size_t size[2];         /**< bytes in each part, size[1] may be 0 */
+    } ach_frame_ref_t;
+
+    /** Finds the next message in place, without copying it or
+        advancing the handle.
+
+        A publisher to a reliable channel does not overwrite frames a
+        subscriber has not read, so the frame stays valid after the
+        lock is released.  Use it, e.g. to write it to a socket, then
+        call ach_seek() with ref->seq_num to move past it.
+        ach_resize() lays frames out again, so do not resize the
+        channel while holding a reference.
+
+        \pre chan is subscribed, see ach_subscribe(), to a reliable
+        channel
+
+        \param chan The previously opened channel handle
+        \param ref Output, the frame
+        \param abstime An absolute timeout if ACH_O_WAIT is specified.
+        \param options ACH_O_WAIT or 0
+        \return As ach_get(), or ACH_EINVAL if chan is not subscribed
+        to a reliable channel or options include ACH_O_LAST or ACH_O_COPY.
+    */
+    enum ach_status
+    ach_get_ref( ach_channel_t *chan, ach_frame_ref_t *ref,
+                 const struct timespec *ACH_RESTRICT abstime,
+                 int options );
+
     /** Writes a new message in the channel.
 
         \pre chan has been opened with ach_open()
@@ -439,6 +699,235 @@ extern "C" {
     enum ach_status
     ach_put( ach_channel_t *chan, const void *buf, size_t len );
 
+    /** Writes a new message in the channel, waiting for room in a reliable channel.
+
+        On a reliable channel, ach_put() returns ACH_EAGAIN rather
+        than overwrite frames that a registered subscriber has not
+        yet read.  This waits instead until the subscribers catch up.
+        On other channels, this is the same as ach_put().
+
+        \param chan (action) The channel to write to
+        \param buf The buffer containing the data to copy into the channel
+        \param len number of bytes in buf to copy, len > 0
+        \param abstime An absolute timeout, or NULL to wait forever.
+        Take care that abstime is given in the correct clock.
+        \return ACH_OK on success, ACH_TIMEOUT if abstime passes first.
+    */
+    enum ach_status
+    ach_put_wait( ach_channel_t *chan, const void *buf, size_t len,
+                  const struct timespec *ACH_RESTRICT abstime );
+
+    /** One channel of an ach_put_group() */
+    typedef struct {
+        ach_channel_t *chan;    /**< channel to write */
+        const void *buf;        /**< the frame */
+        size_t len;             /**< length of the frame, len > 0 */
+    } ach_put_item_t;
+
+    /** Writes frames to several channels as one transaction.
+
+        All the channels are write locked, in order of channel name,
+        before any frame is written, and unlocked after all are
+        written.  A reader using ach_get_snapshot() on the same
+        channels sees either every frame of the group or none.  If
+        any put would fail, e.g. with ACH_OVERFLOW or ACH_EAGAIN on a
+        full reliable channel, nothing is written.
+
+        \param item Channels and frames to write
+        \param cnt Number of elements in item
+        \return ACH_OK on success, ACH_EINVAL if a channel is
+        repeated, or the error of the first put that would fail.
+    */
+    enum ach_status
+    ach_put_group( const ach_put_item_t *item, size_t cnt );
+
+    /** Publishes a copy of the newest frame with some bytes changed.
+
+        The new frame has the size of the newest frame.  Its bytes are
+        copied within the channel, and only the patched ranges are
+        copied from the caller.  The list of patched ranges is stored
+        with the frame for ach_get_ranges().
+
+        The unchanged bytes are still copied, but within shared
+        memory, so callers need not keep or touch a full copy of the
+        frame.  If the new frame would overwrite the newest frame, the
+        newest frame is first staged through a temporary buffer.  In a
+        fixed-size channel, the ranges are kept only if they fit in
+        the slot after the frame.
+
+        \param chan The channel to write to
+        \param patch Array of changes, applied in order
+        \param patch_cnt Number of elements in patch
+        \return ACH_OK on success, ACH_STALE_FRAMES if the channel
+        is empty, ACH_EINVAL if a patch lies outside the frame,
+        ACH_OVERFLOW if the frame and range list do not fit, or
+        ACH_EAGAIN on a full reliable channel.
+    */
+    enum ach_status
+    ach_put_patch( ach_channel_t *chan, const ach_patch_t *patch, size_t patch_cnt );
+
+    /** Gets the byte ranges changed by a frame.
+
+        For a frame published with ach_put_patch(), these are the
+        patched ranges.  For any other frame, the single range is the
+        whole frame.
+
+        \param chan The previously opened channel handle
+        \param seq_num Sequence number of the frame
+        \param ranges Array to receive the ranges
+        \param cnt Number of elements in ranges
+        \param range_cnt Output, number of changed ranges
+        \return ACH_OK on success, ACH_OVERFLOW if there are more
+        than cnt ranges, or ACH_MISSED_FRAME / ACH_STALE_FRAMES as for
+        ach_get_seq().
+    */
+    enum ach_status
+    ach_get_ranges( ach_channel_t *chan, uint64_t seq_num,
+                    ach_range_t *ranges, size_t cnt, size_t *range_cnt );
+
+    /** Registers chan as a subscriber in the channel's subscriber table.
+
+        The slot records the sequence number and time of the last
+        frame read through chan, starting from the current position
+        of chan, and counts the frames skipped between reads.  On
+        a reliable channel, publishers will not overwrite frames
+        beyond that position.  Registration is dropped by
+        ach_unsubscribe() or ach_close().
+
+        Slots of processes that have exited without unsubscribing are
+        reclaimed first.
+
+        \return ACH_OK on success, or ACH_OVERFLOW if all slots are taken.
+    */
+    enum ach_status
+    ach_subscribe( ach_channel_t *chan );
+
+    /** Releases the subscriber slot held by chan. */
+    enum ach_status
+    ach_unsubscribe( ach_channel_t *chan );
+
+    /** Copies out the registered subscribers of a channel.
+
+        Slots held by processes that no longer exist are reclaimed
+        first.  A subscriber's lag is last_seq minus its seq_num.
+
+        \param chan The previously opened channel handle
+        \param subs Array to receive the subscriber slots
+        \param cnt Number of elements in subs
+        \param sub_cnt Output, number of registered subscribers
+        \param last_seq Output, sequence number of the newest frame
+        \return ACH_OK on success, or ACH_OVERFLOW if there are more
+        than cnt subscribers.  On ACH_OVERFLOW, sub_cnt is still set
+        and the first cnt subscribers are copied.
+    */
+    enum ach_status
+    ach_get_subs( ach_channel_t *chan, ach_sub_t *subs, size_t cnt,
+                  size_t *sub_cnt, uint64_t *last_seq );
+
+    /** Grows a channel in place.
+
+        The backing file is extended and the retained frames are laid
+        out again to make room for frame_cnt index entries and
+        frame_cnt*frame_size data bytes.  Frames, their changed ranges
+        from ach_put_patch(), and sequence numbers are preserved.  Other handles to the channel remap it the next
+        time they lock it, so open subscribers and publishers need not
+        reopen.  Channels only grow; asking for a smaller index or
+        data area is an error.
+
+        \param chan The previously opened channel handle
+        \param frame_cnt New number of frames to buffer
+        \param frame_size New nominal size of each frame
+        \return ACH_OK on success, or ACH_EINVAL if the channel would
+        shrink or is anonymous.
+    */
+    enum ach_status
+    ach_resize( ach_channel_t *chan, size_t frame_cnt, size_t frame_size );
+
+    /** Copies a specific frame out of the channel by sequence number.
+
+        The index entry holding the frame is computed directly from
+        the channel head, so this does not scan the index.  Unlike
+        ach_get(), the seq_num and next_index fields of chan are not
+        modified.
+
+        \pre chan has been opened with ach_open()
+
+        \param chan The previously opened channel handle
+        \param seq_num Sequence number of the desired frame
+        \param buf Buffer to store data
+        \param size Length of buffer in bytes
+        \param frame_size The number of bytes copied to buf, or the
+        size of the desired frame if buf is too small.
+
+        \return ACH_OK if the frame was copied, ACH_OVERFLOW if buf is
+        too small, ACH_MISSED_FRAME if the frame has already been
+        overwritten, ACH_STALE_FRAMES if the frame has not yet been
+        published, or ACH_EINVAL if seq_num is zero.
+    */
+    enum ach_status
+    ach_get_seq( ach_channel_t *chan, uint64_t seq_num,
+                 void *buf, size_t size, size_t *frame_size );
+
+    /** Gives the range of sequence numbers currently held in the channel.
+
+        \param chan The previously opened channel handle
+        \param oldest The sequence number of the oldest retained frame
+        \param newest The sequence number of the newest retained frame
+
+        \return ACH_OK, or ACH_STALE_FRAMES if the channel holds no
+        frames, in which case oldest is one greater than newest.
+    */
+    enum ach_status
+    ach_seq_range( ach_channel_t *chan, uint64_t *oldest, uint64_t *newest );
+
+    /** Positions the handle just after a given frame.
+
+        The next ach_get() without ACH_O_LAST returns frame seq_num+1,
+        or the oldest retained frame if that one has been overwritten.
+        This resumes reading where an earlier handle left off, as
+        ach_flush() skips to the newest frame.
+
+        \param chan The previously opened channel handle
+        \param seq_num Sequence number of the last frame already read,
+        or zero to read from the oldest frame
+
+        \return ACH_OK, ACH_MISSED_FRAME if frame seq_num+1 has been
+        overwritten, in which case the handle is still positioned, or
+        ACH_EINVAL if seq_num is newer than the newest frame.
+    */
+    enum ach_status
+    ach_seek( ach_channel_t *chan, uint64_t seq_num );
+
+    /** Copies all frames written within a time window out of the channel.
+
+        Frames are timestamped by the channel clock when they are
+        written.  The index is binary searched for the window and the
+        matching frames are copied in order, under a single lock, into
+        buf one after another.  info[i] describes the i'th copied
+        frame.  The handle's read position is not modified.
+
+        \param chan The previously opened channel handle
+        \param t0 Start of the window, inclusive, or NULL for the oldest frame
+        \param t1 End of the window, inclusive, or NULL for the newest frame
+        \param buf Buffer to store data
+        \param size Length of buffer in bytes
+        \param info Array to describe the copied frames
+        \param info_cnt Number of elements in info
+        \param frame_cnt The number of frames in the window
+        \param frame_bytes The total size of the frames in the window
+
+        \return ACH_OK if the frames were copied, ACH_STALE_FRAMES if
+        no frames are in the window, or ACH_OVERFLOW if buf or info is
+        too small, in which case nothing is copied but frame_cnt and
+        frame_bytes are still set.
+    */
+    enum ach_status
+    ach_get_window( ach_channel_t *chan,
+                    const struct timespec *t0, const struct timespec *t1,
+                    void *buf, size_t size,
+                    ach_frame_info_t *info, size_t info_cnt,
+                    size_t *frame_cnt, size_t *frame_bytes );
+
 
     /** Discards all previously received messages for this handle.  Does
         not change the actual channel, just resets the sequence number in
@@ -0,0 +1,242 @@
+/* -*- mode: C++; c-basic-offset: 4 -*- */
+/* ex: set shiftwidth=4 tabstop=4 expandtab: */
+/*
+ * Copyright (c) 2008-2012, Georgia Tech Research Corporation
+ * All rights reserved.
+ *
+ * Author(s): Neil T. Dantam <ntd@gatech.edu>
+ * Georgia Tech Humanoid Robotics Lab
+ * Under Direction of Prof. Mike Stilman <mstilman@cc.gatech.edu>
+ *
+ *
+ * This file is provided under the following "BSD-style" License:
+ *
+ *
+ *   Redistribution and use in source and binary forms, with or
+ *   without modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *   USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ *   AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/** \file ach.hpp
+ *  \author Neil T. Dantam
+ *
+ * Typed C++ interface to ach channels.  Requires C++11.
+ */
+
+#ifndef ACH_HPP
+#define ACH_HPP
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <string.h>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "ach.h"
+#include "ach_inline.h"
+
+/** C++ interface to ach */
+namespace ach {
+
+    /** Thrown when a channel cannot be created or opened */
+    class error : public std::runtime_error {
+    public:
+        /** The error, and the call that failed */
+        error( enum ach_status r, const char *call ) :
+            std::runtime_error( std::string(call) + ": " + ach_result_to_string(r) ),
+            status(r) {}
+
+        enum ach_status status; /**< what went wrong */
+    };
+
+    /** A channel whose frames are each one T.
+     *
+     * The frame size is sizeof(T), so puts and gets need no size
+     * argument.  The handle is opened by the constructor and closed by
+     * the destructor.
+     */
+    template<typename T>
+    class channel {
+        static_assert( std::is_trivially_copyable<T>::value,
+                       "ach::channel frames must be trivially copyable" );
+
+    public:
+        /** Creates channel name holding frame_cnt frames of T.
+         *
+         * The channel is fixed-size, see
+         * ach_create_attr_t::fixed_size, so put() is inline and
+         * view() reads in place.  Output fields of attr, such as shm
+         * for an anonymous channel, are filled in as by ach_create().
+         */
+        static void create( const char *name, size_t frame_cnt,
+                            ach_create_attr_t *attr = NULL ) {
+            ach_create_attr_t a;
+            if( attr ) a = *attr;
+            else ach_create_attr_init( &a );
+            a.fixed_size = 1;
+            enum ach_status r = ach_create( name, frame_cnt, sizeof(T), &a );
+            if( ACH_OK != r ) throw error( r, "ach_create" );
+            if( attr ) *attr = a;
+        }
+
+        /** Opens channel name, as ach_open() */
+        explicit channel( const char *name, ach_attr_t *attr = NULL ) {
+            enum ach_status r = ach_open( &chan_, name, attr );
+            if( ACH_OK != r ) throw error( r, "ach_open" );
+        }
+
+        /** Closes the channel */
+        ~channel() {
+            ach_close( &chan_ );
+        }
+
+        channel( const channel & ) = delete;
+        channel &operator=( const channel & ) = delete;
+
+        /** Puts x in the channel, as ach_put() */
+        enum ach_status put( const T &x ) {
+            return ach_put_inline( &chan_, &x, sizeof(T) );
+        }
+
+        /** Copies the newest frame to x, as ach_get() with ACH_O_LAST.
+         *
+         * \return As ach_get(), or ACH_OVERFLOW if the frame is not
+         * the size of a T, leaving x unchanged.
+         */
+        enum ach_status latest( T &x ) {
+            frame_buf b;
+            size_t frame_size;
+            enum ach_status r = ach_get_last_inline( &chan_, b.bytes, sizeof(T),
+                                                     &frame_size );
+            return assign( x, b, size_ok( r, frame_size ) );
+        }
+
+        /** Copies a frame to x, as ach_get().
+         *
+         * \return As ach_get(), or ACH_OVERFLOW if the frame is not
+         * the size of a T, leaving x unchanged.
+         */
+        enum ach_status get( T &x, int options,
+                             const struct timespec *abstime = NULL ) {
+            frame_buf b;
+            enum ach_status r = get_buf( b, options, abstime );
+            return assign( x, b, r );
+        }
+
+        /** Calls f with a const T& to a frame, picked as ach_get().
+         *
+         * Frames of a fixed-size channel are read in place, under the
+         * channel lock, see ach_get_view().  Other channels, and any T
+         * aligned more strictly than ACH_SLOT_ALIGN, are copied
+         * first.  f is not called if the frame is not the size of a
+         * T, and ACH_OVERFLOW is returned.  An exception thrown by f
+         * propagates once the channel is unlocked.
+         */
+        template<typename F>
+        enum ach_status view( F f, int options = ACH_O_LAST,
+                              const struct timespec *abstime = NULL ) {
+            if( chan_.shm->slot_size && alignof(T) <= ACH_SLOT_ALIGN ) {
+                view_cx<F> cx = { &f, true, std::exception_ptr() };
+                enum ach_status r = ach_get_view( &chan_, &view_call<F>, &cx,
+                                                  abstime, options );
+                if( cx.err ) std::rethrow_exception( cx.err );
+                if( (ACH_OK == r || ACH_MISSED_FRAME == r) && ! cx.size_ok ) {
+                    return ACH_OVERFLOW;
+                }
+                return r;
+            } else {
+                frame_buf b;
+                enum ach_status r = get_buf( b, options, abstime );
+                if( ACH_OK == r || ACH_MISSED_FRAME == r ) {
+                    f( *reinterpret_cast<const T*>(b.bytes) );
+                }
+                return r;
+            }
+        }
+
+        /** The underlying handle, for the rest of the C API */
+        ach_channel_t *handle() { return &chan_; }
+
+    private:
+        ach_channel_t chan_;
+
+        enum ach_status size_ok( enum ach_status r, size_t frame_size ) {
+            if( (ACH_OK == r || ACH_MISSED_FRAME == r) && sizeof(T) != frame_size ) {
+                return ACH_OVERFLOW;
+            }
+            return r;
+        }
+
+        /* Storage for one frame, so T needs no default constructor
+         * and a short frame never lands in the caller's T */
+        struct frame_buf {
+            alignas(T) unsigned char bytes[sizeof(T)];
+        };
+
+        enum ach_status get_buf( frame_buf &b, int options,
+                                 const struct timespec *abstime ) {
+            size_t frame_size;
+            enum ach_status r = ach_get( &chan_, b.bytes, sizeof(T), &frame_size,
+                                         abstime, options );
+            return size_ok( r, frame_size );
+        }
+
+        static enum ach_status assign( T &x, const frame_buf &b, enum ach_status r ) {
+            if( ACH_OK == r || ACH_MISSED_FRAME == r ) memcpy( &x, b.bytes, sizeof(T) );
+            return r;
+        }
+
+        template<typename F>
+        struct view_cx {
+            F *f;
+            bool size_ok;
+            std::exception_ptr err;  /**< thrown by f, rethrown unlocked */
+        };
+
+        template<typename F>
+        /* Runs under the channel lock inside C code, so nothing may
+         * unwind out of it */
+        static void view_call( void *cx, const void *frame, size_t size ) noexcept {
+            view_cx<F> *v = static_cast<view_cx<F>*>(cx);
+            if( sizeof(T) == size ) {
+                try {
+                    (*v->f)( *static_cast<const T*>(frame) );
+                } catch( ... ) {
+                    v->err = std::current_exception();
+                }
+            } else {
+                v->size_ok = false;
+            }
+        }
+    };
+
+}
+
+#endif /* ACH_HPP */
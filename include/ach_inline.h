@@ -0,0 +1,228 @@
+/* -*- mode: C; c-basic-offset: 4 -*- */
+/* ex: set shiftwidth=4 tabstop=4 expandtab: */
+/*
+ * Copyright (c) 2008-2012, Georgia Tech Research Corporation
+ * All rights reserved.
+ *
+ * Author(s): Neil T. Dantam <ntd@gatech.edu>
+ * Georgia Tech Humanoid Robotics Lab
+ * Under Direction of Prof. Mike Stilman <mstilman@cc.gatech.edu>
+ *
+ *
+ * This file is provided under the following "BSD-style" License:
+ *
+ *
+ *   Redistribution and use in source and binary forms, with or
+ *   without modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *   USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ *   AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/** \file ach_inline.h
+ *  \author Neil T. Dantam
+ *
+ * Inline versions of the most common channel operations.
+ *
+ * These skip the library call and option decoding for the simple
+ * cases of a hot loop and call into the library for everything else,
+ * so they may be mixed freely with the regular functions.  They work
+ * on the same shared memory layout and locking as ach.c and must be
+ * kept in sync with it.
+ */
+
+#ifndef ACH_INLINE_H
+#define ACH_INLINE_H
+
+#include <string.h>
+#include <pthread.h>
+#include "ach.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** Do the guard bytes of shm look right? */
+    static inline int ach_inline_guards_ok( ach_header_t *shm ) {
+        return ACH_SHM_MAGIC_NUM == shm->magic &&
+            ACH_SHM_GUARD_HEADER_NUM == *ACH_SHM_GUARD_HEADER(shm) &&
+            ACH_SHM_GUARD_INDEX_NUM == *ACH_SHM_GUARD_INDEX(shm) &&
+            ACH_SHM_GUARD_DATA_NUM == *ACH_SHM_GUARD_DATA(shm) &&
+            ACH_SHM_GUARD_SUB_NUM == *ACH_SHM_GUARD_SUB(shm);
+    }
+
+    /** Copies len bytes at offset in the data area, wrapping around
+     *  the end. */
+    static inline void ach_inline_ring_read( ach_header_t *shm, size_t offset,
+                                             void *buf, size_t len ) {
+        uint8_t *data = ACH_SHM_DATA(shm);
+        size_t end_cnt = shm->data_size - offset;
+        if( len <= end_cnt ) {
+            memcpy( buf, data + offset, len );
+        } else {
+            memcpy( buf, data + offset, end_cnt );
+            memcpy( (uint8_t*)buf + end_cnt, data, len - end_cnt );
+        }
+    }
+
+    /** Same as ach_get() with options ACH_O_LAST.
+     *
+     * Anonymous channels are read without the lock.  Channels that
+     * have been resized, or where chan holds a subscriber slot, go
+     * through ach_get().
+     */
+    static inline enum ach_status
+    ach_get_last_inline( ach_channel_t *chan, void *buf, size_t size,
+                         size_t *frame_size ) {
+        ach_header_t *shm = chan->shm;
+        enum ach_status r;
+        size_t i, len = 0;
+        uint64_t seq = 0;
+
+        if( chan->sub_slot ) goto LIBRARY;
+
+        if( shm->anon ) {
+            /* see get_lockfree() in ach.c */
+            uint64_t gen = __atomic_load_n( &shm->write_gen, __ATOMIC_ACQUIRE );
+            if( gen & 1 ) goto LIBRARY;
+            uint64_t last_seq = __atomic_load_n( &shm->last_seq, __ATOMIC_RELAXED );
+            i = (shm->index_head + shm->index_cnt - 1) % shm->index_cnt;
+            if( chan->seq_num == last_seq || 0 == last_seq ) {
+                r = ACH_STALE_FRAMES;
+            } else {
+                const volatile ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+                size_t offset = idx->offset;
+                len = idx->size;
+                seq = idx->seq_num;
+                if( offset >= shm->data_size || len > shm->data_size ||
+                    seq <= chan->seq_num ) {
+                    goto LIBRARY;
+                }
+                if( NULL == buf || len > size ) {
+                    r = ACH_OVERFLOW;
+                } else {
+                    ach_inline_ring_read( shm, offset, buf, len );
+                    r = (seq > chan->seq_num + 1) ? ACH_MISSED_FRAME : ACH_OK;
+                }
+            }
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+            if( __atomic_load_n( &shm->write_gen, __ATOMIC_RELAXED ) != gen ) {
+                goto LIBRARY;
+            }
+        } else {
+            if( pthread_mutex_lock( &shm->sync.mutex ) ) goto LIBRARY;
+            if( shm->len != chan->len || ! ach_inline_guards_ok(shm) ) {
+                pthread_mutex_unlock( &shm->sync.mutex );
+                goto LIBRARY;
+            }
+            i = (shm->index_head + shm->index_cnt - 1) % shm->index_cnt;
+            if( chan->seq_num == shm->last_seq || 0 == shm->last_seq ) {
+                r = ACH_STALE_FRAMES;
+            } else {
+                ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+                len = idx->size;
+                seq = idx->seq_num;
+                if( NULL == buf || len > size ) {
+                    r = ACH_OVERFLOW;
+                } else {
+                    ach_inline_ring_read( shm, idx->offset, buf, len );
+                    r = (seq > chan->seq_num + 1) ? ACH_MISSED_FRAME : ACH_OK;
+                }
+            }
+            pthread_mutex_unlock( &shm->sync.mutex );
+        }
+
+        if( ACH_STALE_FRAMES != r ) *frame_size = len;
+        if( ACH_OK == r || ACH_MISSED_FRAME == r ) {
+            chan->seq_num = seq;
+            chan->next_index = (i + 1) % shm->index_cnt;
+        }
+        return r;
+
+    LIBRARY:
+        return ach_get( chan, buf, size, frame_size, NULL, ACH_O_LAST );
+    }
+
+    /** Same as ach_put().
+     *
+     * Frames of a fixed-size channel, see
+     * ach_create_attr_t::fixed_size, are put inline.  Reliable and
+     * dedup channels, variable-size channels, and resized channels go
+     * through ach_put().
+     */
+    static inline enum ach_status
+    ach_put_inline( ach_channel_t *chan, const void *buf, size_t len ) {
+        ach_header_t *shm = chan->shm;
+        if( NULL == buf || 0 == len ||
+            0 == shm->slot_size || len > shm->slot_size ||
+            shm->reliable || shm->dedup ) {
+            goto LIBRARY;
+        }
+
+        if( pthread_mutex_lock( &shm->sync.mutex ) ) goto LIBRARY;
+        if( shm->len != chan->len || ! ach_inline_guards_ok(shm) ||
+            len > shm->slot_size ) {
+            pthread_mutex_unlock( &shm->sync.mutex );
+            goto LIBRARY;
+        }
+
+        /* see set_dirty() in ach.c */
+        shm->sync.dirty = 1;
+        if( shm->anon ) {
+            __atomic_store_n( &shm->write_gen, shm->write_gen + 1, __ATOMIC_RELAXED );
+            __atomic_thread_fence( __ATOMIC_RELEASE );
+        }
+
+        /* see put_fixed() in ach.c */
+        {
+            ach_index_t *idx = ACH_SHM_INDEX(shm) + shm->index_head;
+            idx->offset = shm->index_head * shm->slot_size;
+            shm->last_seq++;
+            idx->seq_num = shm->last_seq;
+            idx->size = len;
+            idx->range_cnt = 0;
+            clock_gettime( shm->clock, &idx->time );
+            shm->index_head = (shm->index_head + 1) % shm->index_cnt;
+            if( shm->index_free ) shm->index_free --;
+            memcpy( ACH_SHM_DATA(shm) + idx->offset, buf, len );
+        }
+
+        /* see clear_dirty() and unwrlock() in ach.c */
+        shm->sync.dirty = 0;
+        if( shm->anon ) {
+            __atomic_store_n( &shm->write_gen, shm->write_gen + 1, __ATOMIC_RELEASE );
+        }
+        pthread_mutex_unlock( &shm->sync.mutex );
+        pthread_cond_broadcast( &shm->sync.cond );
+        return ACH_OK;
+
+    LIBRARY:
+        return ach_put( chan, buf, len );
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACH_INLINE_H */
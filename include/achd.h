@@ -45,12 +45,22 @@
 #define ACHD_PORT 8076
 #define INIT_BUF_SIZE 512
 
-#define ACHD_REFORK_NS 1000000000
-
 #define ACHD_RECONNECT_NS (250 * 1000 * 1000)
 
 #define ACHD_LINE_LENGTH 1024
 
+/* Channel ids available on one multiplexed connection */
+#define ACHD_MUX_CHANNELS 1024
+
+/* Most UDP datagrams covered by one parity datagram */
+#define ACHD_FEC_GROUP_MAX 32
+
+/* Default wait for coalesced TCP frames, microseconds */
+#define ACHD_COALESCE_US 1000
+
+/* Most bytes of TCP frames coalesced into one write */
+#define ACHD_COALESCE_MAX (4 * 1024 * 1024)
+
 #ifdef __GNUC__
 #define ACHD_ATTR_PRINTF(m,n) __attribute__((format(printf, m, n)))
 #else
@@ -69,7 +79,8 @@ enum achd_mode {
     ACHD_MODE_VOID = 0,
     ACHD_MODE_SERVE,
     ACHD_MODE_PUSH,
-    ACHD_MODE_PULL
+    ACHD_MODE_PULL,
+    ACHD_MODE_LISTEN
 };
 
 struct achd_headers {
@@ -80,17 +91,34 @@ struct achd_headers {
     int local_port;
     int remote_port;
     int tcp_nodelay;
+    int fec_group;
+    int coalesce_bytes;     /**< write TCP frames together up to this many bytes */
+    int coalesce_us;        /**< holding the first one at most this long */
+    int in_place;           /**< send reliable channel frames from the ring */
     int retry;
     int get_last;
+    int resume;             /**< frames carry sequence numbers */
+    uint64_t resume_seq;    /**< last frame the puller has */
     int retry_delay_us;
     int64_t period_ns;
     const char *remote_host;
     const char *transport;
+    const char *multicast_group;
+    int has_multicast_token;
+    uint64_t multicast_token;   /**< marks the channel's datagrams in the group */
     enum achd_direction direction;
     enum ach_status status;
     const char *message;
 };
 
+/* Bytes read from a stream but not consumed yet, such as the start
+ * of the first frame when it arrives with the headers */
+struct achd_rbuf {
+    size_t start;
+    size_t end;
+    char data[ACHD_LINE_LENGTH];
+};
+
 struct achd_conn;
 
 typedef void (*achd_io_handler_t) (struct achd_conn*);
@@ -115,6 +143,7 @@ struct achd_conn {
     ach_channel_t channel;
     int in;
     int out;
+    struct achd_rbuf rbuf;
 
     size_t pipeframe_size;
     ach_pipe_frame_t *pipeframe;
@@ -127,10 +156,13 @@ struct achd_conn {
 int achd_reconnect( struct achd_conn *conn );
 
 
-enum ach_status achd_parse_headers(int fd, struct achd_headers *headers);
+enum ach_status achd_parse_headers(int fd, struct achd_rbuf *rbuf, struct achd_headers *headers);
+enum ach_status achd_parse_header_line(char *line, struct achd_headers *headers, int *done);
 
 void achd_serve(void);
+void achd_listen(void);
 void achd_client(void);
+void achd_daemonize(void);
 
 /* logging and error handlers */
 void achd_log( int level, const char fmt[], ...)          ACHD_ATTR_PRINTF(2,3);
@@ -141,18 +173,25 @@ void achd_error_log( enum ach_status code, const char fmt[], ... )    ACHD_ATTR_
 /* basic i/o */
 ssize_t achd_read(int fd, void *buf, size_t cnt );
 ssize_t achd_write(int fd, const void *buf, size_t cnt );
-enum ach_status achd_readline(int fd, char *buf, size_t n );
+struct iovec;
+ssize_t achd_writev(int fd, struct iovec *iov, int iovcnt );
+ssize_t achd_read_buffered(int fd, struct achd_rbuf *rbuf, void *buf, size_t cnt );
+enum ach_status achd_readline(int fd, struct achd_rbuf *rbuf, char *buf, size_t n );
 enum ach_status achd_printf(int fd, const char fmt[], ...) ACHD_ATTR_PRINTF(2,3);
 
 /* i/o handlers */
 
 int achd_connect_nop( struct achd_conn *conn );
 int achd_udp_sock( struct achd_conn *conn );
+int achd_mcast_sock( struct achd_conn *conn );
 
 void achd_push_tcp( struct achd_conn *);
 void achd_pull_tcp( struct achd_conn *);
 void achd_push_udp( struct achd_conn *);
 void achd_pull_udp( struct achd_conn *);
+void achd_push_mcast( struct achd_conn *);
+void achd_pull_mcast( struct achd_conn *);
+void achd_mux( struct achd_conn *);
 
 
 struct achd_cx {
@@ -163,6 +202,10 @@ struct achd_cx {
     int port;
     int reconnect;
     const char *pidfile;
+    const char *mcast_group;     /** Multicast group to publish to */
+    double udp_loss;             /** Share of UDP datagrams to drop, for testing, from ACHD_UDP_LOSS */
+    const char **mux_chans;      /** Channels from command line, for mux */
+    size_t mux_chan_cnt;
     sig_atomic_t sig_received;
     void (*error)(enum ach_status code, const char fmt[], ...);
 };
@@ -82,6 +82,7 @@ ACH_EINVAL         = c_int.in_dll( libach, "ach_einval" ).value
 ACH_CORRUPT        = c_int.in_dll( libach, "ach_corrupt" ).value
 ACH_BAD_HEADER     = c_int.in_dll( libach, "ach_bad_header" ).value
 ACH_EACCES         = c_int.in_dll( libach, "ach_eacces" ).value
+ACH_EAGAIN         = c_int.in_dll( libach, "ach_eagain" ).value
 ACH_O_WAIT         = c_int.in_dll( libach, "ach_o_wait" ).value
 ACH_O_LAST         = c_int.in_dll( libach, "ach_o_last" ).value
 
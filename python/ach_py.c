@@ -265,6 +265,7 @@ get_buf( PyObject *self, PyObject *args ) {
     case ACH_CORRUPT:
     case ACH_BAD_HEADER:
     case ACH_EACCES:
+    case ACH_EAGAIN:
         return raise_error(r);
     }
 
@@ -401,6 +402,7 @@ PyMODINIT_FUNC initach_py() {
     PyModule_AddObject( m, "ACH_CORRUPT",          PyInt_FromLong( ACH_CORRUPT ) );
     PyModule_AddObject( m, "ACH_BAD_HEADER",       PyInt_FromLong( ACH_BAD_HEADER ) );
     PyModule_AddObject( m, "ACH_EACCES",           PyInt_FromLong( ACH_EACCES ) );
+    PyModule_AddObject( m, "ACH_EAGAIN",           PyInt_FromLong( ACH_EAGAIN ) );
     PyModule_AddObject( m, "ACH_O_WAIT",           PyInt_FromLong( ACH_O_WAIT ) );
     PyModule_AddObject( m, "ACH_O_LAST",           PyInt_FromLong( ACH_O_LAST ) );
     PyModule_AddObject( m, "ACH_DEFAULT_FRAME_SIZE",   PyInt_FromLong( ACH_DEFAULT_FRAME_SIZE ) );
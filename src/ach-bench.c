@@ -71,6 +71,13 @@ size_t RECV_RT = 1;
 size_t RECV_NRT = 0;
 size_t SEND_RT = 1;
 int PASS_NO_RT = 0;
+int FIXED_SIZE = 0;
+int ANON = 0;
+size_t PUT_CNT = 0;
+size_t ACHD_SIZE = 0;
+int ACHD_UNRELIABLE = 0;
+double ACHD_RATE = 0;
+const char *ACHD_COALESCE = NULL;
 
 double overhead = 0;
 
@@ -212,19 +219,216 @@ void setup_ach(void) {
     /* create channel */
     int r = ach_unlink("bench");               /* delete first */
     assert( ACH_OK == r || ACH_ENOENT == r);
-    r = ach_create("bench", 10, 256, NULL );
+    ach_create_attr_t attr;
+    ach_create_attr_init(&attr);
+    attr.fixed_size = FIXED_SIZE;
+    attr.map_anon = ANON;
+    r = ach_create("bench", 10, 256, &attr );
     assert(ACH_OK == r);
 
     /* open channel */
-    r = ach_open(&chan, "bench", NULL);
+    ach_attr_t oattr;
+    ach_attr_init(&oattr);
+    oattr.map_anon = ANON;
+    oattr.shm = attr.shm;
+    r = ach_open(&chan, "bench", &oattr);
     assert(ACH_OK == r);
 }
 
 void destroy_ach(void) {
-    int r = ach_unlink("bench");
+    enum ach_status r = ANON ? ach_close(&chan) : ach_unlink("bench");
     assert(ACH_OK == r);
 }
 
+/* Time back-to-back puts of small frames, no receivers */
+void put_throughput_ach(void) {
+    setup_ach();
+    size_t i;
+    ticks_t ticks = get_ticks();
+    ticks_t t0 = get_ticks();
+    for( i = 0; i < PUT_CNT; i ++ ) {
+        int r = ach_put(&chan, &ticks, sizeof(ticks));
+        assert(ACH_OK == r);
+    }
+    ticks_t t1 = get_ticks();
+    double dt = ticks_delta(t0, t1);
+    printf("%"PRIuPTR" puts of %"PRIuPTR" bytes: %fs, %.1fns/put\n",
+           PUT_CNT, sizeof(ticks), dt, dt*1e9/(double)PUT_CNT);
+
+    /* and non-waiting gets of the newest frame */
+    t0 = get_ticks();
+    for( i = 0; i < PUT_CNT; i ++ ) {
+        size_t fs;
+        int r = ach_get(&chan, &ticks, sizeof(ticks), &fs, NULL,
+                        ACH_O_LAST | ACH_O_COPY);
+        assert(ACH_OK == r || ACH_MISSED_FRAME == r);
+    }
+    t1 = get_ticks();
+    dt = ticks_delta(t0, t1);
+    printf("%"PRIuPTR" gets of %"PRIuPTR" bytes: %fs, %.1fns/get\n",
+           PUT_CNT, sizeof(ticks), dt, dt*1e9/(double)PUT_CNT);
+    destroy_ach();
+}
+
+/******************/
+/* ACHD BENCHING  */
+/******************/
+
+#define ACHD_BENCH_PORT "18076"
+
+static pid_t spawn_achd( char *const argv[] ) {
+    pid_t pid = fork();
+    assert( pid >= 0 );
+    if( 0 == pid ) {
+        execvp( argv[0], argv );
+        fprintf(stderr, "Couldn't run %s: %s\n", argv[0], strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/* Frames arriving on bench-dst */
+struct achd_recv {
+    uint64_t seq;               /* newest frame received */
+    ticks_t t;                  /* when it came */
+    size_t lat_cnt;
+    double lat_sum;
+    double lat_max;
+};
+
+/* Take frames off dst till abstime, noting their latency from the
+ * send time stamped in front of each */
+static void achd_drain( ach_channel_t *dst, uint8_t *buf, struct achd_recv *rcv,
+                        const struct timespec *abstime ) {
+    for(;;) {
+        size_t frame_size;
+        enum ach_status r = ach_get( dst, buf, ACHD_SIZE, &frame_size, abstime, ACH_O_WAIT );
+        if( ACH_OK != r && ACH_MISSED_FRAME != r ) return;
+        rcv->t = get_ticks();
+        rcv->seq = dst->seq_num;
+        if( frame_size >= sizeof(ticks_t) ) {
+            ticks_t sent;
+            memcpy( &sent, buf, sizeof(sent) );
+            double lat = ticks_delta( sent, rcv->t );
+            rcv->lat_cnt++;
+            rcv->lat_sum += lat;
+            if( lat > rcv->lat_max ) rcv->lat_max = lat;
+        }
+    }
+}
+
+static void ticks_add( ticks_t *t, double secs ) {
+    int64_t ns = (int64_t)t->tv_nsec + (int64_t)(secs * 1e9);
+    t->tv_sec += (time_t)(ns / 1000000000);
+    t->tv_nsec = (long)(ns % 1000000000);
+}
+
+/* Time PUT_CNT frames of ACHD_SIZE bytes pushed through achd over
+ * loopback, and the CPU time of the pushing achd */
+void achd_throughput(void) {
+    char *achd = getenv("ACHD") ? getenv("ACHD") : (char*)"achd";
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.reliable = !ACHD_UNRELIABLE;
+    ach_unlink("bench-src");
+    ach_unlink("bench-dst");
+    enum ach_status r = ach_create( "bench-src", 8, ACHD_SIZE, &attr );
+    assert(ACH_OK == r);
+    r = ach_create( "bench-dst", 8, ACHD_SIZE, NULL );
+    assert(ACH_OK == r);
+    ach_channel_t src, dst;
+    r = ach_open( &src, "bench-src", NULL );
+    assert(ACH_OK == r);
+    r = ach_open( &dst, "bench-dst", NULL );
+    assert(ACH_OK == r);
+
+    char *server_argv[] = { achd, (char*)"-p", (char*)ACHD_BENCH_PORT, (char*)"listen", NULL };
+    char *client_argv[16];
+    int nargs = 0;
+    client_argv[nargs++] = achd;
+    client_argv[nargs++] = (char*)"-r";
+    client_argv[nargs++] = (char*)"-p";
+    client_argv[nargs++] = (char*)ACHD_BENCH_PORT;
+    client_argv[nargs++] = (char*)"-z";
+    client_argv[nargs++] = (char*)"bench-dst";
+    if( !ACHD_UNRELIABLE ) {
+        client_argv[nargs++] = (char*)"-I";
+    }
+    if( ACHD_COALESCE ) {
+        client_argv[nargs++] = (char*)"-c";
+        client_argv[nargs++] = (char*)ACHD_COALESCE;
+        client_argv[nargs++] = (char*)"-N";
+    }
+    client_argv[nargs++] = (char*)"push";
+    client_argv[nargs++] = (char*)"localhost";
+    client_argv[nargs++] = (char*)"bench-src";
+    client_argv[nargs] = NULL;
+    pid_t server = spawn_achd( server_argv );
+    usleep(200*1000);
+    pid_t client = spawn_achd( client_argv );
+    usleep(500*1000);       /* let it connect */
+
+    uint8_t *buf = (uint8_t*)malloc( ACHD_SIZE );
+    uint8_t *rbuf = (uint8_t*)malloc( ACHD_SIZE );
+    size_t i;
+    for( i = 0; i < ACHD_SIZE; i ++ ) buf[i] = (uint8_t)i;
+    ach_flush( &dst );
+
+    struct achd_recv rcv;
+    memset( &rcv, 0, sizeof(rcv) );
+    ticks_t t0 = get_ticks(), next = t0;
+    rcv.t = t0;
+    for( i = 0; i < PUT_CNT; i ++ ) {
+        ticks_t now = get_ticks();
+        if( ACHD_SIZE >= sizeof(now) ) memcpy( buf, &now, sizeof(now) );
+        r = ach_put_wait( &src, buf, ACHD_SIZE, NULL );
+        assert(ACH_OK == r);
+        if( ACHD_RATE > 0 ) {
+            ticks_add( &next, 1 / ACHD_RATE );
+            achd_drain( &dst, rbuf, &rcv, &next );
+        }
+    }
+
+    /* wait for the last frame, or for achd to stop delivering */
+    while( rcv.seq < PUT_CNT ) {
+        uint64_t seq = rcv.seq;
+        ticks_t t = get_ticks();
+        ticks_add( &t, 1 );
+        achd_drain( &dst, rbuf, &rcv, &t );
+        if( seq == rcv.seq ) break;
+    }
+
+    struct rusage ru;
+    int status;
+    /* achd only notices SIGTERM between frames, and it is now blocked
+     * waiting for the next one */
+    kill( client, SIGKILL );
+    waitpid( client, &status, 0 );
+    getrusage( RUSAGE_CHILDREN, &ru );  /* only the client is reaped yet */
+    kill( server, SIGKILL );
+    waitpid( server, &status, 0 );
+
+    double dt = ticks_delta(t0, rcv.t);
+    double bytes = (double)rcv.seq * (double)ACHD_SIZE;
+    double cpu = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+        (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+    printf("%"PRIu64" of %"PRIuPTR" frames of %"PRIuPTR" bytes: %fs, %.1f MB/s, "
+           "pushing achd %.3f CPU s/GB\n",
+           rcv.seq, PUT_CNT, ACHD_SIZE, dt, bytes / dt / 1e6, cpu / (bytes / 1e9));
+    if( rcv.lat_cnt ) {
+        printf("latency mean %.1f us, max %.1f us, pushing achd %.1f CPU us/frame\n",
+               rcv.lat_sum / (double)rcv.lat_cnt * 1e6, rcv.lat_max * 1e6,
+               cpu / (double)rcv.seq * 1e6);
+    }
+
+    free(buf);
+    free(rbuf);
+    ach_close(&src);
+    ach_close(&dst);
+    ach_unlink("bench-src");
+    ach_unlink("bench-dst");
+}
+
 /*****************/
 /* PIPE BENCHING */
 /*****************/
@@ -301,7 +505,7 @@ int main(int argc, char **argv) {
 
     struct vtab *vt = &vtab_ach;
 
-    while( (c = getopt( argc, argv, "f:s:p:r:l:gPhH?V")) != -1 ) {
+    while( (c = getopt( argc, argv, "f:s:p:r:l:gPFAT:D:UR:C:hH?V")) != -1 ) {
         switch(c) {
         case 'f':
             FREQUENCY = strtod(optarg, &endptr);
@@ -327,6 +531,30 @@ int main(int argc, char **argv) {
         case 'P':
             vt = &vtab_pipe;
             break;
+        case 'F':
+            FIXED_SIZE = 1;
+            break;
+        case 'A':
+            ANON = 1;
+            break;
+        case 'T':
+            PUT_CNT = (size_t)atol(optarg);
+            assert(PUT_CNT);
+            break;
+        case 'D':
+            ACHD_SIZE = (size_t)atol(optarg);
+            assert(ACHD_SIZE);
+            break;
+        case 'U':
+            ACHD_UNRELIABLE = 1;
+            break;
+        case 'R':
+            ACHD_RATE = strtod(optarg, &endptr);
+            assert(endptr);
+            break;
+        case 'C':
+            ACHD_COALESCE = optarg;
+            break;
         case 'V':   /* version     */
             ach_print_version("achbench");
             exit(EXIT_SUCCESS);
@@ -347,11 +575,36 @@ int main(int argc, char **argv) {
                  "  -l COUNT,           Non-Real-Time Receivers (0)\n"
                  "  -g,                 Proceed even if real-time setup fails\n"
                  "  -P,                 Benchmark pipes instead of ach\n"
+                 "  -F,                 Use a fixed-size frame channel\n"
+                 "  -T COUNT,           Just time COUNT puts and gets, with no receivers\n"
+                 "  -A,                 Use an anonymous channel, only with -T\n"
+                 "  -D SIZE,            With -T, push COUNT frames of SIZE bytes through\n"
+                 "                      achd over loopback, running $ACHD or achd\n"
+                 "  -U,                 With -D, publish to an unreliable channel, which\n"
+                 "                      achd must copy frames out of, rather than a\n"
+                 "                      reliable one it sends in place (achd -I)\n"
+                 "  -R RATE,            With -D, publish RATE frames per second rather\n"
+                 "                      than as fast as achd takes them\n"
+                 "  -C BYTES,           With -D, have achd coalesce frames into writes\n"
+                 "                      of up to BYTES\n"
                 );
             exit(EXIT_SUCCESS);
         }
     }
 
+    if( PUT_CNT && ACHD_SIZE ) {
+        achd_throughput();
+        exit(0);
+    }
+    if( PUT_CNT ) {
+        put_throughput_ach();
+        exit(0);
+    }
+    if( ANON ) {
+        fprintf(stderr, "Anonymous channels can't be shared with other processes, use -T\n");
+        exit(EXIT_FAILURE);
+    }
+
     fprintf(stderr, "-f %.2f ", FREQUENCY);
     fprintf(stderr, "-s %.2f ", SECS);
     fprintf(stderr, "-r %"PRIuPTR" ", RECV_RT);
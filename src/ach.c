@@ -62,6 +62,9 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <sys/stat.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <string.h>
 #include <inttypes.h>
@@ -89,6 +92,9 @@
 /** macro to do things when debugging */
 #define IFDEBUG( x ) (x)
 
+/** alignment of data slots in fixed-size channels */
+#define SLOT_ALIGN ((size_t)ACH_SLOT_ALIGN)
+
 
 size_t ach_channel_size = sizeof(ach_channel_t);
 
@@ -96,6 +102,12 @@ size_t ach_attr_size = sizeof(ach_attr_t);
 
 
 
+/* Data bytes used by an index entry: the frame and any changed ranges
+ * stored after it. */
+static size_t idx_bytes( const ach_index_t *idx ) {
+    return idx->size + idx->range_cnt * sizeof(ach_range_t);
+}
+
 static size_t oldest_index_i( ach_header_t *shm ) {
     return (shm->index_head + shm->index_free)%shm->index_cnt;
 }
@@ -104,6 +116,21 @@ static size_t last_index_i( ach_header_t *shm ) {
     return (shm->index_head + shm->index_cnt -1)%shm->index_cnt;
 }
 
+/* Index entries are used in sequence order and freed oldest first, so
+ * the used entries always hold consecutive sequence numbers ending at
+ * last_seq in last_index_i().  Returns shm->index_cnt if seq_num is
+ * not in the channel. */
+static size_t seq_index_i( ach_header_t *shm, uint64_t seq_num ) {
+    uint64_t used = shm->index_cnt - shm->index_free;
+    if( 0 == seq_num || seq_num > shm->last_seq ||
+        shm->last_seq - seq_num >= used )
+    {
+        return shm->index_cnt;
+    }
+    size_t back = (size_t)(shm->last_seq - seq_num);
+    return (shm->index_head + shm->index_cnt - 1 - back) % shm->index_cnt;
+}
+
 const char *ach_result_to_string(ach_status_t result) {
 
     switch(result) {
@@ -123,6 +150,7 @@ const char *ach_result_to_string(ach_status_t result) {
     case ACH_CORRUPT: return "ACH_CORRUPT";
     case ACH_BAD_HEADER: return "ACH_BAD_HEADER";
     case ACH_EACCES: return "ACH_EACCES";
+    case ACH_EAGAIN: return "ACH_EAGAIN";
     }
     return "UNKNOWN";
 
@@ -143,7 +171,8 @@ check_guards( ach_header_t *shm ) {
     if( ACH_SHM_MAGIC_NUM != shm->magic ||
         ACH_SHM_GUARD_HEADER_NUM != *ACH_SHM_GUARD_HEADER(shm) ||
         ACH_SHM_GUARD_INDEX_NUM != *ACH_SHM_GUARD_INDEX(shm) ||
-        ACH_SHM_GUARD_DATA_NUM != *ACH_SHM_GUARD_DATA(shm)  )
+        ACH_SHM_GUARD_DATA_NUM != *ACH_SHM_GUARD_DATA(shm) ||
+        ACH_SHM_GUARD_SUB_NUM != *ACH_SHM_GUARD_SUB(shm) )
     {
         return ACH_CORRUPT;
     } else {
@@ -181,6 +210,23 @@ shmfile_for_channel_name( const char *name, char *buf, size_t n ) {
     return ACH_OK;
 }
 
+#if defined(HAVE_MEMFD_CREATE) && !defined(MFD_CLOEXEC)
+/* <sys/mman.h> only declares these for _GNU_SOURCE */
+#define MFD_CLOEXEC 0x0001U
+int memfd_create( const char *name, unsigned int flags );
+#endif
+
+/** Creates an unnamed memfd for a channel. */
+static int fd_for_memfd( const char *name ) {
+#ifdef HAVE_MEMFD_CREATE
+    return memfd_create( name, MFD_CLOEXEC );
+#else
+    (void)name;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 /** Opens shm file descriptor for a channel.
     \pre name is a valid channel name
 */
@@ -272,11 +318,39 @@ static void unrdlock( ach_header_t *shm ) {
     assert( 0 == r );
 }
 
-static void wrlock( ach_header_t *shm ) {
-    int r = pthread_mutex_lock( & shm->sync.mutex );
+/* Mark the channel dirty while we change it.  Anonymous channels
+ * also make write_gen odd for get_lockfree().
+ *
+ * ach_inline.h repeats this, clear_dirty(), put_fixed_alloc() and
+ * get_lockfree(), so keep it in step with them.
+ *
+ * \pre hold lock on the channel
+ */
+static void set_dirty( ach_header_t *shm ) {
     assert( 0 == shm->sync.dirty );
     shm->sync.dirty = 1;
+    if( shm->anon ) {
+        __atomic_store_n( &shm->write_gen, shm->write_gen + 1, __ATOMIC_RELAXED );
+        /* odd count is visible before any change */
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+    }
+}
+
+/* Mark the channel clean, publishing our changes to get_lockfree().
+ *
+ * \pre hold lock on the channel
+ */
+static void clear_dirty( ach_header_t *shm ) {
+    shm->sync.dirty = 0;
+    if( shm->anon ) {
+        __atomic_store_n( &shm->write_gen, shm->write_gen + 1, __ATOMIC_RELEASE );
+    }
+}
+
+static void wrlock( ach_header_t *shm ) {
+    int r = pthread_mutex_lock( & shm->sync.mutex );
     assert( 0 == r );
+    set_dirty( shm );
 }
 
 static void unwrlock( ach_header_t *shm ) {
@@ -284,7 +358,7 @@ static void unwrlock( ach_header_t *shm ) {
 
     /* mark clean */
     assert( 1 == shm->sync.dirty );
-    shm->sync.dirty = 0;
+    clear_dirty( shm );
 
     /* unlock */
     r = pthread_mutex_unlock( & shm->sync.mutex );
@@ -296,6 +370,112 @@ static void unwrlock( ach_header_t *shm ) {
 
 }
 
+/* Map the whole channel if it has grown through ach_resize() on
+ * another handle, then check the guard bytes.
+ *
+ * \pre hold lock on the channel
+ */
+static enum ach_status remap_locked( ach_channel_t *chan ) {
+    ach_header_t *shm = chan->shm;
+    if( shm->len != chan->len ) {
+        if( chan->fd < 0 ) return ACH_BUG;
+        void *p = mmap( NULL, shm->len, PROT_READ|PROT_WRITE,
+                        MAP_SHARED, chan->fd, 0ul );
+        if( MAP_FAILED == p ) return check_errno();
+        /* the lock lives at the start of the file, so it is the same
+         * lock through either mapping */
+        munmap( shm, chan->len );
+        shm = chan->shm = (ach_header_t*)p;
+        chan->len = shm->len;
+        /* resizing moves index entries */
+        size_t i = seq_index_i( shm, chan->seq_num + 1 );
+        chan->next_index = (i < shm->index_cnt) ? i : shm->index_head;
+    }
+    return check_guards( shm );
+}
+
+/* Take the read lock, optionally waiting for a new frame, with chan
+ * mapping the whole channel.  Returns holding the lock only on
+ * ACH_OK. */
+static enum ach_status
+chan_rdlock( ach_channel_t *chan, int wait, const struct timespec *abstime ) {
+    enum ach_status r;
+    if( wait ) {
+        if( ACH_OK != (r = rdlock_wait( chan->shm, chan, abstime )) ) return r;
+    } else {
+        rdlock( chan->shm );
+    }
+    if( ACH_OK != (r = remap_locked( chan )) ) {
+        unrdlock( chan->shm );
+    }
+    return r;
+}
+
+/* Take the write lock with chan mapping the whole channel.  Returns
+ * holding the lock only on ACH_OK. */
+static enum ach_status chan_wrlock( ach_channel_t *chan ) {
+    enum ach_status r;
+    wrlock( chan->shm );
+    if( ACH_OK != (r = remap_locked( chan )) ) {
+        clear_dirty( chan->shm );
+        unrdlock( chan->shm );
+    }
+    return r;
+}
+
+
+/* Number of frames skipped when a read moves from prev to seq.  A
+ * re-read of the current frame (ACH_O_COPY) skips nothing rather than
+ * wrapping around.
+ */
+static uint64_t seq_gap( uint64_t prev, uint64_t seq ) {
+    return (seq > prev + 1) ? seq - prev - 1 : 0;
+}
+
+/* Record the read position of chan in its subscriber slot.
+ *
+ * \pre hold lock on the channel
+ */
+static void sub_update( ach_header_t *shm, ach_channel_t *chan, uint64_t missed ) {
+    if( chan->sub_slot ) {
+        ach_sub_t *sub = ACH_SHM_SUB(shm) + chan->sub_slot - 1;
+        sub->seq_num = chan->seq_num;
+        sub->missed += missed;
+        clock_gettime( shm->clock, &sub->time );
+    }
+}
+
+/* Free slots of subscribers whose process is gone, returning how
+ * many were freed.
+ *
+ * \pre hold lock on the channel
+ */
+static size_t sub_reap( ach_header_t *shm ) {
+    ach_sub_t *sub = ACH_SHM_SUB(shm);
+    size_t i, n = 0;
+    for( i = 0; i < shm->sub_cnt; i ++ ) {
+        if( sub[i].pid && kill( sub[i].pid, 0 ) && ESRCH == errno ) {
+            memset( sub + i, 0, sizeof(sub[i]) );
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Oldest sequence number read by all registered subscribers, or
+ * UINT64_MAX if there are none.
+ *
+ * \pre hold lock on the channel
+ */
+static uint64_t sub_min_seq( ach_header_t *shm ) {
+    ach_sub_t *sub = ACH_SHM_SUB(shm);
+    uint64_t seq = UINT64_MAX;
+    size_t i;
+    for( i = 0; i < shm->sub_cnt; i ++ ) {
+        if( sub[i].pid && sub[i].seq_num < seq ) seq = sub[i].seq_num;
+    }
+    return seq;
+}
 
 void ach_create_attr_init( ach_create_attr_t *attr ) {
     memset( attr, 0, sizeof( ach_create_attr_t ) );
@@ -308,13 +488,25 @@ ach_create( const char *channel_name,
     ach_header_t *shm;
     int fd;
     size_t len;
+    size_t sub_cnt = 0;
+    size_t slot_size = 0;
+    if( attr ) {
+        sub_cnt = (attr->reliable && 0 == attr->sub_cnt) ?
+            ACH_DEFAULT_SUB_COUNT : attr->sub_cnt;
+        if( attr->fixed_size ) {
+            if( 0 == frame_size ) return ACH_EINVAL;
+            slot_size = (frame_size + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+            frame_size = slot_size;
+        }
+    }
     /* fixme: truncate */
     /* open shm */
     {
         len = sizeof( ach_header_t) +
             frame_cnt*sizeof( ach_index_t ) +
             frame_cnt*frame_size +
-            3*sizeof(uint64_t);
+            sub_cnt*sizeof( ach_sub_t ) +
+            4*sizeof(uint64_t);
 
         if( attr && attr->map_anon ) {
             /* anonymous (heap) */
@@ -328,7 +520,12 @@ ach_create( const char *channel_name,
             if( attr ) {
                 if( attr->truncate ) oflag &= ~O_EXCL;
             }
-            if( (fd = fd_for_channel_name( channel_name, oflag )) < 0 ) {
+            if( attr && attr->map_memfd ) {
+                /* memfd, name is only a label */
+                if( (fd = fd_for_memfd( channel_name )) < 0 ) {
+                    return check_errno();
+                }
+            } else if( (fd = fd_for_channel_name( channel_name, oflag )) < 0 ) {
                 return check_errno();;
             }
 
@@ -407,7 +604,10 @@ ach_create( const char *channel_name,
                 DEBUG_PERROR("pthread_mutexattr_init");
                 return ACH_FAILED_SYSCALL;
             }
-            if( (r = pthread_mutexattr_setpshared(&mutex_attr,
+            /* Anonymous channels stay in this process, so take the
+               cheaper private default */
+            if( ! (attr && attr->map_anon) &&
+                (r = pthread_mutexattr_setpshared(&mutex_attr,
                                                   PTHREAD_PROCESS_SHARED)) ) {
                 DEBUG_PERROR("pthread_mutexattr_setpshared");
                 return ACH_FAILED_SYSCALL;
@@ -422,7 +622,8 @@ ach_create( const char *channel_name,
 #endif
             /* Priority Inheritance Mutex */
 #ifdef PTHREAD_PRIO_INHERIT
-            if( (r = pthread_mutexattr_setprotocol(&mutex_attr,
+            if( ! (attr && attr->map_anon) &&
+                (r = pthread_mutexattr_setprotocol(&mutex_attr,
                                                    PTHREAD_PRIO_INHERIT)) ) {
                 DEBUG_PERROR("pthread_mutexattr_setprotocol");
                 return ACH_FAILED_SYSCALL;
@@ -449,13 +650,21 @@ ach_create( const char *channel_name,
     shm->data_head = 0;
     shm->data_free = frame_cnt * frame_size;
     shm->data_size = frame_cnt * frame_size;
+    shm->clock = (attr && attr->set_clock) ? attr->clock : ACH_DEFAULT_CLOCK;
+    shm->sub_cnt = sub_cnt;
+    shm->reliable = attr && attr->reliable;
+    shm->slot_size = slot_size;
+    shm->dedup = attr && attr->dedup;
+    shm->anon = attr && attr->map_anon;
     assert( sizeof( ach_header_t ) +
             shm->index_free * sizeof( ach_index_t ) +
-            shm->data_free + 3*sizeof(uint64_t) ==  len );
+            shm->data_free +
+            shm->sub_cnt * sizeof( ach_sub_t ) + 4*sizeof(uint64_t) ==  len );
 
     *ACH_SHM_GUARD_HEADER(shm) = ACH_SHM_GUARD_HEADER_NUM;
     *ACH_SHM_GUARD_INDEX(shm) = ACH_SHM_GUARD_INDEX_NUM;
     *ACH_SHM_GUARD_DATA(shm) = ACH_SHM_GUARD_DATA_NUM;
+    *ACH_SHM_GUARD_SUB(shm) = ACH_SHM_GUARD_SUB_NUM;
     shm->magic = ACH_SHM_MAGIC_NUM;
 
     if( attr && attr->map_anon ) {
@@ -468,6 +677,11 @@ ach_create( const char *channel_name,
             DEBUG_PERROR("munmap");
             return ACH_FAILED_SYSCALL;
         }
+        /* a memfd has no name, so hand back the only reference */
+        if( attr && attr->map_memfd ) {
+            attr->fd = fd;
+            return ACH_OK;
+        }
         /* close file */
         int i = 0;
         do {
@@ -482,6 +696,58 @@ ach_create( const char *channel_name,
     return ACH_OK;
 }
 
+/** Maps the whole channel in file descriptor fd. */
+static enum ach_status map_fd( int fd, ach_header_t **shm_p, size_t *len_p ) {
+    ach_header_t *shm;
+    size_t len;
+    if( (shm = (ach_header_t*) mmap (NULL, sizeof(ach_header_t),
+                                     PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0ul) )
+        == MAP_FAILED )
+        return ACH_FAILED_SYSCALL;
+    if( ACH_SHM_MAGIC_NUM != shm->magic ) {
+        munmap( shm, sizeof(ach_header_t) );
+        return ACH_BAD_SHM_FILE;
+    }
+
+    /* calculate mmaping size */
+    len = shm->len;
+
+    /* remap */
+    if( -1 ==  munmap( shm, sizeof(ach_header_t) ) )
+        return check_errno();
+
+    if( (shm = (ach_header_t*) mmap( NULL, len, PROT_READ|PROT_WRITE,
+                                     MAP_SHARED, fd, 0ul) )
+        == MAP_FAILED )
+        return check_errno();
+
+    *shm_p = shm;
+    *len_p = len;
+    return ACH_OK;
+}
+
+/** Initializes chan for the mapped channel shm. */
+static enum ach_status open_mapped( ach_channel_t *chan, int fd,
+                                    ach_header_t *shm, size_t len ) {
+    /* initialize struct */
+    chan->fd = fd;
+    chan->len = len;
+    chan->shm = shm;
+    chan->seq_num = 0;
+    chan->next_index = 1;
+    chan->sub_slot = 0;
+
+    /* Check guard bytes, under the lock in case of a concurrent resize */
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+        if( shm->anon ) shm->refcnt++;
+        unrdlock( chan->shm );
+    }
+
+    return ACH_OK;
+}
+
 enum ach_status
 ach_open( ach_channel_t *chan, const char *channel_name,
           ach_attr_t *attr ) {
@@ -494,52 +760,159 @@ ach_open( ach_channel_t *chan, const char *channel_name,
 
     if( attr && attr->map_anon ) {
         shm = attr->shm;
-        len = sizeof(ach_header_t) + sizeof(ach_index_t)*shm->index_cnt + shm->data_size;
+        len = shm->len;
     }else {
+        enum ach_status r;
         if( ! channel_name_ok( channel_name ) )
             return ACH_INVALID_NAME;
         /* open shm */
-        if( ! channel_name_ok( channel_name ) ) return ACH_INVALID_NAME;
         if( (fd = fd_for_channel_name( channel_name, 0 )) < 0 ) {
             return check_errno();
         }
-        if( (shm = (ach_header_t*) mmap (NULL, sizeof(ach_header_t),
-                                         PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0ul) )
-            == MAP_FAILED )
-            return ACH_FAILED_SYSCALL;
-        if( ACH_SHM_MAGIC_NUM != shm->magic )
-            return ACH_BAD_SHM_FILE;
+        if( ACH_OK != (r = map_fd( fd, &shm, &len )) ) {
+            close( fd );
+            return r;
+        }
+    }
 
-        /* calculate mmaping size */
-        len = sizeof(ach_header_t) + sizeof(ach_index_t)*shm->index_cnt + shm->data_size;
+    return open_mapped( chan, fd, shm, len );
+}
 
-        /* remap */
-        if( -1 ==  munmap( shm, sizeof(ach_header_t) ) )
-            return check_errno();
+enum ach_status
+ach_open_fd( ach_channel_t *chan, int fd, ach_attr_t *attr ) {
+    ach_header_t * shm;
+    size_t len;
+    enum ach_status r;
 
-        if( (shm = (ach_header_t*) mmap( NULL, len, PROT_READ|PROT_WRITE,
-                                         MAP_SHARED, fd, 0ul) )
-            == MAP_FAILED )
-            return check_errno();
-    }
+    if( attr && attr->map_anon ) return ACH_EINVAL;
+    if( attr ) memcpy( &chan->attr, attr, sizeof(chan->attr) );
+    else memset( &chan->attr, 0, sizeof(chan->attr) );
 
-    /* Check guard bytes */
-    {
-        enum ach_status r = check_guards(shm);
-        if( ACH_OK != r ) return r;
+    /* keep our own descriptor so the caller may close theirs */
+    if( (fd = dup(fd)) < 0 ) return check_errno();
+    if( ACH_OK != (r = map_fd( fd, &shm, &len )) ) {
+        close( fd );
+        return r;
     }
 
-    /* initialize struct */
-    chan->fd = fd;
-    chan->len = len;
-    chan->shm = shm;
-    chan->seq_num = 0;
-    chan->next_index = 1;
+    return open_mapped( chan, fd, shm, len );
+}
+
+enum ach_status
+ach_send_fd( int sock, int fd ) {
+    char byte = 0;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t r;
+    int i = 0;
+
+    /* one data byte carries the descriptor */
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    memset( &msg, 0, sizeof(msg) );
+    memset( &control, 0, sizeof(control) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy( CMSG_DATA(cmsg), &fd, sizeof(int) );
+
+    do {
+        r = sendmsg( sock, &msg, 0 );
+    }while( -1 == r && EINTR == errno && i++ < ACH_INTR_RETRY );
+    return (1 == r) ? ACH_OK : check_errno();
+}
+
+enum ach_status
+ach_recv_fd( int sock, int *fd ) {
+    char byte;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t r;
+    int i = 0;
+
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
 
+    do {
+        r = recvmsg( sock, &msg, 0 );
+    }while( -1 == r && EINTR == errno && i++ < ACH_INTR_RETRY );
+    if( -1 == r ) return check_errno();
+    if( 0 == r ) return ACH_CLOSED;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if( NULL == cmsg || (msg.msg_flags & MSG_CTRUNC) ||
+        SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type ||
+        CMSG_LEN(sizeof(int)) != cmsg->cmsg_len )
+        return ACH_EINVAL;
+    memcpy( fd, CMSG_DATA(cmsg), sizeof(int) );
     return ACH_OK;
 }
 
 
+/** Copies len bytes starting at offset in the data area to buf.
+
+    \pre hold read lock on the channel
+*/
+static void ring_read( ach_header_t *shm, size_t offset, void *buf, size_t len ) {
+    uint8_t *data_buf = ACH_SHM_DATA(shm);
+    if( offset + len < shm->data_size ) {
+        /* simple memcpy */
+        memcpy( (uint8_t*)buf, data_buf + offset, len );
+    }else {
+        /* wraparound memcpy */
+        size_t end_cnt = shm->data_size - offset;
+        memcpy( (uint8_t*)buf, data_buf + offset, end_cnt );
+        memcpy( (uint8_t*)buf + end_cnt, data_buf, len - end_cnt );
+    }
+}
+
+/** Copies len bytes of buf to offset in the data area.
+
+    \pre hold write lock on the channel
+*/
+static void ring_write( ach_header_t *shm, size_t offset, const void *buf, size_t len ) {
+    uint8_t *data_ar = ACH_SHM_DATA(shm);
+    if( shm->data_size - offset >= len ) {
+        /* simply copy */
+        memcpy( data_ar + offset, buf, len );
+    } else {
+        /* wraparound copy */
+        size_t end_cnt = shm->data_size - offset;
+        memcpy( data_ar + offset, buf, end_cnt);
+        memcpy( data_ar, (const uint8_t*)buf + end_cnt, len - end_cnt );
+    }
+}
+
+/** Copies the data of index entry idx to buf.
+
+    \pre hold read lock on the channel
+    \pre buf holds at least idx->size bytes
+*/
+static void copy_frame( ach_header_t *shm, ach_index_t *idx, void *buf ) {
+    ring_read( shm, idx->offset, buf, idx->size );
+}
+
 /** Copies frame pointed to by index entry at index_offset.
 
     \pre hold read lock on the channel
@@ -547,10 +920,13 @@ ach_open( ach_channel_t *chan, const char *channel_name,
     \pre on success, buf holds the frame seq_num and next_index fields
     are incremented. The variable pointed to by size_written holds the
     number of bytes written to buf (0 on failure).
+
+    If alloc is given, it supplies buf for the frame's size instead.
 */
 static enum ach_status
 ach_get_from_offset( ach_channel_t *chan, size_t index_offset,
-                     char *buf, size_t size, size_t *frame_size ) {
+                     char *buf, size_t size, size_t *frame_size,
+                     ach_alloc_fun_t alloc, void *cx ) {
     ach_header_t *shm = chan->shm;
     assert( index_offset < shm->index_cnt );
     ach_index_t *idx = ACH_SHM_INDEX(shm) + index_offset;
@@ -567,22 +943,19 @@ ach_get_from_offset( ach_channel_t *chan, size_t index_offset,
         return ACH_BUG;
     }
 
-    if(  idx->size > size ) {
+    if( alloc ) {
+        /* size the buffer while we still hold the frame */
+        buf = (char*)alloc( cx, idx->size );
+        size = idx->size;
+    }
+
+    if(  NULL == buf || idx->size > size ) {
         /* buffer overflow */
         *frame_size = idx->size;
         return ACH_OVERFLOW;
     } else {
         /* good to copy */
-        uint8_t *data_buf = ACH_SHM_DATA(shm);
-        if( idx->offset + idx->size < shm->data_size ) {
-            /* simple memcpy */
-            memcpy( (uint8_t*)buf, data_buf + idx->offset, idx->size );
-        }else {
-            /* wraparound memcpy */
-            size_t end_cnt = shm->data_size - idx->offset;
-            memcpy( (uint8_t*)buf, data_buf + idx->offset, end_cnt );
-            memcpy( (uint8_t*)buf + end_cnt, data_buf, idx->size - end_cnt );
-        }
+        copy_frame( shm, idx, buf );
         *frame_size = idx->size;
         chan->seq_num = idx->seq_num;
         chan->next_index = (index_offset + 1) % shm->index_cnt;
@@ -590,129 +963,642 @@ ach_get_from_offset( ach_channel_t *chan, size_t index_offset,
     }
 }
 
-enum ach_status
-ach_get( ach_channel_t *chan, void *buf, size_t size,
-         size_t *frame_size,
-         const struct timespec *ACH_RESTRICT abstime,
-         int options ) {
+/* Index entry of the next or last frame, per options, or
+ * shm->index_cnt if there is nothing to read.
+ *
+ * \pre hold read lock on the channel
+ */
+static size_t get_index( ach_channel_t *chan, int options ) {
+    const bool o_last = options & ACH_O_LAST;
+    const bool o_copy = options & ACH_O_COPY;
+
     ach_header_t *shm = chan->shm;
     ach_index_t *index_ar = ACH_SHM_INDEX(shm);
 
-    /* Check guard bytes */
-    {
-        enum ach_status r = check_guards(shm);
-        if( ACH_OK != r ) return r;
-    }
-
-    const bool o_wait = options & ACH_O_WAIT;
-    const bool o_last = options & ACH_O_LAST;
-    const bool o_copy = options & ACH_O_COPY;
+    assert( chan->seq_num <= shm->last_seq );
 
-    /* take read lock */
-    if( o_wait ) {
-        enum ach_status r;
-        if( ACH_OK != (r = rdlock_wait( shm, chan, abstime ) ) ) {
-            return r;
+    if( (chan->seq_num == shm->last_seq && !o_copy) || 0 == shm->last_seq ) {
+        /* no entries */
+        return shm->index_cnt;
+    } else if( o_last ) {
+        /* normal case, get last */
+        return last_index_i(shm);
+    } else if (!o_last &&
+               index_ar[chan->next_index].seq_num == chan->seq_num + 1) {
+        /* normal case, get next */
+        return chan->next_index;
+    } else {
+        /* exception case, figure out which frame */
+        if (chan->seq_num == shm->last_seq) {
+            /* copy last */
+            assert(o_copy);
+            return last_index_i(shm);
+        } else {
+            /* copy oldest */
+            return oldest_index_i(shm);
         }
-    } else { rdlock( shm ); }
+    }
+}
 
-    assert( chan->seq_num <= shm->last_seq );
+/* Copy the next or last frame, per options, out of chan.
+ *
+ * \pre hold read lock on the channel
+ */
+static enum ach_status
+get_locked( ach_channel_t *chan, void *buf, size_t size,
+            size_t *frame_size, int options,
+            ach_alloc_fun_t alloc, void *cx ) {
+    ach_header_t *shm = chan->shm;
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
 
     enum ach_status retval = ACH_BUG;
     bool missed_frame = 0;
 
     /* get the data */
-    if( (chan->seq_num == shm->last_seq && !o_copy) || 0 == shm->last_seq ) {
-        /* no entries */
-        assert(!o_wait);
+    size_t read_index = get_index( chan, options );
+    if( read_index == shm->index_cnt ) {
+        assert( !(options & ACH_O_WAIT) );
         retval = ACH_STALE_FRAMES;
     } else {
-        /* Compute the index to read */
-        size_t read_index;
-        if( o_last ) {
-            /* normal case, get last */
-            read_index = last_index_i(shm);
-        } else if (!o_last &&
-                   index_ar[chan->next_index].seq_num == chan->seq_num + 1) {
-            /* normal case, get next */
-            read_index = chan->next_index;
-        } else {
-            /* exception case, figure out which frame */
-            if (chan->seq_num == shm->last_seq) {
-                /* copy last */
-                assert(o_copy);
-                read_index = last_index_i(shm);
-            } else {
-                /* copy oldest */
-                read_index = oldest_index_i(shm);
-            }
-        }
-
+        uint64_t prev_seq = chan->seq_num;
         if( index_ar[read_index].seq_num > chan->seq_num + 1 ) { missed_frame = 1; }
 
         /* read from the index */
         retval = ach_get_from_offset( chan, read_index, (char*)buf, size,
-                                      frame_size );
+                                      frame_size, alloc, cx );
 
         assert( index_ar[read_index].seq_num > 0 );
+
+        if( ACH_OK == retval ) {
+            sub_update( shm, chan, seq_gap(prev_seq, chan->seq_num) );
+        }
     }
 
-    /* release read lock */
+    return (ACH_OK == retval && missed_frame) ? ACH_MISSED_FRAME : retval;
+}
+
+/* Release the read lock after get_locked() */
+static void get_unlock( ach_channel_t *chan, enum ach_status r ) {
+    ach_header_t *shm = chan->shm;
     unrdlock( shm );
 
-    return (ACH_OK == retval && missed_frame) ? ACH_MISSED_FRAME : retval;
+    /* a publisher may be waiting for us to catch up */
+    if( (ACH_OK == r || ACH_MISSED_FRAME == r) &&
+        chan->sub_slot && shm->reliable ) {
+        int i = pthread_cond_broadcast( & shm->sync.cond );
+        assert( 0 == i );
+    }
 }
 
+/* Attempts at get_lockfree() before taking the lock */
+#define LOCKFREE_TRIES 8
 
-enum ach_status
-ach_flush( ach_channel_t *chan ) {
-    /*int r; */
+/* Copy the next or last frame, per options, out of an anonymous
+ * channel without the lock.  Writers keep write_gen odd while they
+ * change the channel, so an unchanged even count on both sides of
+ * the copy means no write overlapped it.  Everything read before
+ * that check may be torn, so it is bounds checked before use.
+ * Returns ACH_EAGAIN if writers kept interfering.
+ */
+static enum ach_status
+get_lockfree( ach_channel_t *chan, void *buf, size_t size,
+              size_t *frame_size, int options ) {
+    const bool o_last = options & ACH_O_LAST;
+    const bool o_copy = options & ACH_O_COPY;
     ach_header_t *shm = chan->shm;
-    rdlock(shm);
-    chan->seq_num = shm->last_seq;
-    chan->next_index = shm->index_head;
-    unrdlock(shm);
-    return ACH_OK;
-}
+    int tries;
 
+    for( tries = 0; tries < LOCKFREE_TRIES; tries ++ ) {
+        uint64_t gen = __atomic_load_n( &shm->write_gen, __ATOMIC_ACQUIRE );
+        if( gen & 1 ) continue;
 
-static void free_index(ach_header_t *shm, size_t i ) {
-    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+        enum ach_status retval;
+        uint64_t last_seq = __atomic_load_n( &shm->last_seq, __ATOMIC_RELAXED );
+        size_t i = shm->index_cnt;
+        size_t len = 0;
+        uint64_t seq = 0;
 
-    assert( index_ar[i].seq_num ); /* only free used indices */
-    assert( index_ar[i].size );    /* must have some data */
-    assert( shm->index_free < shm->index_cnt ); /* must be some used index */
+        if( (chan->seq_num == last_seq && !o_copy) || 0 == last_seq ) {
+            retval = ACH_STALE_FRAMES;
+        } else {
+            if( o_last || chan->seq_num == last_seq ) {
+                i = last_index_i( shm );
+            } else {
+                i = seq_index_i( shm, chan->seq_num + 1 );
+                if( i >= shm->index_cnt ) i = oldest_index_i( shm );
+            }
+            const volatile ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+            size_t offset = idx->offset;
+            len = idx->size;
+            seq = idx->seq_num;
+            if( offset >= shm->data_size || len > shm->data_size ||
+                0 == seq || seq < chan->seq_num ) {
+                continue;
+            }
+            if( NULL == buf || len > size ) {
+                retval = ACH_OVERFLOW;
+            } else {
+                ring_read( shm, offset, buf, len );
+                retval = (seq > chan->seq_num + 1) ? ACH_MISSED_FRAME : ACH_OK;
+            }
+        }
 
-    shm->data_free += index_ar[i].size;
-    shm->index_free ++;
-    memset( &index_ar[i], 0, sizeof( ach_index_t ) );
-}
+        /* did a writer get in? */
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n( &shm->write_gen, __ATOMIC_RELAXED ) != gen ) continue;
 
-enum ach_status
-ach_put( ach_channel_t *chan, const void *buf, size_t len ) {
-    if( 0 == len || NULL == buf || NULL == chan->shm ) {
-        return ACH_EINVAL;
+        if( ACH_STALE_FRAMES != retval ) *frame_size = len;
+        if( ACH_OK == retval || ACH_MISSED_FRAME == retval ) {
+            chan->seq_num = seq;
+            chan->next_index = (i + 1) % shm->index_cnt;
+        }
+        return retval;
     }
+    return ACH_EAGAIN;
+}
 
-    ach_header_t *shm = chan->shm;
+static enum ach_status
+get_alloc( ach_channel_t *chan, void *buf, size_t size,
+           size_t *frame_size,
+           const struct timespec *ACH_RESTRICT abstime,
+           int options, ach_alloc_fun_t alloc, void *cx ) {
+    /* threads of one process can skip the lock */
+    if( chan->shm->anon && !(options & ACH_O_WAIT) &&
+        NULL == alloc && 0 == chan->sub_slot ) {
+        enum ach_status r = get_lockfree( chan, buf, size, frame_size, options );
+        if( ACH_EAGAIN != r ) return r;
+    }
 
-    /* Check guard bytes */
+    /* take read lock */
     {
-        enum ach_status r = check_guards(shm);
+        enum ach_status r = chan_rdlock( chan, options & ACH_O_WAIT, abstime );
         if( ACH_OK != r ) return r;
     }
 
-    if( shm->data_size < len ) {
-        return ACH_OVERFLOW;
-    }
-
-    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
-    uint8_t *data_ar = ACH_SHM_DATA(shm);
+    enum ach_status retval = get_locked( chan, buf, size, frame_size, options,
+                                         alloc, cx );
 
-    if( len > shm->data_size ) return ACH_OVERFLOW;
+    /* release read lock */
+    get_unlock( chan, retval );
+    return retval;
+}
 
-    /* take write lock */
-    wrlock( shm );
+enum ach_status
+ach_get( ach_channel_t *chan, void *buf, size_t size,
+         size_t *frame_size,
+         const struct timespec *ACH_RESTRICT abstime,
+         int options ) {
+    return get_alloc( chan, buf, size, frame_size, abstime, options,
+                      NULL, NULL );
+}
+
+enum ach_status
+ach_get_alloc( ach_channel_t *chan, ach_alloc_fun_t alloc, void *cx,
+               size_t *frame_size,
+               const struct timespec *ACH_RESTRICT abstime,
+               int options ) {
+    if( NULL == alloc ) return ACH_EINVAL;
+    return get_alloc( chan, NULL, 0, frame_size, abstime, options,
+                      alloc, cx );
+}
+
+
+enum ach_status
+ach_get_view( ach_channel_t *chan, ach_view_fun_t fun, void *cx,
+              const struct timespec *ACH_RESTRICT abstime,
+              int options ) {
+    if( NULL == fun ) return ACH_EINVAL;
+    {
+        enum ach_status r = chan_rdlock( chan, options & ACH_O_WAIT, abstime );
+        if( ACH_OK != r ) return r;
+    }
+
+    ach_header_t *shm = chan->shm;
+    enum ach_status retval;
+    size_t i;
+    if( 0 == shm->slot_size ) {
+        /* frames may wrap around the end of the ring */
+        retval = ACH_EINVAL;
+    } else if( shm->index_cnt == (i = get_index( chan, options )) ) {
+        retval = ACH_STALE_FRAMES;
+    } else {
+        ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+        uint64_t prev_seq = chan->seq_num;
+        fun( cx, ACH_SHM_DATA(shm) + idx->offset, idx->size );
+        chan->seq_num = idx->seq_num;
+        chan->next_index = (i + 1) % shm->index_cnt;
+        uint64_t missed = seq_gap( prev_seq, chan->seq_num );
+        sub_update( shm, chan, missed );
+        retval = missed ? ACH_MISSED_FRAME : ACH_OK;
+    }
+
+    get_unlock( chan, retval );
+    return retval;
+}
+
+enum ach_status
+ach_get_ref( ach_channel_t *chan, ach_frame_ref_t *ref,
+             const struct timespec *ACH_RESTRICT abstime,
+             int options ) {
+    if( NULL == ref || (options & (ACH_O_LAST | ACH_O_COPY)) ) return ACH_EINVAL;
+    {
+        enum ach_status r = chan_rdlock( chan, options & ACH_O_WAIT, abstime );
+        if( ACH_OK != r ) return r;
+    }
+
+    ach_header_t *shm = chan->shm;
+    enum ach_status retval;
+    size_t i;
+    if( !shm->reliable || 0 == chan->sub_slot ) {
+        /* a publisher could overwrite the frame */
+        retval = ACH_EINVAL;
+    } else if( shm->index_cnt == (i = get_index( chan, options )) ) {
+        retval = ACH_STALE_FRAMES;
+    } else {
+        ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+        uint8_t *data = ACH_SHM_DATA(shm);
+        size_t end_cnt = shm->data_size - idx->offset;
+        ref->seq_num = idx->seq_num;
+        ref->data[0] = data + idx->offset;
+        ref->size[0] = (idx->size < end_cnt) ? idx->size : end_cnt;
+        ref->data[1] = data;
+        ref->size[1] = idx->size - ref->size[0];
+        retval = (idx->seq_num > chan->seq_num + 1) ? ACH_MISSED_FRAME : ACH_OK;
+    }
+
+    unrdlock( shm );
+    return retval;
+}
+
+/* Lock order for operations on several channels: by name, then, as
+ * anonymous and memfd channels may share a name, by address. */
+static int chan_order( const ach_channel_t *a, const ach_channel_t *b ) {
+    int c = strcmp( a->shm->name, b->shm->name );
+    if( c ) return c;
+    if( (uintptr_t)a->shm == (uintptr_t)b->shm ) return 0;
+    return ((uintptr_t)a->shm < (uintptr_t)b->shm) ? -1 : 1;
+}
+
+/* Order channels for locking, see chan_order(). */
+static void sort_by_name( ach_channel_t **chans, size_t *order, size_t cnt ) {
+    size_t i, j;
+    for( i = 0; i < cnt; i ++ ) {
+        size_t k = order[i];
+        for( j = i; j > 0 &&
+                 chan_order( chans[order[j-1]], chans[k] ) > 0; j -- ) {
+            order[j] = order[j-1];
+        }
+        order[j] = k;
+    }
+}
+
+/* Whether a and b are handles on the same channel.  Separate opens of
+ * one channel map it at different addresses, so compare the files. */
+static int same_chan( const ach_channel_t *a, const ach_channel_t *b ) {
+    struct stat sa, sb;
+    if( a->shm == b->shm ) return 1;
+    if( a->fd < 0 || b->fd < 0 ) return 0;
+    if( fstat( a->fd, &sa ) || fstat( b->fd, &sb ) ) return 0;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/* Whether any channel appears twice in chans, sorted by
+ * sort_by_name().  Handles on the same channel share its name. */
+static int has_dup_chan( ach_channel_t **chans, const size_t *order, size_t cnt ) {
+    size_t i, j;
+    for( i = 0; i < cnt; i ++ ) {
+        for( j = i + 1; j < cnt &&
+                 0 == strcmp( chans[order[i]]->shm->name, chans[order[j]]->shm->name );
+             j ++ ) {
+            if( same_chan( chans[order[i]], chans[order[j]] ) ) return 1;
+        }
+    }
+    return 0;
+}
+
+enum ach_status
+ach_get_snapshot( ach_snapshot_t *snap, size_t cnt, int options ) {
+    if( 0 == cnt || NULL == snap || (options & ACH_O_WAIT) ) return ACH_EINVAL;
+
+    ach_channel_t *chans[cnt];
+    size_t order[cnt];
+    size_t i, locked;
+    for( i = 0; i < cnt; i ++ ) {
+        chans[i] = snap[i].chan;
+        order[i] = i;
+    }
+    sort_by_name( chans, order, cnt );
+    if( has_dup_chan( chans, order, cnt ) ) return ACH_EINVAL;
+
+    /* lock everything, so no put lands in between */
+    enum ach_status retval = ACH_OK;
+    for( locked = 0; locked < cnt; locked ++ ) {
+        retval = chan_rdlock( chans[order[locked]], 0, NULL );
+        if( ACH_OK != retval ) break;
+    }
+
+    int got = (ACH_OK == retval);
+    if( got ) {
+        for( i = 0; i < cnt; i ++ ) {
+            snap[i].result = get_locked( snap[i].chan, snap[i].buf, snap[i].size,
+                                         &snap[i].frame_size,
+                                         options | ACH_O_LAST, NULL, NULL );
+            if( ACH_OK == retval &&
+                ACH_OK != snap[i].result && ACH_MISSED_FRAME != snap[i].result ) {
+                retval = snap[i].result;
+            }
+        }
+    }
+
+    /* unlock in reverse order */
+    while( locked > 0 ) {
+        locked--;
+        size_t k = order[locked];
+        get_unlock( chans[k], got ? snap[k].result : ACH_STALE_FRAMES );
+    }
+
+    return retval;
+}
+
+enum ach_status
+ach_get_seq( ach_channel_t *chan, uint64_t seq_num,
+             void *buf, size_t size, size_t *frame_size ) {
+    if( 0 == seq_num ) return ACH_EINVAL;
+
+    enum ach_status retval = chan_rdlock( chan, 0, NULL );
+    if( ACH_OK != retval ) return retval;
+    ach_header_t *shm = chan->shm;
+
+    size_t i = seq_index_i( shm, seq_num );
+    if( i < shm->index_cnt ) {
+        ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+        assert( seq_num == idx->seq_num );
+        *frame_size = idx->size;
+        if( idx->size > size ) {
+            retval = ACH_OVERFLOW;
+        } else {
+            copy_frame( shm, idx, buf );
+            retval = ACH_OK;
+        }
+    } else if( seq_num > shm->last_seq ) {
+        /* not yet published */
+        retval = ACH_STALE_FRAMES;
+    } else {
+        /* already overwritten */
+        retval = ACH_MISSED_FRAME;
+    }
+
+    unrdlock( shm );
+    return retval;
+}
+
+enum ach_status
+ach_seq_range( ach_channel_t *chan, uint64_t *oldest, uint64_t *newest ) {
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    uint64_t used = shm->index_cnt - shm->index_free;
+    *newest = shm->last_seq;
+    *oldest = shm->last_seq + 1 - used;
+    unrdlock( shm );
+
+    return (*oldest <= *newest) ? ACH_OK : ACH_STALE_FRAMES;
+}
+
+enum ach_status
+ach_seek( ach_channel_t *chan, uint64_t seq_num ) {
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    enum ach_status retval = ACH_OK;
+    if( seq_num > shm->last_seq ) {
+        retval = ACH_EINVAL;
+    } else {
+        size_t i = seq_index_i( shm, seq_num + 1 );
+        if( i >= shm->index_cnt && seq_num < shm->last_seq ) {
+            /* get_index() falls back to the oldest frame */
+            retval = ACH_MISSED_FRAME;
+        }
+        chan->seq_num = seq_num;
+        chan->next_index = (i < shm->index_cnt) ? i : shm->index_head;
+        sub_update( shm, chan, 0 );
+    }
+    unrdlock( shm );
+    if( ACH_EINVAL != retval && chan->sub_slot && shm->reliable ) {
+        int r = pthread_cond_broadcast( & shm->sync.cond );
+        assert( 0 == r );
+    }
+    return retval;
+}
+
+static int timespec_cmp( const struct timespec *a, const struct timespec *b ) {
+    if( a->tv_sec != b->tv_sec ) return (a->tv_sec < b->tv_sec) ? -1 : 1;
+    if( a->tv_nsec != b->tv_nsec ) return (a->tv_nsec < b->tv_nsec) ? -1 : 1;
+    return 0;
+}
+
+/* Number of used entries, counting from the oldest, whose time is
+ * before t (or not after t if inclusive).  Times are nondecreasing
+ * from oldest to newest, so this is a binary search. */
+static size_t window_bound( ach_header_t *shm, const struct timespec *t,
+                            int inclusive ) {
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+    size_t oldest = oldest_index_i(shm);
+    size_t lo = 0, hi = shm->index_cnt - shm->index_free;
+    while( lo < hi ) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = timespec_cmp( &index_ar[(oldest + mid) % shm->index_cnt].time, t );
+        if( c < 0 || (inclusive && 0 == c) ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+enum ach_status
+ach_get_window( ach_channel_t *chan,
+                const struct timespec *t0, const struct timespec *t1,
+                void *buf, size_t size,
+                ach_frame_info_t *info, size_t info_cnt,
+                size_t *frame_cnt, size_t *frame_bytes ) {
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+
+    /* find the window */
+    size_t oldest = oldest_index_i(shm);
+    size_t begin = t0 ? window_bound( shm, t0, 0 ) : 0;
+    size_t end = t1 ? window_bound( shm, t1, 1 ) : shm->index_cnt - shm->index_free;
+    if( end < begin ) end = begin;
+
+    size_t i, bytes = 0;
+    for( i = begin; i < end; i ++ ) {
+        bytes += index_ar[(oldest + i) % shm->index_cnt].size;
+    }
+    *frame_cnt = end - begin;
+    *frame_bytes = bytes;
+
+    enum ach_status retval;
+    if( begin == end ) {
+        retval = ACH_STALE_FRAMES;
+    } else if( end - begin > info_cnt || bytes > size ) {
+        retval = ACH_OVERFLOW;
+    } else {
+        /* copy in order */
+        size_t offset = 0;
+        for( i = begin; i < end; i ++ ) {
+            ach_index_t *idx = index_ar + (oldest + i) % shm->index_cnt;
+            ach_frame_info_t *fi = info + (i - begin);
+            fi->seq_num = idx->seq_num;
+            fi->size = idx->size;
+            fi->offset = offset;
+            fi->time = idx->time;
+            copy_frame( shm, idx, (uint8_t*)buf + offset );
+            offset += idx->size;
+        }
+        retval = ACH_OK;
+    }
+
+    unrdlock( shm );
+    return retval;
+}
+
+
+enum ach_status
+ach_flush( ach_channel_t *chan ) {
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    chan->seq_num = shm->last_seq;
+    chan->next_index = shm->index_head;
+    sub_update( shm, chan, 0 );
+    unrdlock(shm);
+    if( chan->sub_slot && shm->reliable ) {
+        int r = pthread_cond_broadcast( & shm->sync.cond );
+        assert( 0 == r );
+    }
+    return ACH_OK;
+}
+
+
+static void free_index(ach_header_t *shm, size_t i ) {
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+
+    assert( index_ar[i].seq_num ); /* only free used indices */
+    assert( index_ar[i].size );    /* must have some data */
+    assert( shm->index_free < shm->index_cnt ); /* must be some used index */
+
+    shm->data_free += idx_bytes( index_ar + i );
+    shm->index_free ++;
+    memset( &index_ar[i], 0, sizeof( ach_index_t ) );
+}
+
+/* Take the next slot of a fixed-size channel for a frame of len bytes
+ *
+ * \pre hold write lock on the channel
+ */
+static ach_index_t *put_fixed_alloc( ach_header_t *shm, size_t len ) {
+    ach_index_t *idx = ACH_SHM_INDEX(shm) + shm->index_head;
+
+    assert( len <= shm->slot_size );
+
+    idx->offset = shm->index_head * shm->slot_size;
+    shm->last_seq++;
+    idx->seq_num = shm->last_seq;
+    idx->size = len;
+    idx->range_cnt = 0;
+    clock_gettime( shm->clock, &idx->time );
+
+    shm->index_head = (shm->index_head + 1) % shm->index_cnt;
+    if( shm->index_free ) shm->index_free --;
+    return idx;
+}
+
+/* Copy the frame into its slot of a fixed-size channel
+ *
+ * \pre hold write lock on the channel
+ */
+static void put_fixed( ach_header_t *shm, const void *buf, size_t len ) {
+    ach_index_t *idx = put_fixed_alloc( shm, len );
+    memcpy( ACH_SHM_DATA(shm) + idx->offset, buf, len );
+}
+
+/* Is buf the same as the newest frame?
+ *
+ * \pre hold lock on the channel
+ */
+static int put_same( ach_header_t *shm, const void *buf, size_t len ) {
+    if( 0 == shm->last_seq || shm->index_free == shm->index_cnt ) return 0;
+    ach_index_t *idx = ACH_SHM_INDEX(shm) + last_index_i(shm);
+    if( idx->size != len ) return 0;
+    uint8_t *data_ar = ACH_SHM_DATA(shm);
+    size_t end_cnt = shm->data_size - idx->offset;
+    if( len <= end_cnt ) {
+        return 0 == memcmp( data_ar + idx->offset, buf, len );
+    } else {
+        /* wraparound compare */
+        return 0 == memcmp( data_ar + idx->offset, buf, end_cnt ) &&
+            0 == memcmp( data_ar, (const uint8_t*)buf + end_cnt, len - end_cnt );
+    }
+}
+
+/* Highest sequence number that putting len bytes would overwrite, or
+ * 0 if it overwrites nothing.  Mirrors the freeing done in
+ * put_locked().
+ *
+ * \pre hold lock on the channel
+ */
+static uint64_t put_evicts( ach_header_t *shm, size_t len ) {
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+    size_t index_free = shm->index_free;
+    size_t data_free = shm->data_free;
+    size_t i = oldest_index_i(shm);
+    uint64_t seq = 0;
+    if( shm->slot_size ) {
+        return index_free ? 0 : index_ar[i].seq_num;
+    }
+    while( 0 == index_free || data_free < len ) {
+        assert( index_free < shm->index_cnt );
+        seq = index_ar[i].seq_num;
+        data_free += idx_bytes( index_ar + i );
+        index_free ++;
+        i = (i + 1) % shm->index_cnt;
+    }
+    return seq;
+}
+
+/* Would putting len bytes overwrite frames some subscriber still needs? */
+static int put_blocked( ach_header_t *shm, size_t len ) {
+    if( ! shm->reliable ) return 0;
+    uint64_t seq = put_evicts( shm, len );
+    return seq && seq > sub_min_seq( shm );
+}
+
+/* Like put_blocked(), but first free the slots of dead subscribers,
+ * for puts that fail rather than wait */
+static int put_blocked_reap( ach_header_t *shm, size_t len ) {
+    while( put_blocked( shm, len ) ) {
+        if( ! sub_reap( shm ) ) return 1;
+    }
+    return 0;
+}
+
+/* Free space for a frame of len bytes followed by range_cnt changed
+ * ranges, and fill in its index entry.
+ *
+ * \pre hold write lock on the channel
+ */
+static ach_index_t *put_alloc( ach_header_t *shm, size_t len, size_t range_cnt ) {
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+    size_t bytes = len + range_cnt * sizeof(ach_range_t);
 
     /* find next index entry */
     ach_index_t *idx = index_ar + shm->index_head;
@@ -726,59 +1612,579 @@ ach_put( ach_channel_t *chan, const void *buf, size_t len ) {
     /* clear overlapping entries */
     size_t i;
     for(i = (shm->index_head + shm->index_free) % shm->index_cnt;
-        shm->data_free < len;
+        shm->data_free < bytes;
         i = (i + 1) % shm->index_cnt) {
         assert( i != shm->index_head );
         free_index(shm,i);
     }
 
-    assert( shm->data_free >= len );
-
-    /* copy buffer */
-    if( shm->data_size - shm->data_head >= len ) {
-        /* simply copy */
-        memcpy( data_ar + shm->data_head, buf, len );
-    } else {
-        /* wraparound copy */
-        size_t end_cnt = shm->data_size - shm->data_head;
-        memcpy( data_ar + shm->data_head, buf, end_cnt);
-        memcpy( data_ar, (uint8_t*)buf + end_cnt, len - end_cnt );
-    }
+    assert( shm->data_free >= bytes );
 
     /* modify counts */
     shm->last_seq++;
     idx->seq_num = shm->last_seq;
     idx->size = len;
     idx->offset = shm->data_head;
+    idx->range_cnt = range_cnt;
+    /* stamp under the lock so times are ordered like the index */
+    clock_gettime( shm->clock, &idx->time );
 
-    shm->data_head = (shm->data_head + len) % shm->data_size;
-    shm->data_free -= len;
+    shm->data_head = (shm->data_head + bytes) % shm->data_size;
+    shm->data_free -= bytes;
     shm->index_head = (shm->index_head + 1) % shm->index_cnt;
     shm->index_free --;
 
     assert( shm->index_free <= shm->index_cnt );
     assert( shm->data_free <= shm->data_size );
     assert( shm->last_seq > 0 );
+    return idx;
+}
+
+/* Copy the frame into the channel
+ *
+ * \pre hold write lock on the channel
+ */
+static void put_locked( ach_header_t *shm, const void *buf, size_t len ) {
+    ach_index_t *idx = put_alloc( shm, len, 0 );
+    ring_write( shm, idx->offset, buf, len );
+}
+
+static enum ach_status
+put_wait( ach_channel_t *chan, const void *buf, size_t len,
+          int wait, const struct timespec *abstime ) {
+    if( 0 == len || NULL == buf || NULL == chan->shm ) {
+        return ACH_EINVAL;
+    }
+
+    ach_header_t *shm = chan->shm;
+
+    if( shm->slot_size ? shm->slot_size < len : shm->data_size < len ) {
+        return ACH_OVERFLOW;
+    }
+
+    /* take write lock */
+    {
+        enum ach_status r = chan_wrlock( chan );
+        if( ACH_OK != r ) return r;
+    }
+    shm = chan->shm;
+
+    /* unchanged frame, just note that it is still current */
+    if( shm->dedup && put_same( shm, buf, len ) ) {
+        clock_gettime( shm->clock, &ACH_SHM_INDEX(shm)[last_index_i(shm)].time );
+        /* nothing new to read, so don't wake anyone */
+        clear_dirty( shm );
+        unrdlock( shm );
+        return ACH_OK;
+    }
+
+    /* wait for subscribers to make room */
+    while( put_blocked( shm, len ) ) {
+        int r;
+        /* a dead subscriber must not stall us */
+        if( sub_reap( shm ) ) continue;
+        clear_dirty( shm );
+        if( ! wait ) {
+            unrdlock( shm );
+            return ACH_EAGAIN;
+        } else if( abstime ) {
+            r = pthread_cond_timedwait( &shm->sync.cond, &shm->sync.mutex, abstime );
+        } else {
+            r = pthread_cond_wait( &shm->sync.cond, &shm->sync.mutex );
+        }
+        if( ETIMEDOUT == r ) {
+            unrdlock( shm );
+            return ACH_TIMEOUT;
+        }
+        /* the channel may have been resized while we waited */
+        enum ach_status s = remap_locked( chan );
+        shm = chan->shm;
+        if( ACH_OK != s ) {
+            unrdlock( shm );
+            return s;
+        }
+        set_dirty( shm );
+    }
+
+    if( shm->slot_size ) put_fixed( shm, buf, len );
+    else put_locked( shm, buf, len );
 
     /* release write lock */
     unwrlock( shm );
     return ACH_OK;
 }
 
+enum ach_status
+ach_put( ach_channel_t *chan, const void *buf, size_t len ) {
+    return put_wait( chan, buf, len, 0, NULL );
+}
+
+enum ach_status
+ach_put_wait( ach_channel_t *chan, const void *buf, size_t len,
+              const struct timespec *ACH_RESTRICT abstime ) {
+    return put_wait( chan, buf, len, 1, abstime );
+}
+
+/* Apply patches to the freshly copied frame idx and record the
+ * changed ranges after it.
+ *
+ * \pre hold write lock on the channel
+ */
+static void patch_apply( ach_header_t *shm, ach_index_t *idx,
+                         const ach_patch_t *patch, size_t patch_cnt ) {
+    size_t i;
+    for( i = 0; i < patch_cnt; i ++ ) {
+        if( shm->slot_size ) {
+            memcpy( ACH_SHM_DATA(shm) + idx->offset + patch[i].offset,
+                    patch[i].data, patch[i].size );
+        } else {
+            ring_write( shm, (idx->offset + patch[i].offset) % shm->data_size,
+                        patch[i].data, patch[i].size );
+        }
+    }
+    /* record the ranges after the frame */
+    for( i = 0; i < idx->range_cnt; i ++ ) {
+        ach_range_t range;
+        range.offset = patch[i].offset;
+        range.size = patch[i].size;
+        ring_write( shm, (idx->offset + idx->size + i*sizeof(range)) % shm->data_size,
+                    &range, sizeof(range) );
+    }
+}
+
+enum ach_status
+ach_put_group( const ach_put_item_t *item, size_t cnt ) {
+    if( 0 == cnt || NULL == item ) return ACH_EINVAL;
+
+    ach_channel_t *chans[cnt];
+    size_t order[cnt];
+    size_t i, locked;
+    for( i = 0; i < cnt; i ++ ) {
+        if( 0 == item[i].len || NULL == item[i].buf || NULL == item[i].chan->shm ) {
+            return ACH_EINVAL;
+        }
+        chans[i] = item[i].chan;
+        order[i] = i;
+    }
+    sort_by_name( chans, order, cnt );
+    if( has_dup_chan( chans, order, cnt ) ) return ACH_EINVAL;
+
+    /* lock everything, so readers of the group see all or nothing */
+    enum ach_status retval = ACH_OK;
+    for( locked = 0; locked < cnt; locked ++ ) {
+        retval = chan_wrlock( chans[order[locked]] );
+        if( ACH_OK != retval ) break;
+    }
+
+    /* check every put will succeed before making any */
+    for( i = 0; ACH_OK == retval && i < cnt; i ++ ) {
+        ach_header_t *shm = item[i].chan->shm;
+        size_t len = item[i].len;
+        if( shm->slot_size ? shm->slot_size < len : shm->data_size < len ) {
+            retval = ACH_OVERFLOW;
+        } else if( put_blocked_reap( shm, len ) ) {
+            retval = ACH_EAGAIN;
+        }
+    }
+
+    if( ACH_OK == retval ) {
+        for( i = 0; i < cnt; i ++ ) {
+            ach_header_t *shm = item[i].chan->shm;
+            if( shm->dedup && put_same( shm, item[i].buf, item[i].len ) ) {
+                clock_gettime( shm->clock, &ACH_SHM_INDEX(shm)[last_index_i(shm)].time );
+            } else if( shm->slot_size ) {
+                put_fixed( shm, item[i].buf, item[i].len );
+            } else {
+                put_locked( shm, item[i].buf, item[i].len );
+            }
+        }
+    }
+
+    /* unlock in reverse order */
+    while( locked > 0 ) {
+        ach_header_t *shm = chans[order[--locked]]->shm;
+        if( ACH_OK == retval ) {
+            unwrlock( shm );
+        } else {
+            clear_dirty( shm );
+            unrdlock( shm );
+        }
+    }
+
+    return retval;
+}
+
+enum ach_status
+ach_put_patch( ach_channel_t *chan, const ach_patch_t *patch, size_t patch_cnt ) {
+    if( (patch_cnt && NULL == patch) || NULL == chan->shm ) {
+        return ACH_EINVAL;
+    }
+
+    /* staging for a frame that overlaps its copy, allocated unlocked */
+    void *tmp = NULL;
+    size_t tmp_size = 0;
+    ach_header_t *shm;
+    enum ach_status retval;
+    size_t i;
+
+RETRY:
+    /* take write lock */
+    {
+        enum ach_status r = chan_wrlock( chan );
+        if( ACH_OK != r ) {
+            free( tmp );
+            return r;
+        }
+    }
+    shm = chan->shm;
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+    retval = ACH_OK;
+
+    if( 0 == shm->last_seq || shm->index_free == shm->index_cnt ) {
+        retval = ACH_STALE_FRAMES;
+        goto END;
+    }
+
+    ach_index_t prev = index_ar[last_index_i(shm)];
+    size_t len = prev.size;
+    for( i = 0; i < patch_cnt; i ++ ) {
+        if( patch[i].offset > len || patch[i].size > len - patch[i].offset ||
+            (patch[i].size && NULL == patch[i].data) )
+        {
+            retval = ACH_EINVAL;
+            goto END;
+        }
+    }
+
+    size_t ranges_bytes = patch_cnt * sizeof(ach_range_t);
+    if( shm->slot_size ) {
+        /* slots hold frames of fixed size, keep ranges if they fit */
+        size_t range_cnt = (shm->slot_size - len >= ranges_bytes) ? patch_cnt : 0;
+        if( put_blocked_reap( shm, len ) ) {
+            retval = ACH_EAGAIN;
+            goto END;
+        }
+        ach_index_t *idx = put_fixed_alloc( shm, len );
+        idx->range_cnt = range_cnt;
+        if( idx->offset != prev.offset ) {
+            memcpy( ACH_SHM_DATA(shm) + idx->offset,
+                    ACH_SHM_DATA(shm) + prev.offset, len );
+        }
+        patch_apply( shm, idx, patch, patch_cnt );
+    } else {
+        if( len + ranges_bytes > shm->data_size ) {
+            retval = ACH_OVERFLOW;
+            goto END;
+        }
+        if( put_blocked_reap( shm, len + ranges_bytes ) ) {
+            retval = ACH_EAGAIN;
+            goto END;
+        }
+        if( put_evicts( shm, len + ranges_bytes ) >= prev.seq_num ) {
+            /* the new frame overlaps the old, stage it */
+            if( tmp_size < len ) {
+                /* don't stall the channel on malloc, the frame may
+                 * have grown by the time we retry */
+                clear_dirty( shm );
+                unrdlock( shm );
+                free( tmp );
+                if( NULL == (tmp = malloc( len )) ) return ACH_FAILED_SYSCALL;
+                tmp_size = len;
+                goto RETRY;
+            }
+            ring_read( shm, prev.offset, tmp, len );
+            ach_index_t *idx = put_alloc( shm, len, patch_cnt );
+            ring_write( shm, idx->offset, tmp, len );
+            patch_apply( shm, idx, patch, patch_cnt );
+        } else {
+            ach_index_t *idx = put_alloc( shm, len, patch_cnt );
+            /* ring to ring, in pieces that don't wrap */
+            size_t done = 0;
+            while( done < len ) {
+                size_t src = (prev.offset + done) % shm->data_size;
+                size_t dst = (idx->offset + done) % shm->data_size;
+                size_t cnt = len - done;
+                if( cnt > shm->data_size - src ) cnt = shm->data_size - src;
+                if( cnt > shm->data_size - dst ) cnt = shm->data_size - dst;
+                memcpy( ACH_SHM_DATA(shm) + dst, ACH_SHM_DATA(shm) + src, cnt );
+                done += cnt;
+            }
+            patch_apply( shm, idx, patch, patch_cnt );
+        }
+    }
+
+END:
+    if( ACH_OK == retval ) {
+        unwrlock( shm );
+    } else {
+        clear_dirty( shm );
+        unrdlock( shm );
+    }
+    free( tmp );
+    return retval;
+}
+
+enum ach_status
+ach_get_ranges( ach_channel_t *chan, uint64_t seq_num,
+                ach_range_t *ranges, size_t cnt, size_t *range_cnt ) {
+    if( 0 == seq_num ) return ACH_EINVAL;
+
+    enum ach_status retval = chan_rdlock( chan, 0, NULL );
+    if( ACH_OK != retval ) return retval;
+    ach_header_t *shm = chan->shm;
+
+    size_t i = seq_index_i( shm, seq_num );
+    if( i < shm->index_cnt ) {
+        ach_index_t *idx = ACH_SHM_INDEX(shm) + i;
+        if( 0 == idx->range_cnt ) {
+            /* the whole frame */
+            *range_cnt = 1;
+            if( cnt ) {
+                ranges[0].offset = 0;
+                ranges[0].size = idx->size;
+            }
+        } else {
+            size_t j;
+            *range_cnt = idx->range_cnt;
+            for( j = 0; j < idx->range_cnt && j < cnt; j ++ ) {
+                ring_read( shm, (idx->offset + idx->size + j*sizeof(ach_range_t)) % shm->data_size,
+                           ranges + j, sizeof(ach_range_t) );
+            }
+        }
+        retval = (*range_cnt > cnt) ? ACH_OVERFLOW : ACH_OK;
+    } else if( seq_num > shm->last_seq ) {
+        retval = ACH_STALE_FRAMES;
+    } else {
+        retval = ACH_MISSED_FRAME;
+    }
+
+    unrdlock( shm );
+    return retval;
+}
+
+enum ach_status
+ach_subscribe( ach_channel_t *chan ) {
+    if( chan->sub_slot ) return ACH_OK;
+
+    enum ach_status retval = chan_rdlock( chan, 0, NULL );
+    if( ACH_OK != retval ) return retval;
+
+    ach_header_t *shm = chan->shm;
+    ach_sub_t *sub = ACH_SHM_SUB(shm);
+    size_t i;
+    retval = ACH_OVERFLOW;
+    if( shm->sub_cnt ) sub_reap( shm );
+    for( i = 0; i < shm->sub_cnt; i ++ ) {
+        if( 0 == sub[i].pid ) {
+            sub[i].pid = getpid();
+            chan->sub_slot = i + 1;
+            sub_update( shm, chan, 0 );
+            retval = ACH_OK;
+            break;
+        }
+    }
+    unrdlock( shm );
+    return retval;
+}
+
+enum ach_status
+ach_unsubscribe( ach_channel_t *chan ) {
+    if( 0 == chan->sub_slot ) return ACH_OK;
+
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    memset( ACH_SHM_SUB(shm) + chan->sub_slot - 1, 0, sizeof(ach_sub_t) );
+    chan->sub_slot = 0;
+    unrdlock( shm );
+
+    /* the publisher may have been waiting on us */
+    if( shm->reliable ) {
+        int r = pthread_cond_broadcast( & shm->sync.cond );
+        assert( 0 == r );
+    }
+    return ACH_OK;
+}
+
+enum ach_status
+ach_get_subs( ach_channel_t *chan, ach_sub_t *subs, size_t cnt,
+              size_t *sub_cnt, uint64_t *last_seq ) {
+    {
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
+        if( ACH_OK != r ) return r;
+    }
+
+    ach_header_t *shm = chan->shm;
+    ach_sub_t *sub = ACH_SHM_SUB(shm);
+    size_t i, n = 0;
+    if( shm->sub_cnt ) sub_reap( shm );
+    for( i = 0; i < shm->sub_cnt; i ++ ) {
+        if( sub[i].pid ) {
+            if( n < cnt ) subs[n] = sub[i];
+            n++;
+        }
+    }
+    *last_seq = shm->last_seq;
+    unrdlock( shm );
+
+    *sub_cnt = n;
+    return n > cnt ? ACH_OVERFLOW : ACH_OK;
+}
+
+enum ach_status
+ach_resize( ach_channel_t *chan, size_t frame_cnt, size_t frame_size ) {
+    if( chan->fd < 0 || 0 == frame_cnt || 0 == frame_size ) return ACH_EINVAL;
+
+    {
+        enum ach_status r = chan_wrlock( chan );
+        if( ACH_OK != r ) return r;
+    }
+    ach_header_t *shm = chan->shm;
+    enum ach_status retval = ACH_OK;
+
+    size_t slot_size = 0;
+    if( shm->slot_size ) {
+        slot_size = (frame_size + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+        frame_size = slot_size;
+    }
+    size_t data_size = frame_cnt * frame_size;
+    size_t len = sizeof( ach_header_t) +
+        frame_cnt*sizeof( ach_index_t ) +
+        data_size +
+        shm->sub_cnt*sizeof( ach_sub_t ) +
+        4*sizeof(uint64_t);
+
+    /* grow only, subscribers may still hold references to old sizes */
+    if( frame_cnt < shm->index_cnt || data_size < shm->data_size ||
+        slot_size < shm->slot_size )
+    {
+        retval = ACH_EINVAL;
+        goto END;
+    }
+    if( len == shm->len ) goto END;
+
+    /* Save the retained frames with their changed ranges, oldest
+     * first, and subscriber table.  The new layout overlaps the old. */
+    size_t n = shm->index_cnt - shm->index_free;
+    size_t oldest = oldest_index_i(shm);
+    size_t i, used = 0;
+    ach_index_t *index_ar = ACH_SHM_INDEX(shm);
+    for( i = 0; i < n; i ++ ) used += idx_bytes( index_ar + (oldest + i) % shm->index_cnt );
+
+    size_t save_len = n*sizeof(ach_index_t) + shm->sub_cnt*sizeof(ach_sub_t) + used;
+    uint8_t *save = (uint8_t*)malloc( save_len ? save_len : 1 );
+    if( NULL == save ) {
+        retval = ACH_FAILED_SYSCALL;
+        goto END;
+    }
+    ach_index_t *save_index = (ach_index_t*)save;
+    ach_sub_t *save_sub = (ach_sub_t*)(save_index + n);
+    uint8_t *save_data = (uint8_t*)(save_sub + shm->sub_cnt);
+    {
+        size_t offset = 0;
+        for( i = 0; i < n; i ++ ) {
+            ach_index_t *idx = index_ar + (oldest + i) % shm->index_cnt;
+            save_index[i] = *idx;
+            copy_frame( shm, idx, save_data + offset );
+            ring_read( shm, (idx->offset + idx->size) % shm->data_size,
+                       save_data + offset + idx->size,
+                       idx->range_cnt * sizeof(ach_range_t) );
+            offset += idx_bytes( idx );
+        }
+    }
+    memcpy( save_sub, ACH_SHM_SUB(shm), shm->sub_cnt*sizeof(ach_sub_t) );
+
+    /* grow the file and map it */
+    ach_header_t *new_shm;
+    if( ftruncate( chan->fd, (off_t)len ) ) {
+        retval = check_errno();
+        free(save);
+        goto END;
+    }
+    if( (new_shm = (ach_header_t*) mmap( NULL, len, PROT_READ|PROT_WRITE,
+                                         MAP_SHARED, chan->fd, 0ul) )
+        == MAP_FAILED ) {
+        retval = check_errno();
+        free(save);
+        goto END;
+    }
+    munmap( shm, chan->len );
+    shm = chan->shm = new_shm;
+
+    /* lay out the frames again from the start */
+    shm->index_cnt = frame_cnt;
+    shm->data_size = data_size;
+    shm->slot_size = slot_size;
+    index_ar = ACH_SHM_INDEX(shm);
+    memset( index_ar, 0, frame_cnt*sizeof(ach_index_t) );
+    {
+        size_t offset = 0;
+        for( i = 0; i < n; i ++ ) {
+            index_ar[i] = save_index[i];
+            index_ar[i].offset = slot_size ? i * slot_size : offset;
+            memcpy( ACH_SHM_DATA(shm) + index_ar[i].offset,
+                    save_data + offset, idx_bytes( save_index + i ) );
+            offset += idx_bytes( save_index + i );
+        }
+    }
+    shm->index_head = n % frame_cnt;
+    shm->index_free = frame_cnt - n;
+    if( slot_size ) {
+        shm->data_head = 0;
+        shm->data_free = data_size;
+    } else {
+        shm->data_head = used % data_size;
+        shm->data_free = data_size - used;
+    }
+    memcpy( ACH_SHM_SUB(shm), save_sub, shm->sub_cnt*sizeof(ach_sub_t) );
+    free(save);
+
+    *ACH_SHM_GUARD_INDEX(shm) = ACH_SHM_GUARD_INDEX_NUM;
+    *ACH_SHM_GUARD_DATA(shm) = ACH_SHM_GUARD_DATA_NUM;
+    *ACH_SHM_GUARD_SUB(shm) = ACH_SHM_GUARD_SUB_NUM;
+
+    /* other handles remap when they see the new length */
+    shm->len = chan->len = len;
+    {
+        size_t j = seq_index_i( shm, chan->seq_num + 1 );
+        chan->next_index = (j < shm->index_cnt) ? j : shm->index_head;
+    }
+
+END:
+    unwrlock( shm );
+    return retval;
+}
+
 enum ach_status
 ach_close( ach_channel_t *chan ) {
 
     /* Check guard bytes */
     {
-        enum ach_status r = check_guards(chan->shm);
+        enum ach_status r = chan_rdlock( chan, 0, NULL );
         if( ACH_OK != r ) return r;
+        unrdlock( chan->shm );
     }
 
+    /* give up our subscriber slot */
+    ach_unsubscribe( chan );
+
     /* fprintf(stderr, "Closing\n"); */
     /* note the close in the channel */
     if( chan->attr.map_anon ) {
-        /* FIXME: what to do here?? */
-        ;
+        ach_header_t *shm = chan->shm;
+        size_t refcnt;
+        rdlock( shm );
+        refcnt = --shm->refcnt;
+        unrdlock( shm );
+        /* last handle frees the channel */
+        if( 0 == refcnt ) {
+            pthread_cond_destroy( &shm->sync.cond );
+            pthread_mutex_destroy( &shm->sync.mutex );
+            free( shm );
+        }
+        chan->shm = NULL;
     } else {
         /* remove mapping */
         int r = munmap(chan->shm, chan->len);
@@ -804,6 +2210,7 @@ ach_close( ach_channel_t *chan ) {
 }
 
 void ach_dump( ach_header_t *shm ) {
+    size_t i;
     fprintf(stderr, "Magic: %x\n", shm->magic );
     fprintf(stderr, "len: %"PRIuPTR"\n", shm->len );
     fprintf(stderr, "data_size: %"PRIuPTR"\n", shm->data_size );
@@ -815,6 +2222,20 @@ void ach_dump( ach_header_t *shm ) {
     fprintf(stderr, "head guard:  %"PRIx64"\n", * ACH_SHM_GUARD_HEADER(shm) );
     fprintf(stderr, "index guard: %"PRIx64"\n", * ACH_SHM_GUARD_INDEX(shm) );
     fprintf(stderr, "data guard:  %"PRIx64"\n", * ACH_SHM_GUARD_DATA(shm) );
+    fprintf(stderr, "sub guard:   %"PRIx64"\n", * ACH_SHM_GUARD_SUB(shm) );
+    fprintf(stderr, "reliable: %d\n", shm->reliable );
+    fprintf(stderr, "slot_size: %"PRIuPTR"\n", shm->slot_size );
+    fprintf(stderr, "dedup: %d\n", shm->dedup );
+    fprintf(stderr, "anon: %d\n", shm->anon );
+    fprintf(stderr, "sub_cnt: %"PRIuPTR"\n", shm->sub_cnt );
+    for( i = 0; i < shm->sub_cnt; i ++ ) {
+        ach_sub_t *sub = ACH_SHM_SUB(shm) + i;
+        if( sub->pid ) {
+            fprintf(stderr, "  sub %"PRIuPTR": pid %d, seq %"PRIu64", lag %"PRIu64", missed %"PRIu64"\n",
+                    i, (int)sub->pid, sub->seq_num,
+                    shm->last_seq - sub->seq_num, sub->missed );
+        }
+    }
 
     fprintf(stderr, "head seq:  %"PRIu64"\n",
             (ACH_SHM_INDEX(shm) +
@@ -51,7 +51,6 @@
 #include <sys/wait.h>
 #include <ctype.h>
 #include <signal.h>
-#include <regex.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -94,6 +93,22 @@ static const struct achd_conn_vtab handlers[] = {
      .direction = ACHD_DIRECTION_PULL,
      .connect = achd_udp_sock,
      .handler = achd_pull_udp },
+    {.transport = "mcast",
+     .direction = ACHD_DIRECTION_PUSH,
+     .connect = achd_mcast_sock,
+     .handler = achd_push_mcast },
+    {.transport = "mcast",
+     .direction = ACHD_DIRECTION_PULL,
+     .connect = achd_connect_nop,
+     .handler = achd_pull_mcast },
+    {.transport = "mux",
+     .direction = ACHD_DIRECTION_PUSH,
+     .connect = achd_connect_nop,
+     .handler = achd_mux },
+    {.transport = "mux",
+     .direction = ACHD_DIRECTION_PULL,
+     .connect = achd_connect_nop,
+     .handler = achd_mux },
     {.transport = NULL,
      .direction = ACHD_DIRECTION_VOID,
      .connect = NULL,
@@ -115,7 +130,7 @@ int main(int argc, char **argv) {
     /* process options */
     int c = 0, i = 0;
     while( -1 != c ) {
-        while( (c = getopt( argc, argv, "dp:t:f:z:qrvV?")) != -1 ) {
+        while( (c = getopt( argc, argv, "dp:t:f:z:g:e:c:u:NIqrvV?")) != -1 ) {
             switch(c) {
             case 'z':
                 cx.cl_opts.remote_chan_name = strdup(optarg);
@@ -123,6 +138,36 @@ int main(int argc, char **argv) {
             case 'd':
                 cx.daemonize = 1;
                 break;
+            case 'g':
+                cx.mcast_group = strdup(optarg);
+                break;
+            case 'e':
+                cx.cl_opts.fec_group = atoi(optarg);
+                if( cx.cl_opts.fec_group < 0 || cx.cl_opts.fec_group > ACHD_FEC_GROUP_MAX ) {
+                    achd_log(LOG_ERR, "Invalid FEC group: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                cx.cl_opts.coalesce_bytes = atoi(optarg);
+                if( cx.cl_opts.coalesce_bytes < 0 || cx.cl_opts.coalesce_bytes > ACHD_COALESCE_MAX ) {
+                    achd_log(LOG_ERR, "Invalid coalesce size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                cx.cl_opts.coalesce_us = atoi(optarg);
+                if( cx.cl_opts.coalesce_us < 0 ) {
+                    achd_log(LOG_ERR, "Invalid coalesce time: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'N':
+                cx.cl_opts.tcp_nodelay = 1;
+                break;
+            case 'I':
+                cx.cl_opts.in_place = 1;
+                break;
             case 'p':
                 cx.port = atoi(optarg);
                 if( !optarg ) {
@@ -149,14 +194,26 @@ int main(int argc, char **argv) {
                 ach_print_version("achd");
                 exit(EXIT_SUCCESS);
             case '?':
-                puts( "Usage: achd [OPTIONS...] [serve|push|pull] [HOST  CHANNEL] \n"
+                puts( "Usage: achd [OPTIONS...] [serve|listen|push|pull] [HOST  CHANNEL...] \n"
                       "Daemon process to forward ach channels over network and dump to files\n"
                       "\n"
                       "Options:\n"
-                      "  -d,                          daemonize (client-mode only)\n"
+                      "  -d,                          daemonize (client and listen modes)\n"
                       "  -p PORT,                     port\n"
                       "  -f FILE,                     TODO: lock FILE and write pid\n"
-                      "  -t (tcp|udp),                transport (default tcp)\n"
+                      "  -t (tcp|udp|mcast|mux),      transport (default tcp)\n"
+                      "  -g GROUP,                    multicast group to publish to (server)\n"
+                      "  -e COUNT,                    UDP forward error correction, one parity\n"
+                      "                               datagram per COUNT (at most 32)\n"
+                      "  -c BYTES,                    coalesce TCP frames into writes of up to\n"
+                      "                               BYTES (at most 4 MiB), implies -N\n"
+                      "  -u USEC,                     hold coalesced frames at most USEC\n"
+                      "                               (default 1000)\n"
+                      "  -N,                          disable Nagle's algorithm (TCP_NODELAY)\n"
+                      "  -I,                          send frames of a reliable channel over TCP\n"
+                      "                               straight from shared memory.  achd then\n"
+                      "                               subscribes, so ach_put() to the channel\n"
+                      "                               returns ACH_EAGAIN while the link lags\n"
                       "  -z CHANNEL_NAME,             remote channel name\n"
                       "  -r,                          reconnect if connection is lost\n"
                       "  -q,                          be quiet\n"
@@ -172,11 +229,19 @@ int main(int argc, char **argv) {
                       "Examples:\n"
                       "  achd serve                   Server process reading from stdin/stdout.\n"
                       "                               This can be run from inetd.\n"
+                      "  achd -d listen               Standalone server accepting connections on\n"
+                      "                               the port itself, serving many clients from\n"
+                      "                               one process without inetd.\n"
                       "  achd pull golem state-chan   Forward frames via TCP from remote channel\n"
                       "                               'state-chan' on host 'golem' to local channel\n"
                       "                               (a pull from the remote server).\n"
                       "                               An achd server must be listening on the remote\n"
                       "                               host.\n"
+                      "  achd -t mux pull golem a b c Forward frames from remote channels 'a', 'b',\n"
+                      "                               and 'c' over a single TCP connection.\n"
+                      "  achd -t mcast pull golem cam Receive remote channel 'cam' from a multicast\n"
+                      "                               group, which the server publishes to once for\n"
+                      "                               all its subscribers.\n"
                       "  achd -r push golem cmd-chan  Forward frames via TCP from local channel\n"
                       "                               'cmd-chan' to remote channel on host 'golem'\n"
                       "                               (a push to the remote server).\n"
@@ -198,6 +263,19 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* Simulated UDP loss, only for testing */
+    const char *loss = getenv("ACHD_UDP_LOSS");
+    if( loss ) {
+        char *end;
+        double percent = strtod( loss, &end );
+        if( end == loss || *end || !(percent >= 0 && percent <= 100) ) {
+            achd_log(LOG_ERR, "Invalid ACHD_UDP_LOSS: %s\n", loss);
+            exit(EXIT_FAILURE);
+        }
+        cx.udp_loss = percent / 100;
+        achd_log(LOG_WARNING, "Dropping %g%% of sent UDP datagrams\n", percent);
+    }
+
     /* Set some other default options */
     if( !cx.cl_opts.chan_name ) {
         cx.cl_opts.chan_name  = cx.cl_opts.remote_chan_name;
@@ -205,6 +283,16 @@ int main(int argc, char **argv) {
     if( !cx.cl_opts.remote_chan_name ) {
         cx.cl_opts.remote_chan_name  = cx.cl_opts.chan_name;
     }
+    if( cx.mux_chan_cnt > 1 && strcasecmp(cx.cl_opts.transport, "mux") ) {
+        achd_log(LOG_ERR, "Forwarding several channels needs the mux transport\n");
+        exit(EXIT_FAILURE);
+    } else if( ACHD_MODE_PUSH == cx.mode && 0 == strcasecmp(cx.cl_opts.transport, "mcast") ) {
+        achd_log(LOG_ERR, "Multicast only pulls from the server\n");
+        exit(EXIT_FAILURE);
+    } else if( cx.mux_chan_cnt > ACHD_MUX_CHANNELS ) {
+        achd_log(LOG_ERR, "Too many channels, at most %d\n", ACHD_MUX_CHANNELS);
+        exit(EXIT_FAILURE);
+    }
 
     /* dispatch based on mode */
     /* serve */
@@ -216,6 +304,9 @@ int main(int argc, char **argv) {
         cx.error = achd_error_header;
         achd_serve();
         return 0;
+    } else if ( ACHD_MODE_LISTEN == cx.mode ) {
+        achd_listen();
+        return 0;
     } else {
         achd_client();
         return 0;
@@ -270,6 +361,8 @@ void achd_posarg(int i, const char *arg) {
         achd_log(LOG_DEBUG, "mode %s\n", arg);
         if( 0 == strcasecmp(arg, "serve") ) {
             cx.mode = ACHD_MODE_SERVE;
+        } else if( 0 == strcasecmp(arg, "listen") ) {
+            cx.mode = ACHD_MODE_LISTEN;
         } else if( 0 == strcasecmp(arg, "push") ) {
             cx.mode = ACHD_MODE_PUSH;
             cx.cl_opts.direction = ACHD_DIRECTION_PUSH;
@@ -285,13 +378,13 @@ void achd_posarg(int i, const char *arg) {
         achd_log(LOG_DEBUG, "host %s\n", arg);
         cx.cl_opts.remote_host = strdup(arg);
         break;
-    case 2:
-        achd_log(LOG_DEBUG, "channel %s\n", arg);
-        cx.cl_opts.chan_name = strdup(arg);
-        break;
     default:
-        achd_log(LOG_ERR, "Spurious argument: %s\n", arg);
-        exit(EXIT_FAILURE);
+        achd_log(LOG_DEBUG, "channel %s\n", arg);
+        if( 2 == i ) cx.cl_opts.chan_name = strdup(arg);
+        /* the first name may still be replaced by -z */
+        cx.mux_chans = (const char**)realloc( cx.mux_chans, sizeof(cx.mux_chans[0]) * (size_t)(i-1) );
+        cx.mux_chans[i-2] = strdup(arg);
+        cx.mux_chan_cnt = (size_t)(i-1);
     }
 }
 
@@ -299,6 +392,23 @@ void achd_posarg(int i, const char *arg) {
 * Server *
 *********/
 
+/* Continue after the last frame a reconnecting puller has */
+static void serve_resume( struct achd_conn *conn ) {
+    uint64_t seq = conn->recv_hdr.resume_seq;
+    enum ach_status r = ach_seek( &conn->channel, seq );
+    if( ACH_OK == r ) {
+        achd_log( LOG_INFO, "Resuming after frame %" PRIu64 "\n", seq );
+    } else if( ACH_MISSED_FRAME == r ) {
+        /* the puller sees the gap from the frame numbers */
+        achd_log( LOG_NOTICE, "Resuming from oldest frame, frames after %" PRIu64 " lost\n", seq );
+    } else {
+        /* probably a new channel */
+        achd_log( LOG_NOTICE, "Cannot resume after frame %" PRIu64 ": %s\n",
+                  seq, ach_result_to_string(r) );
+        ach_flush( &conn->channel );
+    }
+}
+
 void achd_serve() {
     sighandler_install();
 
@@ -318,7 +428,7 @@ void achd_serve() {
     conn.out = STDOUT_FILENO;
     conn.mode = ACHD_MODE_SERVE;
     {
-        enum ach_status r = achd_parse_headers( conn.in, &conn.recv_hdr );
+        enum ach_status r = achd_parse_headers( conn.in, &conn.rbuf, &conn.recv_hdr );
         if( ACH_OK != r ) {
             cx.error(r, "Bad headers\n");
         }
@@ -326,8 +436,10 @@ void achd_serve() {
 
     /* check transport headers */
     if( !conn.recv_hdr.chan_name ) conn.recv_hdr.chan_name = conn.recv_hdr.remote_chan_name;
+    /* multiplexed connections name their channels later */
+    int mux = conn.recv_hdr.transport && 0 == strcasecmp(conn.recv_hdr.transport, "mux");
 
-    if( !conn.recv_hdr.chan_name ) {
+    if( !conn.recv_hdr.chan_name && !mux ) {
         cx.error( ACH_BAD_HEADER, "%s:%d no channel header\n", inet_ntoa(addr.sin_addr), addr.sin_port);
     } else if( ! conn.recv_hdr.transport ) {
         cx.error( ACH_BAD_HEADER, "%s:%d no transport header\n", inet_ntoa(addr.sin_addr), addr.sin_port);
@@ -337,17 +449,33 @@ void achd_serve() {
         cx.error( ACH_BAD_HEADER, "%s:%d no direction header\n", inet_ntoa(addr.sin_addr), addr.sin_port);
     } else {
         achd_log( LOG_NOTICE, "serving %s:%d channel %s via %s %s\n",
-                  inet_ntoa(addr.sin_addr), addr.sin_port, conn.recv_hdr.chan_name,
+                  inet_ntoa(addr.sin_addr), addr.sin_port,
+                  mux ? "(multiplexed)" : conn.recv_hdr.chan_name,
                   conn.recv_hdr.transport,
                   (ACHD_DIRECTION_PUSH == conn.recv_hdr.direction) ? "push" : "pull" );
     }
 
+    if( mux ) {
+        conn.vtab = achd_get_vtab( conn.recv_hdr.transport, conn.recv_hdr.direction );
+        assert( conn.vtab && conn.vtab->handler );
+        achd_printf(conn.out,
+                    "status: %d # %s\n"
+                    ".\n",
+                    ACH_OK, ach_result_to_string(ACH_OK) );
+        cx.error = achd_error_log;
+        conn.vtab->handler( &conn );
+        achd_log( LOG_INFO, "Finished serving %s:%d\n", inet_ntoa(addr.sin_addr), addr.sin_port );
+        return;
+    }
+
     /* open channel */
     {
         enum ach_status r = ach_open( &conn.channel, conn.recv_hdr.chan_name, NULL );
         if( ACH_OK != r ) {
             cx.error( r, "Couldn't open channel %s - %s\n", conn.recv_hdr.chan_name, strerror(errno) );
             assert(0);
+        } else if( conn.recv_hdr.resume && conn.recv_hdr.resume_seq ) {
+            serve_resume( &conn );
         } else {
             ach_flush(&conn.channel);
         }
@@ -389,138 +517,196 @@ void achd_serve() {
 /**********
 * HEADERS *
 **********/
-static void achd_set_header
+static enum ach_status achd_set_header
 (const char *key, const char *val, struct achd_headers *headers);
-static void achd_set_int(int *pint, const char *name, const char *val);
-static void achd_set_status(enum ach_status *pint, const char *name, const char *val);
-
-#define REGEX_WORD "([^:=\n]*)"
-#define REGEX_SPACE "[[:blank:]\n\r]*"
-
-enum ach_status achd_parse_headers(int fd, struct achd_headers *headers) {
-    regex_t line_regex, dot_regex;
-    regmatch_t match[3];
-    if (regcomp(&line_regex,
-                "^"REGEX_SPACE"$|"     /* empty line */
-                "^"REGEX_SPACE         /* beginning space */
-                REGEX_WORD             /* key */
-                REGEX_SPACE            /* mid space */
-                "[:=]"
-                REGEX_SPACE            /* mid space */
-                REGEX_WORD             /* value */
-                REGEX_SPACE            /* end space */
-                "$",
-                REG_EXTENDED ) ) {
-        cx.error(ACH_BUG, "couldn't compile regex\n");
-        assert(0);
+static enum ach_status achd_set_int(int *pint, const char *name, const char *val);
+static enum ach_status achd_set_status(enum ach_status *pint, const char *name, const char *val);
+static enum ach_status achd_set_seq(uint64_t *pseq, const char *name, const char *val);
+
+/* Blanks around keys, values and the final dot */
+static int is_blank( char c ) {
+    return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+}
+
+/* Trim blanks from the end of [p, end) */
+static char *trim_end( char *p, char *end ) {
+    while( end > p && is_blank(end[-1]) ) end--;
+    *end = '\0';
+    return p;
+}
+
+/* A line is blank, ".", or "key: value" / "key = value", and anything
+ * after '#' is a comment. */
+enum ach_status achd_parse_header_line(char *lineptr, struct achd_headers *headers, int *done) {
+    *done = 0;
+    /* kill comments */
+    char *end = strchr(lineptr, '#');
+    if( !end ) end = lineptr + strlen(lineptr);
+    *end = '\0';
+
+    char *p = lineptr;
+    while( is_blank(*p) ) p++;
+    trim_end( p, end );
+
+    /* Break on ".\n" */
+    if( '.' == p[0] && '\0' == p[1] ) {
+        *done = 1;
+        return ACH_OK;
     }
-    if( regcomp(&dot_regex,
-                "^"REGEX_SPACE "." REGEX_SPACE "$",
-                REG_EXTENDED) ) {
-        cx.error(ACH_BUG, "couldn't compile regex\n");
-        assert(0);
+    if( '\0' == *p ) return ACH_OK;
+
+    /* split key and value */
+    char *sep = strpbrk( p, ":=" );
+    if( !sep ) {
+        achd_log( LOG_ERR, "malformed header: %s\n", lineptr );
+        return ACH_BAD_HEADER;
     }
+    char *key = trim_end( p, sep );
+    char *val = sep + 1;
+    while( is_blank(*val) ) val++;
+
+    achd_log( LOG_DEBUG, "header parsed `%s' : `%s'\n", key, val );
+    return achd_set_header(key, val, headers);
+}
 
+enum ach_status achd_parse_headers(int fd, struct achd_rbuf *rbuf, struct achd_headers *headers) {
     int line = 0;
     size_t n = ACHD_LINE_LENGTH;
     char lineptr[n];
     enum ach_status r;
-    while( ACH_OK == (r = achd_readline(fd, lineptr, n)) ) {
+    while( ACH_OK == (r = achd_readline(fd, rbuf, lineptr, n)) ) {
         line++;
-        /* Break on ".\n" */
-        if (! regexec(&dot_regex, lineptr, 0, NULL, 0)) break;
         achd_log(LOG_DEBUG, "header line %d: %s\n", line, lineptr);
-        /* kill comments and translate */
-        char *cmt = strchr(lineptr, '#');
-        if( cmt ) *cmt = '\0';
-        /* match key/value */
-        int i = regexec(&line_regex, lineptr, sizeof(match)/sizeof(match[0]), match, 0);
-        if( i ) {
-            cx.error( ACH_BAD_HEADER, "malformed header\n");
+        char text[n];
+        strcpy( text, lineptr );
+        int done;
+        r = achd_parse_header_line( lineptr, headers, &done );
+        if( ACH_OK != r ) {
+            cx.error( r, "bad header line %d: %s\n", line, text );
             assert(0);
         }
-        assert( ! strchr(lineptr, '#') );
-        if( match[1].rm_so >= 0 && match[2].rm_so >=0 ) {
-            lineptr[match[1].rm_eo] = '\0';
-            lineptr[match[2].rm_eo] = '\0';
-            char *key = lineptr+match[1].rm_so;
-            char *val = lineptr+match[2].rm_so;
-            achd_log( LOG_DEBUG, "header line %d parsed `%s' : `%s'\n", line, key, val );
-            achd_set_header(key, val, headers);
-        }
-
+        if( done ) break;
     }
-    regfree(&line_regex);
-    regfree(&dot_regex);
     return r;
 }
 
-void achd_set_int(int *pint, const char *name, const char *val) {
+enum ach_status achd_set_int(int *pint, const char *name, const char *val) {
     errno = 0;
     long i = strtol( val, NULL, 10 );
     if( errno ) {
-        cx.error( ACH_BAD_HEADER, "Invalid %s %s: %s\n", name, val, strerror(errno) );
-        assert(0);
+        achd_log( LOG_ERR, "Invalid %s %s: %s\n", name, val, strerror(errno) );
+        return ACH_BAD_HEADER;
     }
     *pint = (int) i;
+    return ACH_OK;
+}
+
+enum ach_status achd_set_seq(uint64_t *pseq, const char *name, const char *val) {
+    errno = 0;
+    unsigned long long i = strtoull( val, NULL, 10 );
+    if( errno ) {
+        achd_log( LOG_ERR, "Invalid %s %s: %s\n", name, val, strerror(errno) );
+        return ACH_BAD_HEADER;
+    }
+    *pseq = (uint64_t) i;
+    return ACH_OK;
 }
 
-void achd_set_status(enum ach_status *pint, const char *name, const char *val) {
+enum ach_status achd_set_status(enum ach_status *pint, const char *name, const char *val) {
     errno = 0;
     long i = strtol( val, NULL, 10 );
     if( errno ) {
-        cx.error( ACH_BAD_HEADER, "Invalid %s %s: %s\n", name, val, strerror(errno) );
-        assert(0);
+        achd_log( LOG_ERR, "Invalid %s %s: %s\n", name, val, strerror(errno) );
+        return ACH_BAD_HEADER;
     }
     *pint = (enum ach_status) i;
+    return ACH_OK;
 }
 
 
-int achd_parse_boolean( const char *value ) {
+static enum ach_status achd_parse_boolean( int *pint, const char *value ) {
     const char *yes[] = {"yes", "true", "1", "t", "y", "+", "aye", NULL};
     const char *no[] = {"no", "false", "0", "f", "n", "-", "nay", NULL};
     const char** s;
     for( s = yes; *s; s++ )
-        if( 0 == strcasecmp(*s, value) ) return 1;
+        if( 0 == strcasecmp(*s, value) ) { *pint = 1; return ACH_OK; }
     for( s = no; *s; s++ )
-        if( 0 == strcasecmp(*s, value) ) return 0;
-    cx.error(ACH_BAD_HEADER, "Invalid boolean: %s\n", value);
-    assert(0);
+        if( 0 == strcasecmp(*s, value) ) { *pint = 0; return ACH_OK; }
+    achd_log( LOG_ERR, "Invalid boolean: %s\n", value );
+    return ACH_BAD_HEADER;
 }
 
-void achd_set_header (const char *key, const char *val, struct achd_headers *headers) {
+enum ach_status achd_set_header (const char *key, const char *val, struct achd_headers *headers) {
     if       ( 0 == strcasecmp(key, "channel-name")) {
         headers->chan_name = strdup(val);
     } else if( 0 == strcasecmp(key, "frame-size")) {
-        achd_set_int( &headers->frame_size, "frame size", val );
+        return achd_set_int( &headers->frame_size, "frame size", val );
     } else if( 0 == strcasecmp(key, "frame-count")) {
-        achd_set_int( &headers->frame_count, "frame count", val );
+        return achd_set_int( &headers->frame_count, "frame count", val );
     } else if( 0 == strcasecmp(key, "remote-port")) {
-        achd_set_int( &headers->remote_port, "remote port", val );
+        return achd_set_int( &headers->remote_port, "remote port", val );
     } else if( 0 == strcasecmp(key, "local-port")) {
-        achd_set_int( &headers->local_port, "local port", val );
+        return achd_set_int( &headers->local_port, "local port", val );
     } else if( 0 == strcasecmp(key, "remote-host")) {
         headers->remote_host = strdup(val);
     } else if( 0 == strcasecmp(key, "transport")) {
         headers->transport = strdup(val);
+    } else if( 0 == strcasecmp(key, "multicast-group")) {
+        headers->multicast_group = strdup(val);
+    } else if( 0 == strcasecmp(key, "multicast-token")) {
+        enum ach_status r = achd_set_seq( &headers->multicast_token, "multicast token", val );
+        if( ACH_OK == r && headers->multicast_token > UINT32_MAX ) {
+            achd_log( LOG_ERR, "Invalid multicast token: %s\n", val );
+            r = ACH_BAD_HEADER;
+        }
+        headers->has_multicast_token = (ACH_OK == r);
+        return r;
+    } else if( 0 == strcasecmp(key, "fec-group")) {
+        enum ach_status r = achd_set_int( &headers->fec_group, "FEC group", val );
+        if( ACH_OK == r && (headers->fec_group < 0 || headers->fec_group > ACHD_FEC_GROUP_MAX) ) {
+            achd_log( LOG_ERR, "Invalid FEC group: %s\n", val );
+            r = ACH_BAD_HEADER;
+        }
+        return r;
+    } else if( 0 == strcasecmp(key, "coalesce-bytes")) {
+        enum ach_status r = achd_set_int( &headers->coalesce_bytes, "coalesce size", val );
+        if( ACH_OK == r && (headers->coalesce_bytes < 0 || headers->coalesce_bytes > ACHD_COALESCE_MAX) ) {
+            achd_log( LOG_ERR, "Invalid coalesce size: %s\n", val );
+            r = ACH_BAD_HEADER;
+        }
+        return r;
+    } else if( 0 == strcasecmp(key, "coalesce-us")) {
+        enum ach_status r = achd_set_int( &headers->coalesce_us, "coalesce time", val );
+        if( ACH_OK == r && headers->coalesce_us < 0 ) {
+            achd_log( LOG_ERR, "Invalid coalesce time: %s\n", val );
+            r = ACH_BAD_HEADER;
+        }
+        return r;
+    } else if( 0 == strcasecmp(key, "resume-seq")) {
+        headers->resume = 1;
+        return achd_set_seq( &headers->resume_seq, "resume sequence number", val );
     } else if( 0 == strcasecmp(key, "tcp-nodelay")) {
-        headers->tcp_nodelay = achd_parse_boolean( val );
+        return achd_parse_boolean( &headers->tcp_nodelay, val );
+    } else if( 0 == strcasecmp(key, "in-place")) {
+        return achd_parse_boolean( &headers->in_place, val );
     } else if( 0 == strcasecmp(key, "retry")) {
-        headers->retry = achd_parse_boolean( val );
+        return achd_parse_boolean( &headers->retry, val );
     } else if( 0 == strcasecmp(key, "direction")) {
         if( 0 == strcasecmp(val, "push") ) headers->direction = ACHD_DIRECTION_PUSH;
         else if( 0 == strcasecmp(val, "pull") ) headers->direction = ACHD_DIRECTION_PULL;
         else {
-            cx.error( ACH_BAD_HEADER, "Invalid direction: %s\n", val);
-            assert(0);
+            achd_log( LOG_ERR, "Invalid direction: %s\n", val);
+            return ACH_BAD_HEADER;
         }
     } else if ( 0 == strcasecmp(key, "status") ) {
-        achd_set_status( &headers->status, "status", val );
+        return achd_set_status( &headers->status, "status", val );
     } else if ( 0 == strcasecmp(key, "message") ) {
         headers->message = strdup(val);
     } else {
-        cx.error( ACH_BAD_HEADER, "Invalid header: %s\n", key );
+        achd_log( LOG_ERR, "Invalid header: %s\n", key );
+        return ACH_BAD_HEADER;
     }
+    return ACH_OK;
 }
 
 
@@ -48,7 +48,6 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <ctype.h>
 #include <signal.h>
 #include <regex.h>
@@ -68,12 +67,9 @@
 * Client *
 *********/
 
-static void client_refork(void);
 static int socket_connect(void);
 static int server_connect( struct achd_conn*);
-static void daemonize(void);
 static void sleep_till( const struct timespec *t0, int32_t ns );
-static pid_t wait_for_child( pid_t pid );
 
 void achd_client() {
     /* First, do some checks to make sure we can process the request */
@@ -96,8 +92,16 @@ void achd_client() {
             cx.cl_opts.direction == ACHD_DIRECTION_PULL );
     conn.send_hdr.transport = cx.cl_opts.transport;
 
-    /* Check the channel */
+    /* ask for numbered frames so a reconnect picks up where we left off */
+    if( cx.reconnect && ACHD_DIRECTION_PULL == cx.cl_opts.direction &&
+        0 == strcasecmp( cx.cl_opts.transport, "tcp" ) )
     {
+        conn.send_hdr.resume = 1;
+    }
+
+    /* Check the channel, multiplexed channels are opened by the handler */
+    int mux = 0 == strcasecmp( cx.cl_opts.transport, "mux" );
+    if( !mux ) {
         enum ach_status r = ach_open(&conn.channel, cx.cl_opts.chan_name, NULL );
         if( ACH_ENOENT == r ) {
             achd_log(LOG_INFO, "Local channel %s not found, creating\n", cx.cl_opts.chan_name);
@@ -114,41 +118,29 @@ void achd_client() {
 
     /* maybe daemonize */
     if( cx.daemonize ) {
-        daemonize();
+        achd_daemonize();
     }
 
-    /* fork a worker if we are to retry connectons */
-    client_refork();
-
-    /* Finally, start the show, possibly in a child process */
-
     /* Open initial connection */
     int fd = server_connect( &conn );
     if( fd < 0 ) fd = achd_reconnect( &conn );
 
     /* Allocate buffers */
-    conn.pipeframe_size =
-        conn.channel.shm->data_size / conn.channel.shm->index_cnt;
-    conn.pipeframe = ach_pipe_alloc( conn.pipeframe_size );
-
-    /* TODO: If we lose and then re-establish a connections, frames
-     * may be missed or duplicated.
-     *
-     * This can be more easily fixed with a pushing client, since it
-     * can maintain channel context and try to reconnect.  We just
-     * need to buffer the last read frame till we reconnect, or re-get
-     * it with ACH_O_COPY.  Other frames can remain buffered in the
-     * channel.  If the client dies, though, we lose context.
-     *
-     * Fixing this for pulling requires the server process to persist
-     * after lost connection.  That seems harder to implement.
-     */
-
-    /* Start running */
-    if ( fd >= 0 && !cx.sig_received ) {
+    if( conn.channel.shm ) {
+        conn.pipeframe_size =
+            conn.channel.shm->data_size / conn.channel.shm->index_cnt;
+        conn.pipeframe = ach_pipe_alloc( conn.pipeframe_size );
+    }
+
+    /* Start running.  Reconnecting here keeps the channel position,
+     * so a pushing client resends from where it left off, and a
+     * pulling client tells the server the last frame it has. */
+    while( fd >= 0 && !cx.sig_received ) {
         achd_log(LOG_INFO, "Client running\n");
         conn.vtab->handler( &conn );
         achd_log(LOG_INFO, "Client done\n");
+        if( !cx.reconnect ) break;
+        fd = achd_reconnect( &conn );
     }
 }
 
@@ -172,6 +164,22 @@ static int server_connect( struct achd_conn *conn) {
         conn->in = conn->out = fd;
         if( conn->vtab->connect ) conn->vtab->connect(conn);
         conn->in = conn->out = -1;
+        if( cx.cl_opts.fec_group ) {
+            achd_printf( fd, "fec-group: %d\n", cx.cl_opts.fec_group );
+        }
+        if( cx.cl_opts.coalesce_bytes ) {
+            achd_printf( fd, "coalesce-bytes: %d\ncoalesce-us: %d\n",
+                         cx.cl_opts.coalesce_bytes, cx.cl_opts.coalesce_us );
+        }
+        if( cx.cl_opts.tcp_nodelay ) {
+            achd_printf( fd, "tcp-nodelay: 1\n" );
+        }
+        if( cx.cl_opts.in_place ) {
+            achd_printf( fd, "in-place: 1\n" );
+        }
+        if( conn->send_hdr.resume ) {
+            achd_printf( fd, "resume-seq: %" PRIu64 "\n", conn->send_hdr.resume_seq );
+        }
         enum ach_status r =
             achd_printf(fd,
                         "channel-name: %s\n"
@@ -194,9 +202,17 @@ static int server_connect( struct achd_conn *conn) {
 
     /* Get Response */
     conn->recv_hdr.status = ACH_BUG;
+    conn->rbuf.start = conn->rbuf.end = 0;
     {
-        enum ach_status r = achd_parse_headers( fd, &conn->recv_hdr );
-        if( ACH_OK != r ) {
+        enum ach_status r = achd_parse_headers( fd, &conn->rbuf, &conn->recv_hdr );
+        if( cx.reconnect && (ACH_OK != r || ACH_OK != conn->recv_hdr.status) ) {
+            /* the server side may come right, keep trying */
+            achd_log( LOG_ERR, "Server error: %s\n",
+                      (ACH_OK == r && conn->recv_hdr.message) ? conn->recv_hdr.message :
+                      ach_result_to_string( ACH_OK != r ? r : conn->recv_hdr.status ) );
+            close(fd);
+            return -1;
+        } else if( ACH_OK != r ) {
             if( errno ) {
                 cx.error( r, "Bad response from server: %s\n", strerror(errno) );
             } else {
@@ -216,7 +232,7 @@ static int server_connect( struct achd_conn *conn) {
     achd_log(LOG_DEBUG, "Server response received\n");
 
     /* Try to create channel if needed */
-    if( ! conn->channel.shm ) {
+    if( ! conn->channel.shm && strcasecmp( conn->send_hdr.transport, "mux" ) ) {
         int frame_size = conn->recv_hdr.frame_size ? conn->recv_hdr.frame_size : ACH_DEFAULT_FRAME_SIZE;
         int frame_count = conn->recv_hdr.frame_count ? conn->recv_hdr.frame_count : ACH_DEFAULT_FRAME_COUNT;
         /* Fixme: should sanity check these counts */
@@ -231,6 +247,12 @@ static int server_connect( struct achd_conn *conn) {
 
 int achd_reconnect( struct achd_conn *conn) {
     int fd = -1;
+
+    /* drop the broken connection */
+    if( conn->in >= 0 ) close( conn->in );
+    if( conn->out >= 0 && conn->out != conn->in ) close( conn->out );
+    conn->in = conn->out = -1;
+
     while( cx.reconnect && fd < 0 && !cx.sig_received ) {
         achd_log(LOG_DEBUG, "Reconnect attempt\n");
         sleep_till( &conn->t0, ACHD_RECONNECT_NS );
@@ -300,101 +322,7 @@ static void sleep_till( const struct timespec *t0, int32_t ns ) {
     }
 }
 
-/* Wait till child returns or signal received */
-static pid_t wait_for_child( pid_t pid ) {
-    assert( pid > 0 );
-    while(1)
-    {
-        int status;
-        achd_log(LOG_DEBUG, "now waiting: %d...\n", pid);
-        pid_t wpid = wait( &status );
-        achd_log(LOG_DEBUG, "wait(): %d, errno:  %s\n", wpid, strerror(errno));
-        if( wpid == pid ) {
-            achd_log(LOG_DEBUG, "WIFEXITED: %d, WIFSIGNALED: %d, WIFSTOPPED: %d\n",
-                     WIFEXITED(status),
-                     WIFSIGNALED(status),
-                     WIFSTOPPED(status));
-            /* Child did something */
-            if( WIFEXITED(status) ) {
-                achd_log(LOG_DEBUG, "child exited with %d\n", WEXITSTATUS(status));
-                return 0;
-            } else if ( WIFSIGNALED(status) ) {
-                achd_log(LOG_DEBUG, "child signalled with %d\n", WTERMSIG(status));
-                return 0;
-            } else {
-                achd_log(LOG_WARNING, "Unexpected wait result %d\n", status);
-                continue; /* I guess we keep waiting then */
-            }
-        } else if ( wpid < 0 ) {
-            /* Wait failed */
-            if (cx.sig_received ) {
-                achd_log(LOG_DEBUG, "signal during wait\n");
-                return pid; /* process still running */
-            } else if( EINTR == errno ) {
-                achd_log(LOG_DEBUG, "wait interrupted\n");
-                continue; /* interrupted */
-            } else if (ECHILD == errno) {
-                achd_log(LOG_WARNING, "unexpected ECHILD\n");
-                return 0; /* child somehow died */
-            } else { /* something bad */
-                cx.error(ACH_FAILED_SYSCALL, "Couldn't wait for child\n", strerror(errno));
-            }
-        } else {
-            /* Wrong child somehow */
-            cx.error(ACH_BUG, "Got unexpected PID, child %d, wait %d\n", pid, wpid);
-        }
-        assert(0);
-    }
-}
-
-static void client_refork() {
-    /* TODO: When we refork the child, we "forget" our position in
-     * the channel.  This means some frames may be missed or resent.
-     * It would be better to have the child attempt to reconnect if
-     * the connection gets broken.
-     */
-    if( !cx.reconnect ) return;
-
-    pid_t pid = 0;
-
-    /* Loop to fork children when the die */
-    while( ! cx.sig_received ) {
-        assert( 0 == pid );
-        struct timespec t;
-        clock_gettime( CLOCK_MONOTONIC, &t );
-        pid = fork();
-        if( 0 == pid ) { /* Child case */
-            return;
-        } else if ( pid > 0 ) {
-            achd_log( LOG_DEBUG, "Forked child %d\n", pid );
-            /* Parent Case */
-            pid = wait_for_child(pid);
-            if( 0 == pid && !cx.sig_received ) {
-                achd_log( LOG_WARNING, "Child died, reforking\n" );
-            }
-            /* Maybe sleep to prevent forking too fast */
-            sleep_till(&t, ACHD_REFORK_NS);
-        } else {
-            assert( pid < 0 );
-            /* Error Case */
-            /* TODO: retry on EAGAIN */
-            cx.error(ACH_FAILED_SYSCALL, "Couldn't fork: %s\n", strerror(errno));
-        }
-    }
-
-    /* still in parent */
-    if( pid > 0 ) {
-        /* kill child if running */
-        if( kill( pid, SIGTERM ) ) {
-            achd_log( LOG_ERR, "Couldn't kill child: %s\n", strerror(errno) );
-        }
-    }
-
-    exit(EXIT_SUCCESS);
-}
-
-
-static void daemonize() {
+void achd_daemonize() {
     /* fork */
     pid_t grandparent = getpid();
     pid_t pid1 = fork();
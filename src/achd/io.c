@@ -59,6 +59,7 @@
 #include <errno.h>
 #include <syslog.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netdb.h>
 
@@ -90,34 +91,68 @@ ssize_t achd_write(int fd, const void *buf, size_t cnt ) {
     return (ssize_t)cnt;
 }
 
-int achd_getc(int fd) {
-    char c;
-    ssize_t r = achd_read(fd, &c, 1);
-    if( 1 == r ) return c;
-    else return EOF;
+/* Like achd_write, advancing iov past what was written */
+ssize_t achd_writev(int fd, struct iovec *iov, int iovcnt ) {
+    size_t n = 0;
+    while( !cx.sig_received && iovcnt > 0 ) {
+        ssize_t r = writev( fd, iov, iovcnt );
+        if( r < 0 ) {
+            if( EINTR == errno && !cx.sig_received ) continue;
+            else return r;
+        }
+        n += (size_t)r;
+        while( iovcnt > 0 && (size_t)r >= iov->iov_len ) {
+            r -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if( iovcnt > 0 ) {
+            iov->iov_base = (uint8_t*)iov->iov_base + r;
+            iov->iov_len -= (size_t)r;
+        }
+    }
+    return (ssize_t)n;
 }
 
-enum ach_status achd_readline(int fd, char *buf, size_t cnt ) {
-    int c;
+/* Like achd_read, first taking any bytes left over in rbuf */
+ssize_t achd_read_buffered(int fd, struct achd_rbuf *rbuf, void *buf, size_t cnt ) {
+    size_t n = rbuf->end - rbuf->start;
+    if( n > cnt ) n = cnt;
+    memcpy( buf, rbuf->data + rbuf->start, n );
+    rbuf->start += n;
+    if( n == cnt ) return (ssize_t)n;
+    return (ssize_t)n + achd_read( fd, (uint8_t*)buf + n, cnt - n );
+}
+
+/* Read a line into buf, reading ahead into rbuf.  Whatever follows
+ * the line stays in rbuf for the next achd_readline() or
+ * achd_read_buffered(). */
+enum ach_status achd_readline(int fd, struct achd_rbuf *rbuf, char *buf, size_t cnt ) {
     size_t i = 0;
-    /* Yeah, this loop is super-inefficnet, but it's only for
-     * connection setup */
-    while( i < cnt ) {
-        c = achd_getc(fd);
-        switch(c) {
-        case '\n':
-            buf[i++] = '\0';
-            return ACH_OK;
-        case '\r':
-            /* TODO: is eating '\r' reasonable? */
-            break;
-        case EOF:
-            return ACH_FAILED_SYSCALL;
-        default:
-            buf[i++] = (char)c;
+    for(;;) {
+        if( rbuf->start == rbuf->end ) {
+            ssize_t r;
+            do {
+                r = read( fd, rbuf->data, sizeof(rbuf->data) );
+            } while( r < 0 && EINTR == errno && !cx.sig_received );
+            if( r <= 0 ) return ACH_FAILED_SYSCALL;
+            rbuf->start = 0;
+            rbuf->end = (size_t)r;
+        }
+        while( rbuf->start < rbuf->end ) {
+            char c = rbuf->data[rbuf->start++];
+            if( '\n' == c ) {
+                buf[i] = '\0';
+                return ACH_OK;
+            } else if( '\r' == c ) {
+                /* TODO: is eating '\r' reasonable? */
+                continue;
+            } else if( i + 1 >= cnt ) {
+                return ACH_OVERFLOW;
+            }
+            buf[i++] = c;
         }
     }
-    return ACH_OVERFLOW;
 }
 
 enum ach_status achd_printf(int fd, const char fmt[], ...) {
@@ -0,0 +1,722 @@
+/* -*- mode: C; c-basic-offset: 4 -*- */
+/* ex: set shiftwidth=4 tabstop=4 expandtab: */
+/*
+ * Copyright (c) 2008-2012, Georgia Tech Research Corporation
+ * All rights reserved.
+ *
+ * Author(s): Neil T. Dantam <ntd@gatech.edu>
+ * Georgia Tech Humanoid Robotics Lab
+ * Under Direction of Prof. Mike Stilman <mstilman@cc.gatech.edu>
+ *
+ *
+ * This file is provided under the following "BSD-style" License:
+ *
+ *
+ *   Redistribution and use in source and binary forms, with or
+ *   without modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *   USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ *   AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Standalone server.
+ *
+ * Rather than forking a process per connection under inetd, one
+ * process accepts connections itself.  A single thread runs an epoll
+ * loop over the listening socket and all connections, reading request
+ * headers and frames pushed to us.  Channels we push from each get
+ * one feed thread that waits on the channel and writes every new
+ * frame to all connections subscribed to it.  Connections that can't
+ * keep up skip frames rather than stalling the others.
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ach.h"
+#include "achutil.h"
+#include "achd.h"
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+
+#define LISTEN_BACKLOG 64
+#define LISTEN_EVENTS 64
+
+/* How often an idle feed checks whether it is still needed */
+#define FEED_WAIT_NS (250 * 1000 * 1000)
+
+enum lconn_state {
+    LCONN_HEADER,  /* reading request headers */
+    LCONN_PUSH,    /* sending frames from a feed */
+    LCONN_PULL     /* receiving frames to put */
+};
+
+struct feed;
+
+/* A connection to the standalone server */
+struct lconn {
+    int fd;
+    enum lconn_state state;
+    struct sockaddr_in addr;
+    struct achd_headers hdr;
+
+    /* header lines, LCONN_HEADER, and what was read past them */
+    char line[ACHD_LINE_LENGTH];
+    size_t line_len;
+    struct achd_rbuf rbuf;
+
+    /* frame being received, LCONN_PULL */
+    ach_channel_t channel;
+    ach_pipe_frame_t *pipeframe;
+    size_t pipeframe_size;
+    size_t in_len;
+
+    /* unsent rest of a frame, LCONN_PUSH, under feed->mutex */
+    struct feed *feed;
+    struct lconn *next;
+    uint8_t *out_buf;
+    size_t out_max;
+    size_t out_off;
+    size_t out_len;
+    int dead;
+};
+
+/* A channel we push from, shared by all its subscribers */
+struct feed {
+    char name[ACH_CHAN_NAME_MAX+1];
+    ach_channel_t channel;
+    pthread_mutex_t mutex;
+    struct lconn *conns;
+    ach_pipe_frame_t *pipeframe;
+    size_t pipeframe_size;
+    struct feed *next;
+};
+
+static struct {
+    int epfd;
+    pthread_mutex_t mutex;  /* protects feeds, taken before any feed->mutex */
+    struct feed *feeds;
+} srv = { -1, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+static int set_nonblock( int fd ) {
+    int flags = fcntl( fd, F_GETFL, 0 );
+    return ( flags < 0 ) ? -1 : fcntl( fd, F_SETFL, flags | O_NONBLOCK );
+}
+
+static int watch( int op, struct lconn *conn, uint32_t events ) {
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = events;
+    ev.data.ptr = conn;
+    return epoll_ctl( srv.epfd, op, conn->fd, &ev );
+}
+
+/*******
+* Feed *
+*******/
+
+/* Grow the feed's frame buffer for ach_get_alloc(), keeping the old
+ * one if that fails so ach_get_alloc() reports ACH_OVERFLOW */
+static void *feed_alloc( void *cx_, size_t size ) {
+    struct feed *f = (struct feed*)cx_;
+    if( size > f->pipeframe_size ) {
+        ach_pipe_frame_t *p = ach_pipe_alloc( size );
+        if( NULL == p ) return NULL;
+        free( f->pipeframe );
+        f->pipeframe = p;
+        f->pipeframe_size = size;
+    }
+    return f->pipeframe->data;
+}
+
+/* Start sending buf to conn, keeping what the socket won't take.
+ *
+ * \pre hold conn->feed->mutex
+ */
+static void feed_send( struct lconn *conn, const void *buf, size_t len ) {
+    if( conn->dead ) return;
+    if( conn->out_off < conn->out_len ) {
+        /* still sending an older frame, skip this one */
+        achd_log( LOG_DEBUG, "%s:%d slow, skipping frame\n",
+                  inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port) );
+        return;
+    }
+    ssize_t r = send( conn->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+    if( r < 0 ) {
+        if( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno ) {
+            /* the epoll loop sees the hangup and closes it */
+            conn->dead = 1;
+            shutdown( conn->fd, SHUT_RDWR );
+            return;
+        }
+        r = 0;
+    }
+    if( (size_t)r < len ) {
+        size_t rest = len - (size_t)r;
+        if( rest > conn->out_max ) {
+            free( conn->out_buf );
+            conn->out_max = 0;
+            if( NULL == (conn->out_buf = (uint8_t*)malloc( rest )) ) {
+                achd_log( LOG_ERR, "%s:%d couldn't buffer %" PRIuPTR " bytes, dropping\n",
+                          inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port), rest );
+                conn->dead = 1;
+                shutdown( conn->fd, SHUT_RDWR );
+                return;
+            }
+            conn->out_max = rest;
+        }
+        memcpy( conn->out_buf, (const uint8_t*)buf + r, rest );
+        conn->out_off = 0;
+        conn->out_len = rest;
+        watch( EPOLL_CTL_MOD, conn, EPOLLIN | EPOLLOUT );
+    }
+}
+
+/* Remove f from the feed list if nobody is subscribed, returning
+ * whether it was removed. */
+static int feed_retire( struct feed *f ) {
+    int retire;
+    pthread_mutex_lock( &srv.mutex );
+    pthread_mutex_lock( &f->mutex );
+    retire = ( NULL == f->conns );
+    if( retire ) {
+        struct feed **p;
+        for( p = &srv.feeds; *p != f; p = &(*p)->next );
+        *p = f->next;
+    }
+    pthread_mutex_unlock( &f->mutex );
+    pthread_mutex_unlock( &srv.mutex );
+    return retire;
+}
+
+static void *feed_run( void *arg ) {
+    struct feed *f = (struct feed*)arg;
+    achd_log( LOG_DEBUG, "feed %s started\n", f->name );
+
+    while( !cx.sig_received ) {
+        struct timespec abstime;
+        clock_gettime( f->channel.shm->clock, &abstime );
+        abstime.tv_nsec += FEED_WAIT_NS;
+        if( abstime.tv_nsec >= 1000000000 ) {
+            abstime.tv_sec ++;
+            abstime.tv_nsec -= 1000000000;
+        }
+
+        size_t frame_size = 0;
+        enum ach_status r = ach_get_alloc( &f->channel, feed_alloc, f, &frame_size,
+                                           &abstime, ACH_O_WAIT );
+        if( ACH_TIMEOUT == r ) {
+            if( feed_retire(f) ) break;
+        } else if( ACH_OK == r || ACH_MISSED_FRAME == r ) {
+            ach_pipe_set_size( f->pipeframe, frame_size );
+            size_t size = sizeof(ach_pipe_frame_t) - 1 + frame_size;
+            struct lconn *conn;
+            pthread_mutex_lock( &f->mutex );
+            for( conn = f->conns; conn; conn = conn->next ) {
+                feed_send( conn, f->pipeframe, size );
+            }
+            pthread_mutex_unlock( &f->mutex );
+        } else {
+            achd_log( LOG_ERR, "Couldn't get frame from %s: %s\n",
+                      f->name, ach_result_to_string(r) );
+            /* drop the subscribers, the epoll loop closes them */
+            struct lconn *conn;
+            pthread_mutex_lock( &f->mutex );
+            for( conn = f->conns; conn; conn = conn->next ) {
+                conn->dead = 1;
+                shutdown( conn->fd, SHUT_RDWR );
+            }
+            pthread_mutex_unlock( &f->mutex );
+            while( !feed_retire(f) && !cx.sig_received ) {
+                usleep( FEED_WAIT_NS / 1000 );
+            }
+            break;
+        }
+    }
+
+    achd_log( LOG_DEBUG, "feed %s done\n", f->name );
+    ach_close( &f->channel );
+    pthread_mutex_destroy( &f->mutex );
+    free( f->pipeframe );
+    free( f );
+    return NULL;
+}
+
+/* Subscribe conn to the feed of its channel, starting one if needed */
+static enum ach_status feed_attach( struct lconn *conn ) {
+    struct feed *f;
+    enum ach_status r = ACH_OK;
+
+    pthread_mutex_lock( &srv.mutex );
+    for( f = srv.feeds; f && strcmp(f->name, conn->hdr.chan_name); f = f->next );
+    if( NULL == f ) {
+        f = (struct feed*)calloc( 1, sizeof(*f) );
+        if( NULL == f ) {
+            r = ACH_FAILED_SYSCALL;
+            goto END;
+        }
+        strncpy( f->name, conn->hdr.chan_name, ACH_CHAN_NAME_MAX );
+        r = ach_open( &f->channel, f->name, NULL );
+        if( ACH_OK != r ) {
+            free( f );
+            goto END;
+        }
+        ach_flush( &f->channel );
+        f->pipeframe_size = f->channel.shm->data_size / f->channel.shm->index_cnt;
+        f->pipeframe = ach_pipe_alloc( f->pipeframe_size );
+        if( NULL == f->pipeframe ) {
+            ach_close( &f->channel );
+            free( f );
+            r = ACH_FAILED_SYSCALL;
+            goto END;
+        }
+        pthread_mutex_init( &f->mutex, NULL );
+
+        /* signals go to the epoll loop */
+        pthread_t thread;
+        pthread_attr_t attr;
+        sigset_t block, old;
+        sigemptyset( &block );
+        sigaddset( &block, SIGINT );
+        sigaddset( &block, SIGTERM );
+        pthread_sigmask( SIG_BLOCK, &block, &old );
+        pthread_attr_init( &attr );
+        pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+        int i = pthread_create( &thread, &attr, feed_run, f );
+        pthread_attr_destroy( &attr );
+        pthread_sigmask( SIG_SETMASK, &old, NULL );
+        if( i ) {
+            achd_log( LOG_ERR, "Couldn't start feed thread: %s\n", strerror(i) );
+            ach_close( &f->channel );
+            pthread_mutex_destroy( &f->mutex );
+            free( f->pipeframe );
+            free( f );
+            r = ACH_FAILED_SYSCALL;
+            goto END;
+        }
+        f->next = srv.feeds;
+        srv.feeds = f;
+    }
+
+    pthread_mutex_lock( &f->mutex );
+    conn->feed = f;
+    conn->next = f->conns;
+    f->conns = conn;
+    pthread_mutex_unlock( &f->mutex );
+
+END:
+    pthread_mutex_unlock( &srv.mutex );
+    return r;
+}
+
+static void feed_detach( struct lconn *conn ) {
+    struct feed *f = conn->feed;
+    struct lconn **p;
+    pthread_mutex_lock( &f->mutex );
+    for( p = &f->conns; *p != conn; p = &(*p)->next );
+    *p = conn->next;
+    conn->feed = NULL;
+    pthread_mutex_unlock( &f->mutex );
+}
+
+/*************
+* Connection *
+*************/
+
+static void conn_close( struct lconn *conn ) {
+    achd_log( LOG_INFO, "Finished serving %s:%d\n",
+              inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port) );
+    epoll_ctl( srv.epfd, EPOLL_CTL_DEL, conn->fd, NULL );
+    if( conn->feed ) feed_detach( conn );
+    if( LCONN_PULL == conn->state ) ach_close( &conn->channel );
+    close( conn->fd );
+    free( (char*)conn->hdr.chan_name );
+    free( (char*)conn->hdr.remote_chan_name );
+    free( (char*)conn->hdr.remote_host );
+    free( (char*)conn->hdr.transport );
+    free( (char*)conn->hdr.multicast_group );
+    free( (char*)conn->hdr.message );
+    free( conn->pipeframe );
+    free( conn->out_buf );
+    free( conn );
+}
+
+/* Refuse the request in conn with an error header */
+static void conn_refuse( struct lconn *conn, enum ach_status code, const char *message ) {
+    achd_log( LOG_ERR, "%s:%d %s\n",
+              inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port), message );
+    achd_printf( conn->fd,
+                 "status: %d # %s\n"
+                 "message: %s\n"
+                 ".\n",
+                 code, ach_result_to_string(code), message );
+    conn_close( conn );
+}
+
+static int conn_read_frames( struct lconn *conn );
+
+/* Headers are in, start serving conn */
+static void conn_start( struct lconn *conn ) {
+    struct achd_headers *hdr = &conn->hdr;
+    ach_channel_t *chan;
+    enum ach_status r;
+
+    if( !hdr->chan_name && hdr->remote_chan_name ) hdr->chan_name = strdup( hdr->remote_chan_name );
+
+    if( !hdr->chan_name ) {
+        conn_refuse( conn, ACH_BAD_HEADER, "no channel header" );
+        return;
+    } else if( !hdr->transport ) {
+        conn_refuse( conn, ACH_BAD_HEADER, "no transport header" );
+        return;
+    } else if( 0 != strcasecmp( hdr->transport, "tcp" ) ) {
+        conn_refuse( conn, ACH_BAD_HEADER, "only tcp transport is served by achd listen" );
+        return;
+    }
+
+    if( ACHD_DIRECTION_PUSH == hdr->direction ) {
+        /* we send frames */
+        r = feed_attach( conn );
+        if( ACH_OK != r ) {
+            conn_refuse( conn, r, "couldn't open channel" );
+            return;
+        }
+        conn->state = LCONN_PUSH;
+        chan = &conn->feed->channel;
+    } else if( ACHD_DIRECTION_PULL == hdr->direction ) {
+        /* we receive frames */
+        r = ach_open( &conn->channel, hdr->chan_name, NULL );
+        if( ACH_OK != r ) {
+            conn_refuse( conn, r, "couldn't open channel" );
+            return;
+        }
+        conn->state = LCONN_PULL;
+        chan = &conn->channel;
+        conn->pipeframe_size = chan->shm->data_size / chan->shm->index_cnt;
+        conn->pipeframe = ach_pipe_alloc( conn->pipeframe_size );
+        if( NULL == conn->pipeframe ) {
+            conn_refuse( conn, ACH_FAILED_SYSCALL, "couldn't allocate frame buffer" );
+            return;
+        }
+        conn->in_len = 0;
+    } else {
+        conn_refuse( conn, ACH_BAD_HEADER, "no direction header" );
+        return;
+    }
+
+    achd_log( LOG_NOTICE, "serving %s:%d channel %s via %s %s\n",
+              inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port),
+              hdr->chan_name, hdr->transport,
+              (ACHD_DIRECTION_PUSH == hdr->direction) ? "push" : "pull" );
+
+    /* the feed only writes to us once we are attached, and frames
+     * are never sent before the header since the socket buffer is
+     * empty */
+    if( conn->feed ) pthread_mutex_lock( &conn->feed->mutex );
+    r = achd_printf( conn->fd,
+                     "frame-count: %" PRIuPTR "\n"
+                     "frame-size: %" PRIuPTR "\n"
+                     "status: %d # %s\n"
+                     ".\n",
+                     chan->shm->index_cnt,
+                     chan->shm->data_size / chan->shm->index_cnt,
+                     ACH_OK, ach_result_to_string(ACH_OK) );
+    if( conn->feed ) pthread_mutex_unlock( &conn->feed->mutex );
+    if( ACH_OK != r ) conn_close( conn );
+    else if( LCONN_PULL == conn->state ) conn_read_frames( conn );
+}
+
+/* Read request header lines, returning -1 if conn was closed */
+static int conn_read_headers( struct lconn *conn ) {
+    struct achd_rbuf *rb = &conn->rbuf;
+    for(;;) {
+        if( rb->start == rb->end ) {
+            ssize_t r = recv( conn->fd, rb->data, sizeof(rb->data), 0 );
+            if( r < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) ) return 0;
+            if( r < 0 && EINTR == errno ) continue;
+            if( r <= 0 ) {
+                conn_close( conn );
+                return -1;
+            }
+            rb->start = 0;
+            rb->end = (size_t)r;
+        }
+        char c = rb->data[rb->start++];
+        if( '\r' == c ) continue;
+        if( '\n' != c ) {
+            if( conn->line_len + 1 >= sizeof(conn->line) ) {
+                conn_refuse( conn, ACH_OVERFLOW, "header line too long" );
+                return -1;
+            }
+            conn->line[conn->line_len++] = c;
+            continue;
+        }
+        conn->line[conn->line_len] = '\0';
+        conn->line_len = 0;
+        int done;
+        enum ach_status s = achd_parse_header_line( conn->line, &conn->hdr, &done );
+        if( ACH_OK != s ) {
+            conn_refuse( conn, s, "bad header" );
+            return -1;
+        } else if( done ) {
+            conn_start( conn );
+            return -1;
+        }
+    }
+}
+
+/* Read and put frames pushed to us, returning -1 if conn was closed */
+static int conn_read_frames( struct lconn *conn ) {
+    const size_t hdr_size = sizeof(ach_pipe_frame_t) - 1;
+    for(;;) {
+        uint8_t *dst;
+        size_t want;
+        if( conn->in_len < hdr_size ) {
+            dst = (uint8_t*)conn->pipeframe + conn->in_len;
+            want = hdr_size - conn->in_len;
+        } else {
+            size_t cnt = (size_t)ach_pipe_get_size( conn->pipeframe );
+            dst = conn->pipeframe->data + (conn->in_len - hdr_size);
+            want = hdr_size + cnt - conn->in_len;
+        }
+
+        if( want ) {
+            ssize_t r;
+            size_t left = conn->rbuf.end - conn->rbuf.start;
+            if( left ) {
+                /* sent along with the headers */
+                r = (ssize_t)(left < want ? left : want);
+                memcpy( dst, conn->rbuf.data + conn->rbuf.start, (size_t)r );
+                conn->rbuf.start += (size_t)r;
+            } else {
+                r = recv( conn->fd, dst, want, 0 );
+            }
+            if( r < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) ) return 0;
+            if( r < 0 && EINTR == errno ) continue;
+            if( r <= 0 ) {
+                conn_close( conn );
+                return -1;
+            }
+            conn->in_len += (size_t)r;
+        }
+
+        if( conn->in_len == hdr_size && want ) {
+            /* check frame header */
+            if( memcmp("achpipe", conn->pipeframe->magic, 8) ) {
+                achd_log( LOG_ERR, "Invalid frame header\n" );
+                conn_close( conn );
+                return -1;
+            }
+            uint64_t cnt = ach_pipe_get_size( conn->pipeframe );
+            if( cnt > conn->channel.shm->data_size ) {
+                achd_log( LOG_ERR, "Frame of %" PRIu64 " bytes exceeds channel\n", cnt );
+                conn_close( conn );
+                return -1;
+            }
+            if( (size_t)cnt > conn->pipeframe_size ) {
+                ach_pipe_frame_t *p = ach_pipe_alloc( (size_t)cnt );
+                if( NULL == p ) {
+                    achd_log( LOG_ERR, "Couldn't allocate frame of %" PRIu64 " bytes\n", cnt );
+                    conn_close( conn );
+                    return -1;
+                }
+                memcpy( p, conn->pipeframe, hdr_size );
+                free( conn->pipeframe );
+                conn->pipeframe = p;
+                conn->pipeframe_size = (size_t)cnt;
+            }
+        }
+
+        if( conn->in_len >= hdr_size &&
+            conn->in_len == hdr_size + ach_pipe_get_size( conn->pipeframe ) ) {
+            size_t cnt = conn->in_len - hdr_size;
+            enum ach_status r = ach_put( &conn->channel, conn->pipeframe->data, cnt );
+            if( ACH_OK != r ) {
+                achd_log( LOG_ERR, "Couldn't put frame, size %" PRIuPTR ": %s\n",
+                          cnt, ach_result_to_string(r) );
+            }
+            conn->in_len = 0;
+        }
+    }
+}
+
+/* Finish sending a frame the socket wouldn't take at once */
+static void conn_write( struct lconn *conn ) {
+    struct feed *f = conn->feed;
+    pthread_mutex_lock( &f->mutex );
+    while( conn->out_off < conn->out_len ) {
+        ssize_t r = send( conn->fd, conn->out_buf + conn->out_off,
+                          conn->out_len - conn->out_off, MSG_DONTWAIT | MSG_NOSIGNAL );
+        if( r < 0 && EINTR == errno ) continue;
+        if( r < 0 ) {
+            if( EAGAIN != errno && EWOULDBLOCK != errno ) {
+                conn->dead = 1;
+                shutdown( conn->fd, SHUT_RDWR );
+            }
+            break;
+        }
+        conn->out_off += (size_t)r;
+    }
+    if( conn->out_off >= conn->out_len ) {
+        conn->out_off = conn->out_len = 0;
+        watch( EPOLL_CTL_MOD, conn, EPOLLIN );
+    }
+    pthread_mutex_unlock( &f->mutex );
+}
+
+static void conn_event( struct lconn *conn, uint32_t events ) {
+    switch( conn->state ) {
+    case LCONN_HEADER:
+        if( events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) conn_read_headers( conn );
+        break;
+    case LCONN_PULL:
+        if( events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) conn_read_frames( conn );
+        break;
+    case LCONN_PUSH:
+        if( events & (EPOLLIN | EPOLLHUP | EPOLLERR) || conn->dead ) {
+            /* subscribers don't talk, so this is a hangup */
+            conn_close( conn );
+        } else if( events & EPOLLOUT ) {
+            conn_write( conn );
+        }
+        break;
+    }
+}
+
+static void conn_accept( int lfd ) {
+    for(;;) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept( lfd, (struct sockaddr*)&addr, &len );
+        if( fd < 0 ) {
+            if( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno ) {
+                achd_log( LOG_ERR, "Couldn't accept: %s\n", strerror(errno) );
+            }
+            return;
+        }
+        if( set_nonblock(fd) ) {
+            achd_log( LOG_ERR, "Couldn't make socket non-blocking: %s\n", strerror(errno) );
+            close( fd );
+            continue;
+        }
+        struct lconn *conn = (struct lconn*)calloc( 1, sizeof(*conn) );
+        conn->fd = fd;
+        conn->addr = addr;
+        conn->state = LCONN_HEADER;
+        if( watch( EPOLL_CTL_ADD, conn, EPOLLIN ) ) {
+            achd_log( LOG_ERR, "Couldn't watch connection: %s\n", strerror(errno) );
+            close( fd );
+            free( conn );
+            continue;
+        }
+        achd_log( LOG_DEBUG, "accepted %s:%d\n",
+                  inet_ntoa(addr.sin_addr), ntohs(addr.sin_port) );
+    }
+}
+
+/*******
+* Main *
+*******/
+
+void achd_listen() {
+    /* Make listening socket */
+    int lfd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( lfd < 0 ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't create socket: %s\n", strerror(errno) );
+    }
+    {
+        int yes = 1;
+        if( setsockopt( lfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes) ) ) {
+            achd_log( LOG_WARNING, "Couldn't set SO_REUSEADDR: %s\n", strerror(errno) );
+        }
+    }
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( (uint16_t)cx.port );
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    if( bind( lfd, (struct sockaddr*)&addr, sizeof(addr) ) ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't bind port %d: %s\n", cx.port, strerror(errno) );
+    }
+    if( listen( lfd, LISTEN_BACKLOG ) || set_nonblock( lfd ) ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't listen: %s\n", strerror(errno) );
+    }
+
+    srv.epfd = epoll_create( LISTEN_EVENTS );
+    if( srv.epfd < 0 ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't create epoll: %s\n", strerror(errno) );
+    }
+    {
+        struct epoll_event ev;
+        memset( &ev, 0, sizeof(ev) );
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if( epoll_ctl( srv.epfd, EPOLL_CTL_ADD, lfd, &ev ) ) {
+            cx.error( ACH_FAILED_SYSCALL, "Couldn't watch socket: %s\n", strerror(errno) );
+        }
+    }
+
+    if( cx.daemonize ) achd_daemonize();
+    sighandler_install();
+    achd_log( LOG_NOTICE, "listening on port %d\n", cx.port );
+
+    /* Event loop */
+    while( !cx.sig_received ) {
+        struct epoll_event ev[LISTEN_EVENTS];
+        int n = epoll_wait( srv.epfd, ev, LISTEN_EVENTS, -1 );
+        if( n < 0 ) {
+            if( EINTR == errno ) continue;
+            cx.error( ACH_FAILED_SYSCALL, "Couldn't wait for events: %s\n", strerror(errno) );
+        }
+        int i;
+        for( i = 0; i < n; i ++ ) {
+            if( NULL == ev[i].data.ptr ) conn_accept( lfd );
+            else conn_event( (struct lconn*)ev[i].data.ptr, ev[i].events );
+        }
+    }
+    achd_log( LOG_NOTICE, "stopped listening\n" );
+}
+
+#else /* __linux__ */
+
+void achd_listen() {
+    cx.error( ACH_FAILED_SYSCALL, "achd listen needs epoll, which this system lacks\n" );
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,543 @@
+/* -*- mode: C; c-basic-offset: 4 -*- */
+/* ex: set shiftwidth=4 tabstop=4 expandtab: */
+/*
+ * Copyright (c) 2008-2012, Georgia Tech Research Corporation
+ * All rights reserved.
+ *
+ * Author(s): Neil T. Dantam <ntd@gatech.edu>
+ * Georgia Tech Humanoid Robotics Lab
+ * Under Direction of Prof. Mike Stilman <mstilman@cc.gatech.edu>
+ *
+ *
+ * This file is provided under the following "BSD-style" License:
+ *
+ *
+ *   Redistribution and use in source and binary forms, with or
+ *   without modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *   USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ *   AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Multiplexed transport.
+ *
+ * One TCP connection carries frames for many channels.  After the
+ * usual text headers, both ends exchange binary messages: an 8 byte
+ * header -- type, a reserved byte, 16-bit channel id, and 32-bit
+ * payload size, little-endian like pipe frames -- then the payload.
+ *
+ *   OPEN    forward a channel under a new id; the payload is the
+ *           direction for the receiving end and the channel name
+ *   STATUS  reply to OPEN; the payload is the status, frame count,
+ *           and frame size
+ *   FRAME   one frame of the channel
+ *   CLOSE   stop forwarding the channel and release the id
+ *
+ * Channels may be opened and closed at any time.  Each channel we send
+ * gets a feed thread.  Feeds append messages to a shared output buffer
+ * and whichever finds nobody writing drains it, so frames from other
+ * channels that arrive during a write go out together in the next.
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <assert.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+
+#include "ach.h"
+#include "achutil.h"
+#include "achd.h"
+
+#define MUX_HEADER_SIZE 8
+
+/* Stop coalescing and wait for the writer beyond this many bytes */
+#define MUX_COALESCE_MAX (64 * 1024)
+
+/* Largest control message payload */
+#define MUX_CONTROL_MAX (ACH_CHAN_NAME_MAX + 16)
+
+/* How often an idle feed checks whether it should stop */
+#define MUX_FEED_WAIT_NS (250 * 1000 * 1000)
+
+enum mux_type {
+    MUX_OPEN = 1,
+    MUX_STATUS,
+    MUX_FRAME,
+    MUX_CLOSE
+};
+
+struct mux;
+
+struct mux_chan {
+    struct mux *mux;
+    uint16_t id;
+    enum achd_direction direction;  /**< ours, PUSH sends frames */
+    char name[ACH_CHAN_NAME_MAX+1]; /**< local channel name */
+    int is_open;
+    ach_channel_t channel;
+    int feeding;
+    int stop;                       /**< under mux->mutex */
+    pthread_t feed;
+    uint8_t *buf;
+    size_t buf_size;
+};
+
+struct mux {
+    struct achd_conn *conn;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t *out;       /**< messages waiting for the writer */
+    size_t out_len;
+    size_t out_max;
+    uint8_t *spare;     /**< buffer being written */
+    size_t spare_max;
+    int writing;
+    int failed;
+    uint8_t *in;
+    size_t in_max;
+    struct mux_chan *chans[ACHD_MUX_CHANNELS];
+};
+
+static void put_le( uint8_t *p, uint64_t x, size_t n ) {
+    size_t i;
+    for( i = 0; i < n; i ++ ) p[i] = (uint8_t)((x >> (8 * i)) & 0xFF);
+}
+
+static uint64_t get_le( const uint8_t *p, size_t n ) {
+    uint64_t x = 0;
+    size_t i;
+    for( i = 0; i < n; i ++ ) x |= (uint64_t)p[i] << (8 * i);
+    return x;
+}
+
+static void *grow( uint8_t **buf, size_t *max, size_t size ) {
+    if( size > *max ) {
+        size_t n = *max ? *max : INIT_BUF_SIZE;
+        while( n < size ) n *= 2;
+        uint8_t *p = (uint8_t*)realloc( *buf, n );
+        if( NULL == p ) return NULL;
+        *buf = p;
+        *max = n;
+    }
+    return *buf;
+}
+
+/* Queue a message of payload a followed by b and write out the queue
+ * unless another thread already is.  Returns -1 when the connection
+ * failed or sender c was stopped. */
+static int mux_send( struct mux *m, struct mux_chan *c, enum mux_type type, uint16_t id,
+                     const void *a, size_t na, const void *b, size_t nb )
+{
+    int r = 0;
+    pthread_mutex_lock( &m->mutex );
+    while( m->writing && m->out_len >= MUX_COALESCE_MAX &&
+           !m->failed && !(c && c->stop) )
+    {
+        pthread_cond_wait( &m->cond, &m->mutex );
+    }
+    if( m->failed || (c && c->stop) ) {
+        r = -1;
+        goto END;
+    }
+
+    /* append */
+    size_t len = MUX_HEADER_SIZE + na + nb;
+    if( NULL == grow( &m->out, &m->out_max, m->out_len + len ) ) {
+        achd_log( LOG_ERR, "Couldn't allocate %" PRIuPTR " bytes\n", m->out_len + len );
+        r = -1;
+        goto END;
+    }
+    uint8_t *p = m->out + m->out_len;
+    p[0] = (uint8_t)type;
+    p[1] = 0;
+    put_le( p+2, id, 2 );
+    put_le( p+4, na + nb, 4 );
+    if( na ) memcpy( p + MUX_HEADER_SIZE, a, na );
+    if( nb ) memcpy( p + MUX_HEADER_SIZE + na, b, nb );
+    m->out_len += len;
+
+    if( m->writing ) goto END;
+
+    /* become the writer */
+    m->writing = 1;
+    while( m->out_len && !m->failed ) {
+        uint8_t *buf = m->out;
+        size_t max = m->out_max, cnt = m->out_len;
+        m->out = m->spare;
+        m->out_max = m->spare_max;
+        m->out_len = 0;
+        m->spare = buf;
+        m->spare_max = max;
+        pthread_cond_broadcast( &m->cond );
+        pthread_mutex_unlock( &m->mutex );
+
+        achd_log( LOG_DEBUG, "Writing %" PRIuPTR " multiplexed bytes\n", cnt );
+        ssize_t s = achd_write( m->conn->out, buf, cnt );
+
+        pthread_mutex_lock( &m->mutex );
+        if( s < 0 || (size_t)s != cnt ) {
+            achd_log( LOG_ERR, "Couldn't write frames: %s\n", strerror(errno) );
+            m->failed = 1;
+            /* wake the reader */
+            shutdown( m->conn->out, SHUT_RDWR );
+        }
+    }
+    m->writing = 0;
+    pthread_cond_broadcast( &m->cond );
+    r = m->failed ? -1 : 0;
+
+END:
+    pthread_mutex_unlock( &m->mutex );
+    return r;
+}
+
+static enum ach_status mux_send_status( struct mux *m, uint16_t id, enum ach_status status,
+                                        const ach_channel_t *chan )
+{
+    uint8_t p[12];
+    put_le( p, (uint64_t)status, 4 );
+    put_le( p+4, chan ? chan->shm->index_cnt : 0, 4 );
+    put_le( p+8, chan ? chan->shm->data_size / chan->shm->index_cnt : 0, 4 );
+    return mux_send( m, NULL, MUX_STATUS, id, p, sizeof(p), NULL, 0 ) ? ACH_FAILED_SYSCALL : ACH_OK;
+}
+
+/********
+* Feeds *
+********/
+
+static void *mux_alloc( void *cx_, size_t size ) {
+    struct mux_chan *c = (struct mux_chan*)cx_;
+    return grow( &c->buf, &c->buf_size, size );
+}
+
+static void *mux_feed( void *arg ) {
+    struct mux_chan *c = (struct mux_chan*)arg;
+    struct mux *m = c->mux;
+    achd_log( LOG_DEBUG, "feeding %s as %u\n", c->name, c->id );
+
+    while( !cx.sig_received ) {
+        struct timespec abstime;
+        clock_gettime( c->channel.shm->clock, &abstime );
+        abstime.tv_nsec += MUX_FEED_WAIT_NS;
+        if( abstime.tv_nsec >= 1000000000 ) {
+            abstime.tv_sec ++;
+            abstime.tv_nsec -= 1000000000;
+        }
+
+        size_t frame_size = 0;
+        enum ach_status r = ach_get_alloc( &c->channel, mux_alloc, c, &frame_size,
+                                           &abstime, ACH_O_WAIT );
+        if( ACH_TIMEOUT == r ) {
+            int stop;
+            pthread_mutex_lock( &m->mutex );
+            stop = c->stop || m->failed;
+            pthread_mutex_unlock( &m->mutex );
+            if( stop ) break;
+        } else if( ACH_OK == r || ACH_MISSED_FRAME == r ) {
+            if( mux_send( m, c, MUX_FRAME, c->id, c->buf, frame_size, NULL, 0 ) ) break;
+        } else {
+            achd_log( LOG_ERR, "Couldn't get frame from %s: %s\n",
+                      c->name, ach_result_to_string(r) );
+            mux_send( m, c, MUX_CLOSE, c->id, NULL, 0, NULL, 0 );
+            break;
+        }
+    }
+    return NULL;
+}
+
+static enum ach_status mux_feed_start( struct mux_chan *c ) {
+    /* signals go to the reader */
+    sigset_t block, old;
+    sigemptyset( &block );
+    sigaddset( &block, SIGINT );
+    sigaddset( &block, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &block, &old );
+    int i = pthread_create( &c->feed, NULL, mux_feed, c );
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+    if( i ) {
+        achd_log( LOG_ERR, "Couldn't start feed thread: %s\n", strerror(i) );
+        return ACH_FAILED_SYSCALL;
+    }
+    c->feeding = 1;
+    return ACH_OK;
+}
+
+/***********
+* Channels *
+***********/
+
+static struct mux_chan *mux_chan_new( struct mux *m, uint16_t id, enum achd_direction direction,
+                                      const char *name )
+{
+    if( id >= ACHD_MUX_CHANNELS || m->chans[id] ) {
+        achd_log( LOG_ERR, "Invalid channel id %u\n", id );
+        return NULL;
+    }
+    struct mux_chan *c = (struct mux_chan*)calloc( 1, sizeof(*c) );
+    c->mux = m;
+    c->id = id;
+    c->direction = direction;
+    strncpy( c->name, name, ACH_CHAN_NAME_MAX );
+    m->chans[id] = c;
+    return c;
+}
+
+static void mux_chan_release( struct mux *m, uint16_t id ) {
+    struct mux_chan *c = m->chans[id];
+    if( NULL == c ) return;
+    if( c->feeding ) {
+        pthread_mutex_lock( &m->mutex );
+        c->stop = 1;
+        pthread_cond_broadcast( &m->cond );
+        pthread_mutex_unlock( &m->mutex );
+        pthread_join( c->feed, NULL );
+    }
+    if( c->is_open ) ach_close( &c->channel );
+    achd_log( LOG_DEBUG, "released %s as %u\n", c->name, id );
+    m->chans[id] = NULL;
+    free( c->buf );
+    free( c );
+}
+
+/* Open the local channel, creating it like the peer's if it is missing */
+static enum ach_status mux_chan_open( struct mux_chan *c, size_t frame_count, size_t frame_size ) {
+    enum ach_status r = ach_open( &c->channel, c->name, NULL );
+    if( ACH_ENOENT == r && frame_count && frame_size ) {
+        achd_log( LOG_INFO, "Local channel %s not found, creating\n", c->name );
+        r = ach_create( c->name, frame_count, frame_size, NULL );
+        if( ACH_OK == r ) r = ach_open( &c->channel, c->name, NULL );
+    }
+    if( ACH_OK == r ) {
+        c->is_open = 1;
+        ach_flush( &c->channel );
+    }
+    return r;
+}
+
+/***********
+* Messages *
+***********/
+
+/* Read and drop cnt bytes */
+static int mux_skip( struct mux *m, size_t cnt ) {
+    while( cnt ) {
+        size_t n = cnt < m->in_max ? cnt : m->in_max;
+        if( (ssize_t)n != achd_read_buffered( m->conn->in, &m->conn->rbuf, m->in, n ) ) return -1;
+        cnt -= n;
+    }
+    return 0;
+}
+
+/* Peer asks us to forward a channel */
+static void mux_on_open( struct mux *m, uint16_t id, const uint8_t *p, size_t n ) {
+    if( n < 2 || n - 1 > ACH_CHAN_NAME_MAX ) {
+        achd_log( LOG_ERR, "Bad open request for %u\n", id );
+        mux_send_status( m, id, ACH_BAD_HEADER, NULL );
+        return;
+    }
+    char name[ACH_CHAN_NAME_MAX+1];
+    memcpy( name, p+1, n-1 );
+    name[n-1] = '\0';
+    enum achd_direction direction = (enum achd_direction)p[0];
+    if( ACHD_DIRECTION_PUSH != direction && ACHD_DIRECTION_PULL != direction ) {
+        achd_log( LOG_ERR, "Bad direction for %s\n", name );
+        mux_send_status( m, id, ACH_BAD_HEADER, NULL );
+        return;
+    }
+
+    struct mux_chan *c = mux_chan_new( m, id, direction, name );
+    if( NULL == c ) {
+        mux_send_status( m, id, ACH_EINVAL, NULL );
+        return;
+    }
+    enum ach_status r = mux_chan_open( c, 0, 0 );
+    if( ACH_OK != r ) {
+        achd_log( LOG_ERR, "Couldn't open channel %s: %s\n", name, ach_result_to_string(r) );
+        mux_send_status( m, id, r, NULL );
+        mux_chan_release( m, id );
+        return;
+    }
+    achd_log( LOG_NOTICE, "serving channel %s as %u via mux %s\n", name, id,
+              (ACHD_DIRECTION_PUSH == direction) ? "push" : "pull" );
+
+    /* status goes out before any frames */
+    mux_send_status( m, id, ACH_OK, &c->channel );
+    if( ACHD_DIRECTION_PUSH == direction && ACH_OK != mux_feed_start(c) ) {
+        mux_send( m, NULL, MUX_CLOSE, id, NULL, 0, NULL, 0 );
+        mux_chan_release( m, id );
+    }
+}
+
+/* Peer answered our open request */
+static void mux_on_status( struct mux *m, uint16_t id, const uint8_t *p, size_t n ) {
+    struct mux_chan *c = (id < ACHD_MUX_CHANNELS) ? m->chans[id] : NULL;
+    if( NULL == c || n < 12 ) {
+        achd_log( LOG_WARNING, "Stray status for %u\n", id );
+        return;
+    }
+    enum ach_status r = (enum ach_status)get_le( p, 4 );
+    if( ACH_OK != r ) {
+        achd_log( LOG_ERR, "Server couldn't open %s: %s\n", c->name, ach_result_to_string(r) );
+        mux_chan_release( m, id );
+        return;
+    }
+    if( !c->is_open ) {
+        r = mux_chan_open( c, (size_t)get_le(p+4, 4), (size_t)get_le(p+8, 4) );
+        if( ACH_OK != r ) {
+            achd_log( LOG_ERR, "Couldn't open channel %s: %s\n", c->name, ach_result_to_string(r) );
+            mux_send( m, NULL, MUX_CLOSE, id, NULL, 0, NULL, 0 );
+            mux_chan_release( m, id );
+            return;
+        }
+    }
+    achd_log( LOG_INFO, "forwarding channel %s as %u\n", c->name, id );
+    if( ACHD_DIRECTION_PUSH == c->direction && ACH_OK != mux_feed_start(c) ) {
+        mux_send( m, NULL, MUX_CLOSE, id, NULL, 0, NULL, 0 );
+        mux_chan_release( m, id );
+    }
+}
+
+/* Read messages till the connection closes */
+static void mux_recv( struct mux *m ) {
+    while( !cx.sig_received ) {
+        uint8_t h[MUX_HEADER_SIZE];
+        if( MUX_HEADER_SIZE != achd_read_buffered( m->conn->in, &m->conn->rbuf, h, MUX_HEADER_SIZE ) ) {
+            achd_log( LOG_DEBUG, "Empty read: %s (%d)\n", strerror(errno), errno );
+            return;
+        }
+        enum mux_type type = (enum mux_type)h[0];
+        uint16_t id = (uint16_t)get_le( h+2, 2 );
+        size_t cnt = (size_t)get_le( h+4, 4 );
+        struct mux_chan *c = (id < ACHD_MUX_CHANNELS) ? m->chans[id] : NULL;
+
+        if( MUX_FRAME == type ) {
+            if( NULL == c || !c->is_open || ACHD_DIRECTION_PULL != c->direction ||
+                cnt > c->channel.shm->data_size )
+            {
+                /* e.g., in flight when we closed it */
+                achd_log( LOG_DEBUG, "Dropping %" PRIuPTR " byte frame for %u\n", cnt, id );
+                if( mux_skip(m, cnt) ) return;
+                continue;
+            }
+        } else if( cnt > MUX_CONTROL_MAX ) {
+            achd_log( LOG_ERR, "Invalid message, type %d, size %" PRIuPTR "\n", type, cnt );
+            return;
+        }
+
+        if( NULL == grow( &m->in, &m->in_max, cnt ) ) return;
+        if( (ssize_t)cnt != achd_read_buffered( m->conn->in, &m->conn->rbuf, m->in, cnt ) ) {
+            achd_log( LOG_ERR, "Incomplete message\n" );
+            return;
+        }
+
+        switch( type ) {
+        case MUX_FRAME: {
+            enum ach_status r = ach_put( &c->channel, m->in, cnt );
+            if( ACH_OK != r ) {
+                achd_log( LOG_ERR, "Couldn't put frame to %s, size %" PRIuPTR ": %s\n",
+                          c->name, cnt, ach_result_to_string(r) );
+            }
+            break;
+        }
+        case MUX_OPEN:
+            mux_on_open( m, id, m->in, cnt );
+            break;
+        case MUX_STATUS:
+            mux_on_status( m, id, m->in, cnt );
+            break;
+        case MUX_CLOSE:
+            achd_log( LOG_INFO, "peer closed %u\n", id );
+            if( id < ACHD_MUX_CHANNELS ) mux_chan_release( m, id );
+            break;
+        default:
+            achd_log( LOG_WARNING, "Ignoring message type %d\n", type );
+        }
+    }
+}
+
+/* Ask the server to forward our channels */
+static int mux_request( struct mux *m ) {
+    size_t i, n = cx.mux_chan_cnt ? cx.mux_chan_cnt : 1;
+    for( i = 0; i < n; i ++ ) {
+        const char *local = i ? cx.mux_chans[i] : cx.cl_opts.chan_name;
+        const char *remote = i ? cx.mux_chans[i] : cx.cl_opts.remote_chan_name;
+        struct mux_chan *c = mux_chan_new( m, (uint16_t)i, cx.cl_opts.direction, local );
+        if( NULL == c ) return -1;
+        if( ACHD_DIRECTION_PUSH == c->direction ) {
+            enum ach_status r = mux_chan_open( c, 0, 0 );
+            if( ACH_OK != r && ACH_ENOENT != r ) {
+                cx.error( r, "Couldn't open channel %s\n", local );
+            }
+        }
+        /* remote end does the opposite */
+        uint8_t direction = (ACHD_DIRECTION_PUSH == c->direction) ?
+            ACHD_DIRECTION_PULL : ACHD_DIRECTION_PUSH;
+        if( mux_send( m, NULL, MUX_OPEN, c->id, &direction, 1, remote, strlen(remote) ) ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void achd_mux( struct achd_conn *conn ) {
+    struct mux *m = (struct mux*)calloc( 1, sizeof(*m) );
+    pthread_mutex_init( &m->mutex, NULL );
+    pthread_cond_init( &m->cond, NULL );
+    grow( &m->in, &m->in_max, INIT_BUF_SIZE );
+
+    do {
+        size_t i;
+        m->conn = conn;
+        m->failed = 0;
+        m->out_len = 0;
+        if( ACHD_MODE_SERVE == conn->mode || 0 == mux_request(m) ) {
+            mux_recv( m );
+        }
+
+        /* stop the feeds */
+        pthread_mutex_lock( &m->mutex );
+        m->failed = 1;
+        pthread_cond_broadcast( &m->cond );
+        pthread_mutex_unlock( &m->mutex );
+        for( i = 0; i < ACHD_MUX_CHANNELS; i ++ ) {
+            mux_chan_release( m, (uint16_t)i );
+        }
+    } while( ACHD_MODE_SERVE != conn->mode && cx.reconnect && !cx.sig_received &&
+             achd_reconnect(conn) >= 0 );
+
+    pthread_mutex_destroy( &m->mutex );
+    pthread_cond_destroy( &m->cond );
+    free( m->out );
+    free( m->spare );
+    free( m->in );
+    free( m );
+}
@@ -41,6 +41,9 @@
  */
 
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 
 #include <unistd.h>
 #include <stdint.h>
@@ -59,10 +62,15 @@
 #include <errno.h>
 #include <syslog.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 
 #include "ach.h"
 #include "achutil.h"
@@ -70,25 +78,151 @@
 
 /* TODO: add SCTP, RDS, DCCP Support */
 
+/* Most datagrams moved per syscall */
+#define UDP_BATCH 32
+
+#define HEADER_BYTES_IPV4 20
+#define HEADER_BYTES_UDP 8
+#define MTU_ETH 1500
+
+/* UDP fragments
+ *
+ * Each datagram carries a fragment header -- magic, token, datagram
+ * number, frame sequence number, fragment index, fragment count, and
+ * frame size, little-endian -- followed by part of the frame.  The
+ * token tells a channel's datagrams from others sent to the same
+ * multicast group and port; unicast senders leave it zero.  Fragments fit
+ * in an ethernet frame so IP never fragments them.
+ *
+ * With forward error correction, a parity datagram follows each group
+ * of up to fec-group datagrams and at the end of each send batch.  It
+ * holds magic, token, the first datagram number of the group, the group size,
+ * and the XOR of the members' lengths, then the XOR of the members
+ * after their datagram numbers.  Receivers rebuild any one datagram
+ * lost from a group.
+ */
+#define FRAG_MAGIC "achf"
+#define FRAG_HEADER_SIZE 24
+#define FRAG_BODY_OFFSET 12     /* parity covers the header from here */
+#define PARITY_MAGIC "achp"
+#define PARITY_HEADER_SIZE 16
+#define FRAG_DGRAM_MAX (MTU_ETH - HEADER_BYTES_IPV4 - HEADER_BYTES_UDP)
+/* leaves room for parity, which is a body plus its larger header */
+#define FRAG_PAYLOAD_MAX (FRAG_DGRAM_MAX - FRAG_HEADER_SIZE - \
+                          (PARITY_HEADER_SIZE - FRAG_BODY_OFFSET))
+#define FRAG_BODY_MAX (FRAG_HEADER_SIZE - FRAG_BODY_OFFSET + FRAG_PAYLOAD_MAX)
+#define FRAG_COUNT_MAX 0xFFFF
+
+/* Recent datagrams a receiver keeps for parity, a power of two */
+#define FEC_RING 64
+
+/* Longest a receiver holds a datagram waiting for its group's parity,
+ * which may itself be lost */
+#define FEC_HOLD_MS 5
+
+/* Frames reassembled at once */
+#define FRAG_SLOTS 4
+
+/* Frames numbered this far behind the newest are from a restarted
+ * sender rather than late */
+#define FRAG_STALE_WINDOW 4096
+
+struct udp_frag {
+    uint8_t hdr[FRAG_HEADER_SIZE];
+    size_t hdr_len;
+    const uint8_t *data;
+    size_t len;
+};
+
+/* Datagram held for parity, from its body on */
+struct udp_kept {
+    int valid;
+    int fed;
+    uint32_t pkt;
+    int64_t t_ms;       /**< when it arrived */
+    size_t len;
+    uint8_t body[FRAG_BODY_MAX];
+};
+
+struct udp_reasm {
+    int busy;
+    uint32_t seq;
+    uint32_t size;
+    uint16_t count;
+    uint16_t got;
+    uint8_t *buf;
+    size_t max;
+    uint8_t *have;      /**< per fragment, whether received */
+    size_t have_max;
+};
+
 struct udp_cx {
     int sock;
     struct sockaddr_in addr;
+    /* batch of frames, slot 0 is unused when sending since the
+     * first frame is in conn->pipeframe */
+    uint8_t *buf[UDP_BATCH];
+    size_t buf_size[UDP_BATCH];
+    size_t len[UDP_BATCH];
+    uint32_t seq[UDP_BATCH];
+    /* sending */
+    struct udp_frag frag[UDP_BATCH];
+    size_t frag_cnt;
+    uint32_t pkt;                   /**< next datagram number */
+    size_t fec_group;               /**< datagrams per parity, 0 for none */
+    size_t fec_cnt;                 /**< datagrams in the current group */
+    uint32_t fec_first;
+    uint16_t fec_len;
+    size_t fec_max;
+    uint8_t fec_acc[FRAG_BODY_MAX];
+    uint8_t fec_out[UDP_BATCH][FRAG_BODY_MAX]; /**< parity per queue slot */
+    unsigned loss_seed;
+    uint32_t token;                 /**< marks our datagrams, 0 for unicast */
+    /* receiving */
+    int check_token;                /**< drop datagrams without our token */
+    int have_seq;
+    uint32_t last_seq;  /**< newest frame put */
+    struct udp_reasm reasm[FRAG_SLOTS];
+    int fec_seen;
+    uint32_t fec_next;  /**< first datagram still held */
+    struct udp_kept kept[FEC_RING];
 };
 
-static void get_frame( struct achd_conn *conn );
+static enum ach_status get_frame( struct achd_conn *conn, const struct timespec *abstime );
 static void put_frame( struct achd_conn *conn );
+static void put_buf( struct achd_conn *conn, const void *buf, size_t cnt );
 
 
-#define HEADER_BYTES_IPV4 20
-#define HEADER_BYTES_UDP 8
-#define MTU_UDP (0xFFFF)
-#define MTU_ETH 1500
+static void put_le( uint8_t *p, uint64_t x, size_t n ) {
+    size_t i;
+    for( i = 0; i < n; i ++ ) p[i] = (uint8_t)((x >> (8 * i)) & 0xFF);
+}
+
+static uint64_t get_le( const uint8_t *p, size_t n ) {
+    uint64_t x = 0;
+    size_t i;
+    for( i = 0; i < n; i ++ ) x |= (uint64_t)p[i] << (8 * i);
+    return x;
+}
 
+/* Grow the connection's frame buffer for ach_get_alloc().  This runs
+ * under the channel lock, so get_frame() does the logging.
+ */
+static void *pipeframe_alloc( void *cx_, size_t size ) {
+    struct achd_conn *conn = (struct achd_conn*)cx_;
+    if( size > conn->pipeframe_size ) {
+        conn->pipeframe_size = size;
+        free(conn->pipeframe);
+        conn->pipeframe = ach_pipe_alloc( conn->pipeframe_size );
+    }
+    return conn->pipeframe->data;
+}
 
-static void get_frame( struct achd_conn *conn ) {
+static enum ach_status get_frame( struct achd_conn *conn, const struct timespec *abstime ) {
+    ach_status_t r = ACH_BUG;
     do {
         size_t frame_size = 0;
-        ach_status_t r = ACH_BUG;
+        size_t buf_size = conn->pipeframe_size;
         if( 0 ) {
             /* parse command */
             /* if ( 0 == memcmp("next", cmd, 4) ) { */
@@ -106,40 +240,43 @@ static void get_frame( struct achd_conn *conn ) {
         } else {
             /* push the data */
             /* TODO: getlast header is not right */
-            r = ach_get( &conn->channel, conn->pipeframe->data, conn->pipeframe_size, &frame_size,  NULL,
-                         ( (conn->recv_hdr.get_last /*|| is_freq*/) ?
-                           (ACH_O_WAIT | ACH_O_LAST ) : ACH_O_WAIT) );
+            r = ach_get_alloc( &conn->channel, pipeframe_alloc, conn, &frame_size, abstime,
+                               ( (conn->recv_hdr.get_last /*|| is_freq*/) ?
+                                 (ACH_O_WAIT | ACH_O_LAST ) : ACH_O_WAIT) );
+        }
+        if( conn->pipeframe_size > buf_size ) {
+            achd_log( LOG_NOTICE, "buffer too small, resized to %" PRIuPTR "\n",
+                      conn->pipeframe_size );
         }
         /* check return code */
-        if( ACH_OVERFLOW == r ) {
-            achd_log( LOG_NOTICE, "buffer too small, resizing to %" PRIuPTR "\n", frame_size);
-            /* enlarge buffer and retry on overflow */
-            assert(frame_size > conn->pipeframe_size );
-            conn->pipeframe_size = frame_size;
-            free(conn->pipeframe);
-            conn->pipeframe = ach_pipe_alloc( conn->pipeframe_size );
-        } else if (ACH_OK == r || ACH_MISSED_FRAME == r ) {
+        if (ACH_OK == r || ACH_MISSED_FRAME == r ) {
             ach_pipe_set_size( conn->pipeframe, frame_size );
             break;
-        }else {
+        } else if( ACH_TIMEOUT == r && abstime ) {
+            break;
+        } else {
             /* abort on other errors */
             /* hard_assert( 0, "sub: ach_error: %s\n", */
             /*              ach_result_to_string(r) ); */
             assert(0);
         }
     }while( !cx.sig_received );
+    return r;
 }
 
-static void put_frame( struct achd_conn *conn ) {
-    size_t cnt =  ach_pipe_get_size(conn->pipeframe);
+static void put_buf( struct achd_conn *conn, const void *buf, size_t cnt ) {
     if( !cx.sig_received ) {
-        ach_status_t r = ach_put( &conn->channel, conn->pipeframe->data, cnt );
+        ach_status_t r = ach_put( &conn->channel, buf, cnt );
         if( ACH_OK != r ) {
             cx.error( r, "Couldn't put frame, size %d\n", cnt );
         }
     }
 }
 
+static void put_frame( struct achd_conn *conn ) {
+    put_buf( conn, conn->pipeframe->data, ach_pipe_get_size(conn->pipeframe) );
+}
+
 int achd_connect_nop( struct achd_conn *conn ) {
     (void)conn;
     return 0;
@@ -149,7 +286,9 @@ int achd_connect_nop( struct achd_conn *conn ) {
 int achd_udp_sock( struct achd_conn *conn ) {
     struct udp_cx *ucx;
     if( conn->cx ) {
+        /* reconnecting, replace the socket */
         ucx = (struct udp_cx*)conn->cx;
+        close( ucx->sock );
     } else {
         conn->cx = ucx = (struct udp_cx*)calloc(1, sizeof(struct udp_cx));
     }
@@ -187,8 +326,177 @@ int achd_udp_sock( struct achd_conn *conn ) {
     return 0;
 }
 
+/* Frames for a resuming client carry the remote sequence number after
+ * the pipe frame header */
+#define SEQ_FRAME_MAGIC "achpseq"
+#define SEQ_FRAME_HEADER_SIZE 24
+
+/* Fill in the stream header for frame, returning its size */
+static size_t frame_header( struct achd_conn *conn, const ach_frame_ref_t *frame,
+                            uint8_t hdr[SEQ_FRAME_HEADER_SIZE] ) {
+    size_t hdr_size;
+    if( conn->recv_hdr.resume ) {
+        memcpy( hdr, SEQ_FRAME_MAGIC, 8 );
+        put_le( hdr+16, frame->seq_num, 8 );
+        hdr_size = SEQ_FRAME_HEADER_SIZE;
+    } else {
+        memcpy( hdr, "achpipe", 8 );
+        hdr_size = sizeof(ach_pipe_frame_t) - 1;
+    }
+    put_le( hdr+8, frame->size[0] + frame->size[1], 8 );
+    return hdr_size;
+}
+
+/* Write a frame, given in up to two parts, behind its header in one
+ * system call */
+static int write_frame( struct achd_conn *conn, const ach_frame_ref_t *frame ) {
+    size_t cnt = frame->size[0] + frame->size[1];
+    uint8_t hdr[SEQ_FRAME_HEADER_SIZE];
+    size_t hdr_size = frame_header( conn, frame, hdr );
+
+    struct iovec iov[3] = { { hdr, hdr_size },
+                            { (void*)frame->data[0], frame->size[0] },
+                            { (void*)frame->data[1], frame->size[1] } };
+    achd_log( LOG_DEBUG, "Writing frame %" PRIu64 ", %" PRIuPTR " bytes\n",
+              frame->seq_num, cnt );
+    ssize_t r = achd_writev( conn->out, iov, frame->size[1] ? 3 : 2 );
+    return ( r == (ssize_t)(hdr_size + cnt) ) ? 0 : -1;
+}
+
+/* Frames held back to go out in one write, see achd -c */
+struct coalesce {
+    size_t max;                 /**< write once this many bytes are held */
+    long us;                    /**< or once the first has waited this long */
+    struct timespec deadline;   /**< when the first must go, by the channel clock */
+    size_t len;                 /**< bytes held */
+    uint8_t *buf;
+};
+
+/* Write out the held frames */
+static int coalesce_flush( struct achd_conn *conn, struct coalesce *co ) {
+    if( 0 == co->len ) return 0;
+    achd_log( LOG_DEBUG, "Writing %" PRIuPTR " coalesced bytes\n", co->len );
+    if( (ssize_t)co->len != achd_write( conn->out, co->buf, co->len ) ) return -1;
+    co->len = 0;
+    return 0;
+}
+
+/* Whether the first held frame has waited long enough */
+static int coalesce_due( struct achd_conn *conn, struct coalesce *co ) {
+    struct timespec now;
+    clock_gettime( conn->channel.shm->clock, &now );
+    return now.tv_sec > co->deadline.tv_sec ||
+        ( now.tv_sec == co->deadline.tv_sec && now.tv_nsec >= co->deadline.tv_nsec );
+}
+
+/* Hold frame to be written with the next ones, or write it now if it
+ * doesn't fit.  On failure nothing of frame is held, so it can be
+ * pushed again. */
+static int push_frame( struct achd_conn *conn, struct coalesce *co,
+                       const ach_frame_ref_t *frame ) {
+    uint8_t hdr[SEQ_FRAME_HEADER_SIZE];
+    size_t hdr_size = frame_header( conn, frame, hdr );
+    size_t size = hdr_size + frame->size[0] + frame->size[1];
+
+    if( co->len + size > co->max && coalesce_flush( conn, co ) ) return -1;
+    if( size > co->max ) return write_frame( conn, frame );
+
+    if( 0 == co->len ) {
+        clock_gettime( conn->channel.shm->clock, &co->deadline );
+        co->deadline.tv_sec += co->us / 1000000;
+        co->deadline.tv_nsec += (co->us % 1000000) * 1000;
+        co->deadline.tv_sec += co->deadline.tv_nsec / 1000000000;
+        co->deadline.tv_nsec %= 1000000000;
+    }
+    uint8_t *p = co->buf + co->len;
+    memcpy( p, hdr, hdr_size );
+    memcpy( p + hdr_size, frame->data[0], frame->size[0] );
+    memcpy( p + hdr_size + frame->size[0], frame->data[1], frame->size[1] );
+    co->len += size;
+    return 0;
+}
+
+/* Send segments as soon as they are written */
+static void tcp_nodelay( int fd ) {
+    int one = 1;
+    if( setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) ) ) {
+        achd_log( LOG_INFO, "Couldn't set TCP_NODELAY: %s\n", strerror(errno) );
+    }
+}
+
+/* Note a failed write, returning whether to try again */
+static int write_failed( struct achd_conn *conn, int nodelay ) {
+    achd_log( LOG_ERR, "Couldn't write frame\n");
+    if( !cx.reconnect ) return 0;
+    achd_reconnect(conn);
+    if( nodelay ) tcp_nodelay( conn->out );
+    return !cx.sig_received;
+}
+
+/* Find the next frame in place */
+static enum ach_status get_ref( struct achd_conn *conn, ach_frame_ref_t *frame,
+                                const struct timespec *abstime ) {
+    ach_status_t r;
+    do {
+        r = ach_get_ref( &conn->channel, frame, abstime, ACH_O_WAIT );
+        if( ACH_OK == r || ACH_MISSED_FRAME == r ) break;
+        if( ACH_TIMEOUT == r && abstime ) break;
+        assert(0);
+    } while( !cx.sig_received );
+    return r;
+}
+
+/* Copy a frame out of the ring and drop our subscription, so a
+ * broken link doesn't hold the publisher back while we reconnect */
+static int unref_frame( struct achd_conn *conn, ach_frame_ref_t *frame ) {
+    size_t size = frame->size[0] + frame->size[1];
+    if( !conn->pipeframe || size > conn->pipeframe_size ) {
+        ach_pipe_frame_t *p = ach_pipe_alloc( size );
+        if( NULL == p ) {
+            achd_log( LOG_ERR, "Couldn't allocate %" PRIuPTR " bytes for frame\n", size );
+            return -1;
+        }
+        free( conn->pipeframe );
+        conn->pipeframe = p;
+        conn->pipeframe_size = size;
+    }
+    memcpy( conn->pipeframe->data, frame->data[0], frame->size[0] );
+    memcpy( conn->pipeframe->data + frame->size[0], frame->data[1], frame->size[1] );
+    ach_seek( &conn->channel, frame->seq_num );
+    ach_unsubscribe( &conn->channel );
+    frame->data[0] = conn->pipeframe->data;
+    frame->size[0] = size;
+    frame->data[1] = NULL;
+    frame->size[1] = 0;
+    return 0;
+}
+
 void achd_push_tcp( struct achd_conn *conn ) {
     /* Subscribe and Write */
+    const struct achd_headers *opts =
+        (ACHD_MODE_SERVE == conn->mode) ? &conn->recv_hdr : &cx.cl_opts;
+
+    /* A reliable channel holds our next frame till we move past it,
+     * so it can be sent straight from the ring instead of copied out
+     * first.  Other channels may overwrite it mid-send.  Subscribing
+     * makes the publisher wait for the link, so only when asked. */
+    int in_place = opts->in_place && !conn->recv_hdr.get_last &&
+        conn->channel.shm->reliable;
+    int by_ref = 0;
+
+    /* Small frames are held back and written together.  We decide
+     * when segments go out then, so Nagle would only add delay. */
+    struct coalesce co;
+    memset( &co, 0, sizeof(co) );
+    co.max = (size_t)opts->coalesce_bytes;
+    co.us = opts->coalesce_us ? opts->coalesce_us : ACHD_COALESCE_US;
+    if( co.max && NULL == (co.buf = (uint8_t*)malloc( co.max )) ) {
+        achd_log( LOG_WARNING, "Couldn't allocate %" PRIuPTR " bytes to coalesce frames, "
+                  "writing each alone\n", co.max );
+        co.max = 0;
+    }
+    int nodelay = opts->tcp_nodelay || co.max;
+    if( nodelay ) tcp_nodelay( conn->out );
 
     /* struct timespec period = {0,0}; */
     /* int is_freq = 0; */
@@ -210,24 +518,47 @@ void achd_push_tcp( struct achd_conn *conn ) {
         /*     verbprintf(2, "Command %s\n", cmd ); */
         /* } */
 
-        /* read the data */
-        get_frame(conn);
+        /* subscribe, again after a reconnect, or copy if no slot is free */
+        if( in_place && !by_ref ) {
+            in_place = by_ref = ACH_OK == ach_subscribe( &conn->channel );
+            if( by_ref ) achd_log( LOG_DEBUG, "Sending frames in place\n" );
+        }
+
+        /* read the data, waiting no longer than held frames may */
+        const struct timespec *abstime = co.len ? &co.deadline : NULL;
+        ach_frame_ref_t frame;
+        enum ach_status r;
+        if( by_ref ) {
+            r = get_ref( conn, &frame, abstime );
+        } else {
+            r = get_frame( conn, abstime );
+            frame.seq_num = conn->channel.seq_num;
+            frame.data[0] = conn->pipeframe->data;
+            frame.size[0] = ach_pipe_get_size(conn->pipeframe);
+            frame.data[1] = NULL;
+            frame.size[1] = 0;
+        }
 
         if( cx.sig_received ) break;
 
         /* stream send */
-        int sent_frame = 0;
-        do {
-            size_t size = sizeof(ach_pipe_frame_t) - 1 + ach_pipe_get_size(conn->pipeframe);
-            achd_log( LOG_DEBUG, "Writing frame, %" PRIuPTR " bytes total\n", size);
-            ssize_t r = achd_write( conn->out, conn->pipeframe, size );
-            if( r < 0 || (size_t)r != size ) {
-                achd_log( LOG_ERR, "Couldn't write frame\n");
-                if( cx.reconnect ) achd_reconnect(conn);
-                else return;
-            } else sent_frame = 1;
-        } while( !sent_frame && !cx.sig_received && cx.reconnect );
-        /* TODO: ACH_O_LAST handling */
+        if( ACH_TIMEOUT != r ) {
+            while( push_frame( conn, &co, &frame ) < 0 ) {
+                if( by_ref && cx.reconnect && 0 == unref_frame( conn, &frame ) ) {
+                    by_ref = 0;
+                }
+                if( !write_failed( conn, nodelay ) ) goto done;
+            }
+            /* TODO: ACH_O_LAST handling */
+
+            /* let the publisher reuse it */
+            if( by_ref ) ach_seek( &conn->channel, frame.seq_num );
+        }
+        if( co.len && (co.len >= co.max || coalesce_due( conn, &co )) ) {
+            while( coalesce_flush( conn, &co ) < 0 ) {
+                if( !write_failed( conn, nodelay ) ) goto done;
+            }
+        }
 
         /* if( opt_sync ) { */
             /*     fsync( fileno(fout) ); /\* fails w/ sbcl, and maybe that's ok *\/ */
@@ -240,25 +571,47 @@ void achd_push_tcp( struct achd_conn *conn ) {
         /*     _relsleep(period); */
         /* } */
     }
+ done:
+    /* leave no slot behind for the publisher to wait on */
+    if( by_ref ) ach_unsubscribe( &conn->channel );
+    free( co.buf );
+}
+
+/* Note frames skipped between the last one put and seq */
+static void check_seq( struct achd_conn *conn, uint64_t seq ) {
+    uint64_t last = conn->send_hdr.resume_seq;
+    if( last && seq > last + 1 ) {
+        achd_log( LOG_WARNING, "Lost remote frames %" PRIu64 " through %" PRIu64 "\n",
+                  last + 1, seq - 1 );
+    } else if( last && seq <= last ) {
+        achd_log( LOG_WARNING, "Remote channel restarted at frame %" PRIu64 "\n", seq );
+    }
+    conn->send_hdr.resume_seq = seq;
 }
 
 void achd_pull_tcp( struct achd_conn *conn ) {
     /* Read and Publish Loop */
     while( !cx.sig_received ) {
-        int got_frame = 0;
+        int got_frame = 0, has_seq = 0;
         uint64_t cnt = 0;
+        uint8_t seq[8];
         do {
             /* get size */
-            ssize_t s = achd_read(conn->in, conn->pipeframe, 16 );
+            ssize_t s = achd_read_buffered(conn->in, &conn->rbuf, conn->pipeframe, 16 );
             if( s <= 0 ) {
                 achd_log(LOG_DEBUG, "Empty read: %s (%d)\n", strerror(errno), errno);
                 achd_reconnect(conn);
             } else if( 16 != (ssize_t)s ) {
                 achd_log(LOG_ERR, "Incomplete frame header\n");
                 achd_reconnect(conn);
-            } else if( memcmp("achpipe", conn->pipeframe->magic, 8) ) {
+            } else if( memcmp("achpipe", conn->pipeframe->magic, 8) &&
+                       memcmp(SEQ_FRAME_MAGIC, conn->pipeframe->magic, 8) ) {
                 achd_log(LOG_ERR, "Invalid frame header\n");
                 achd_reconnect(conn);
+            } else if( (has_seq = !memcmp(SEQ_FRAME_MAGIC, conn->pipeframe->magic, 8)) &&
+                       8 != achd_read_buffered(conn->in, &conn->rbuf, seq, 8) ) {
+                achd_log(LOG_ERR, "Incomplete frame header\n");
+                achd_reconnect(conn);
             } else {
                 cnt = ach_pipe_get_size( conn->pipeframe );
                 /* TODO: sanity check that cnt is not something outrageous */
@@ -270,7 +623,7 @@ void achd_pull_tcp( struct achd_conn *conn ) {
                     ach_pipe_set_size( conn->pipeframe, cnt );
                 }
                 /* get data */
-                s = achd_read( conn->in, conn->pipeframe->data, (size_t)cnt );
+                s = achd_read_buffered( conn->in, &conn->rbuf, conn->pipeframe->data, (size_t)cnt );
                 if( (ssize_t)cnt != s ) {
                     achd_log(LOG_ERR, "Incomplete frame data\n");
                     achd_reconnect(conn);
@@ -282,6 +635,7 @@ void achd_pull_tcp( struct achd_conn *conn ) {
         if( !got_frame ) return;
         /* put data */
         put_frame(conn);
+        if( has_seq ) check_seq( conn, get_le( seq, 8 ) );
     }
 }
 
@@ -308,11 +662,11 @@ static void udp_peer( struct achd_conn *conn, struct sockaddr_in *addr_peer ) {
 }
 
 /* Check if TCP control channel is still open */
-static int udp_poll( struct pollfd pfd[2] ) {
+static int udp_poll( struct pollfd pfd[2], int timeout ) {
     int r;
     do {
         errno = 0;
-        r = poll( pfd, 2, -1 );
+        r = poll( pfd, 2, timeout );
     } while ( r < 0 && ( EAGAIN == errno ||
                          (EINTR == errno && !cx.sig_received) ) );
     if( cx.sig_received ) {
@@ -336,84 +690,613 @@ static int udp_poll( struct pollfd pfd[2] ) {
     return 0;
 }
 
-void achd_push_udp( struct achd_conn *conn ) {
-    struct udp_cx *ucx = (struct udp_cx*)conn->cx;
-    assert(ucx);
+/* Grow a batch slot for ach_get_alloc() */
+struct udp_slot {
+    struct udp_cx *ucx;
+    size_t i;
+};
 
-    int warned_mtu_eth = 0;
-    int warned_mtu_udp = 0;
+static void *udp_slot_alloc( void *cx_, size_t size ) {
+    struct udp_slot *slot = (struct udp_slot*)cx_;
+    struct udp_cx *ucx = slot->ucx;
+    if( size > ucx->buf_size[slot->i] ) {
+        /* on failure the frame stays in the channel for the next batch */
+        uint8_t *b = (uint8_t*)malloc( size );
+        if( NULL == b ) return NULL;
+        free( ucx->buf[slot->i] );
+        ucx->buf[slot->i] = b;
+        ucx->buf_size[slot->i] = size;
+    }
+    return ucx->buf[slot->i];
+}
 
-    /* Find remote address */
-    struct sockaddr_in addr_udp;
-    udp_peer( conn, &addr_udp );
+/* Take frames already waiting in the channel, without blocking, into
+ * the batch after slot 0.  Returns the batch size. */
+static size_t udp_drain( struct achd_conn *conn, struct udp_cx *ucx ) {
+    size_t n = 1;
+    /* only the latest frame matters */
+    if( conn->recv_hdr.get_last ) return n;
+    while( n < UDP_BATCH ) {
+        struct udp_slot slot = {ucx, n};
+        size_t frame_size = 0;
+        ach_status_t r = ach_get_alloc( &conn->channel, udp_slot_alloc, &slot, &frame_size,
+                                        NULL, 0 );
+        if( ACH_OK == r || ACH_MISSED_FRAME == r ) {
+            ucx->seq[n] = (uint32_t)conn->channel.seq_num;
+            ucx->len[n++] = frame_size;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+/* Send n fragments, returning how many went out */
+static ssize_t udp_send_batch( int sock, const struct udp_frag *frag, size_t n,
+                               struct sockaddr_in *addr )
+{
+    struct iovec iov[UDP_BATCH][2];
+    struct msghdr hdr[UDP_BATCH];
+    size_t i;
+    assert( n <= UDP_BATCH );
+    memset( hdr, 0, sizeof(hdr[0]) * n );
+    for( i = 0; i < n; i ++ ) {
+        iov[i][0].iov_base = (void*)frag[i].hdr;
+        iov[i][0].iov_len = frag[i].hdr_len;
+        iov[i][1].iov_base = (void*)frag[i].data;
+        iov[i][1].iov_len = frag[i].len;
+        hdr[i].msg_name = addr;
+        hdr[i].msg_namelen = sizeof(*addr);
+        hdr[i].msg_iov = iov[i];
+        hdr[i].msg_iovlen = 2;
+    }
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msg[UDP_BATCH];
+    memset( msg, 0, sizeof(msg[0]) * n );
+    for( i = 0; i < n; i ++ ) msg[i].msg_hdr = hdr[i];
+    int r;
+    do {
+        r = sendmmsg( sock, msg, (unsigned)n, 0 );
+    } while( r < 0 && !cx.sig_received && EINTR == errno );
+    return r;
+#else
+    ssize_t r;
+    do {
+        r = sendmsg( sock, &hdr[0], 0 );
+    } while( r < 0 && !cx.sig_received && EINTR == errno );
+    return ( r < 0 ) ? r : 1;
+#endif
+}
+
+/* Send the queued fragments, returning -1 if the connection closed */
+static int udp_flush( struct udp_cx *ucx, struct pollfd pfd[2], struct sockaddr_in *addr ) {
+    size_t i = 0;
+    while( i < ucx->frag_cnt && !cx.sig_received ) {
+        /* Poll fds */
+        /* TODO: does O_NONBLOCK make sense? */
+        pfd[0].revents = 0;
+        while( ! (pfd[0].revents & POLLOUT) ) {
+            int r = udp_poll( pfd, -1 );
+            if( r < 0 ) {
+                return -1;
+            } else if( cx.sig_received ) {
+                return -1;
+            } else if ( ! (pfd[0].revents & POLLOUT) ) {
+                achd_log(LOG_ERR, "No output possible after poll\n");
+            }
+        }
+
+        achd_log( LOG_DEBUG, "Sending %" PRIuPTR " UDP messages\n", ucx->frag_cnt - i );
+        ssize_t r = udp_send_batch( ucx->sock, ucx->frag + i, ucx->frag_cnt - i, addr );
+        if( r < 0 ) {
+            /* cx.error() returns in client mode, so give up here */
+            cx.error( ACH_FAILED_SYSCALL, "Couldn't send UDP message to %s:%d, %s (%d)\n",
+                      inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), strerror(errno), errno );
+            ucx->frag_cnt = 0;
+            return -1;
+        } else if( 0 == r ) {
+            /* nothing taken, poll again */
+            continue;
+        }
+        i += (size_t)r;
+    }
+    ucx->frag_cnt = 0;
+    return 0;
+}
+
+/* Take the next queue slot, sending a full queue first */
+static struct udp_frag *udp_next( struct udp_cx *ucx, struct pollfd pfd[2],
+                                  struct sockaddr_in *addr )
+{
+    if( UDP_BATCH == ucx->frag_cnt && udp_flush( ucx, pfd, addr ) ) return NULL;
+    return &ucx->frag[ucx->frag_cnt++];
+}
+
+/* Drop the datagram just queued when simulating a lossy link */
+static void udp_maybe_lose( struct udp_cx *ucx ) {
+    if( cx.udp_loss > 0 &&
+        (double)rand_r( &ucx->loss_seed ) < cx.udp_loss * ((double)RAND_MAX + 1) )
+    {
+        ucx->frag_cnt--;
+    }
+}
+
+static void xor_into( uint8_t *dst, const uint8_t *src, size_t n ) {
+    size_t i;
+    for( i = 0; i < n; i ++ ) dst[i] ^= src[i];
+}
+
+/* Queue parity for the datagrams since the last parity */
+static int udp_fec_emit( struct udp_cx *ucx, struct pollfd pfd[2], struct sockaddr_in *addr ) {
+    if( 0 == ucx->fec_cnt ) return 0;
+    struct udp_frag *f = udp_next( ucx, pfd, addr );
+    if( NULL == f ) return -1;
+    uint8_t *out = ucx->fec_out[f - ucx->frag];
+    memcpy( f->hdr, PARITY_MAGIC, 4 );
+    put_le( f->hdr+4, ucx->token, 4 );
+    put_le( f->hdr+8, ucx->fec_first, 4 );
+    put_le( f->hdr+12, ucx->fec_cnt, 2 );
+    put_le( f->hdr+14, ucx->fec_len, 2 );
+    f->hdr_len = PARITY_HEADER_SIZE;
+    memcpy( out, ucx->fec_acc, ucx->fec_max );
+    f->data = out;
+    f->len = ucx->fec_max;
+    ucx->fec_cnt = 0;
+    udp_maybe_lose( ucx );
+    return 0;
+}
+
+/* Add a queued datagram to the parity group */
+static int udp_fec_add( struct udp_cx *ucx, const struct udp_frag *f,
+                        struct pollfd pfd[2], struct sockaddr_in *addr )
+{
+    if( 0 == ucx->fec_group ) return 0;
+    const size_t hbody = FRAG_HEADER_SIZE - FRAG_BODY_OFFSET;
+    if( 0 == ucx->fec_cnt ) {
+        ucx->fec_first = (uint32_t)get_le( f->hdr+8, 4 );
+        ucx->fec_len = 0;
+        ucx->fec_max = 0;
+        memset( ucx->fec_acc, 0, sizeof(ucx->fec_acc) );
+    }
+    xor_into( ucx->fec_acc, f->hdr + FRAG_BODY_OFFSET, hbody );
+    xor_into( ucx->fec_acc + hbody, f->data, f->len );
+    ucx->fec_len ^= (uint16_t)(hbody + f->len);
+    if( hbody + f->len > ucx->fec_max ) ucx->fec_max = hbody + f->len;
+    ucx->fec_cnt ++;
+    return ( ucx->fec_cnt >= ucx->fec_group ) ? udp_fec_emit( ucx, pfd, addr ) : 0;
+}
+
+/* Queue the fragments of a frame, sending full batches.  The frame
+ * must stay put till the queue is flushed.  Frames are numbered by
+ * their channel sequence number so another sender of the same channel
+ * can take over. */
+static int udp_queue( struct udp_cx *ucx, uint32_t seq, const uint8_t *buf, size_t cnt,
+                      struct pollfd pfd[2], struct sockaddr_in *addr )
+{
+    size_t count = cnt ? (cnt + FRAG_PAYLOAD_MAX - 1) / FRAG_PAYLOAD_MAX : 1;
+    size_t i;
+    for( i = 0; i < count; i ++ ) {
+        struct udp_frag *f = udp_next( ucx, pfd, addr );
+        if( NULL == f ) return -1;
+        size_t off = i * FRAG_PAYLOAD_MAX;
+        memcpy( f->hdr, FRAG_MAGIC, 4 );
+        put_le( f->hdr+4, ucx->token, 4 );
+        put_le( f->hdr+8, ucx->pkt++, 4 );
+        put_le( f->hdr+12, seq, 4 );
+        put_le( f->hdr+16, i, 2 );
+        put_le( f->hdr+18, count, 2 );
+        put_le( f->hdr+20, cnt, 4 );
+        f->hdr_len = FRAG_HEADER_SIZE;
+        f->data = buf + off;
+        f->len = (cnt - off < FRAG_PAYLOAD_MAX) ? cnt - off : FRAG_PAYLOAD_MAX;
+        /* parity uses f before a simulated loss */
+        struct udp_frag g = *f;
+        udp_maybe_lose( ucx );
+        if( udp_fec_add( ucx, &g, pfd, addr ) ) return -1;
+    }
+    return 0;
+}
+
+/* Send frames to addr till the TCP connection closes */
+static void udp_push( struct achd_conn *conn, struct udp_cx *ucx, struct sockaddr_in *addr_udp ) {
+    int warned_size = 0;
+
+    /* the client asks for parity */
+    ucx->fec_group = (size_t)( (ACHD_MODE_SERVE == conn->mode) ?
+                               conn->recv_hdr.fec_group : cx.cl_opts.fec_group );
+    ucx->loss_seed = (unsigned)getpid();
 
     achd_log( LOG_INFO, "sending UDP to %s:%d\n",
-              inet_ntoa(addr_udp.sin_addr), ntohs(addr_udp.sin_port) );
+              inet_ntoa(addr_udp->sin_addr), ntohs(addr_udp->sin_port) );
 
     struct pollfd pfd[] = {{ .fd = ucx->sock,
                              .events = POLLOUT},
                            { .fd = conn->in,
                              .events = POLLIN } };
     while( !cx.sig_received ) {
-        /* read the data */
-        get_frame(conn);
+        /* read the data, then whatever else is already waiting */
+        get_frame( conn, NULL );
 
         if( cx.sig_received ) break;
 
-        /* Check size */
-        size_t cnt = ach_pipe_get_size( conn->pipeframe );
-        if( cnt > MTU_UDP ) {
-            if( ! warned_mtu_udp ) {
-                achd_log( LOG_ERR, "Cannot send %" PRIuPTR " bytes via UDP\n", cnt );
-                warned_mtu_udp = 1;
+        ucx->seq[0] = (uint32_t)conn->channel.seq_num;
+        size_t n = udp_drain( conn, ucx );
+
+        /* UDP Send */
+        size_t i;
+        for( i = 0; i < n; i ++ ) {
+            const uint8_t *buf = i ? ucx->buf[i] : conn->pipeframe->data;
+            size_t cnt = i ? ucx->len[i] : ach_pipe_get_size( conn->pipeframe );
+            if( cnt > (size_t)FRAG_COUNT_MAX * FRAG_PAYLOAD_MAX || cnt > UINT32_MAX ) {
+                if( ! warned_size ) {
+                    achd_log( LOG_ERR, "Cannot send %" PRIuPTR " bytes via UDP\n", cnt );
+                    warned_size = 1;
+                }
+                continue;
             }
+            if( udp_queue( ucx, ucx->seq[i], buf, cnt, pfd, addr_udp ) ) return;
+        }
+        /* protect the end of the batch too, the latest frame matters most */
+        if( udp_fec_emit( ucx, pfd, addr_udp ) ) return;
+        if( udp_flush( ucx, pfd, addr_udp ) ) return;
+    }
+}
+
+void achd_push_udp( struct achd_conn *conn ) {
+    struct udp_cx *ucx = (struct udp_cx*)conn->cx;
+    assert(ucx);
+
+    /* Find remote address */
+    struct sockaddr_in addr_udp;
+    udp_peer( conn, &addr_udp );
+
+    udp_push( conn, ucx, &addr_udp );
+}
+
+/* Receive the datagrams waiting on the socket, at least one, into the
+ * batch slots.  Returns how many were received. */
+static size_t udp_recv_batch( struct udp_cx *ucx, struct sockaddr_in *addr ) {
+    size_t i, cnt, n = 0;
+    for( i = 0; i < UDP_BATCH; i ++ ) {
+        if( ucx->buf_size[i] < FRAG_DGRAM_MAX ) {
+            free( ucx->buf[i] );
+            ucx->buf[i] = (uint8_t*)malloc( FRAG_DGRAM_MAX );
+            ucx->buf_size[i] = ucx->buf[i] ? FRAG_DGRAM_MAX : 0;
+        }
+    }
+    /* receive into the slots we have buffers for */
+    for( cnt = 0; cnt < UDP_BATCH && ucx->buf_size[cnt] >= FRAG_DGRAM_MAX; cnt ++ );
+    if( 0 == cnt ) {
+        achd_log( LOG_ERR, "Couldn't allocate UDP buffer, dropping message\n" );
+        recv( ucx->sock, NULL, 0, MSG_DONTWAIT );
+        return 0;
+    }
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msg[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    memset( msg, 0, sizeof(msg) );
+    for( i = 0; i < cnt; i ++ ) {
+        iov[i].iov_base = ucx->buf[i];
+        iov[i].iov_len = ucx->buf_size[i];
+        msg[i].msg_hdr.msg_name = &addr[i];
+        msg[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    int r;
+    do {
+        r = recvmmsg( ucx->sock, msg, (unsigned)cnt, MSG_WAITFORONE, NULL );
+    } while( r < 0 && EINTR == errno && !cx.sig_received );
+    for( i = 0; r > 0 && i < (size_t)r; i ++ ) {
+        if( msg[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+            achd_log( LOG_ERR, "Dropping UDP message larger than %" PRIuPTR " bytes\n",
+                      ucx->buf_size[i] );
             continue;
-        } else if ( cnt + HEADER_BYTES_UDP + HEADER_BYTES_IPV4 > MTU_ETH &&
-                    ! warned_mtu_eth ) {
-            achd_log( LOG_WARNING, "Size %" PRIuPTR " exceeds typical ethernet MTU\n",
-                      cnt + HEADER_BYTES_UDP + HEADER_BYTES_IPV4 );
-            warned_mtu_eth = 1;
         }
+        if( i != n ) {
+            /* keep every slot's buffer */
+            uint8_t *b = ucx->buf[n];
+            ucx->buf[n] = ucx->buf[i];
+            ucx->buf[i] = b;
+            addr[n] = addr[i];
+        }
+        ucx->len[n++] = msg[i].msg_len;
+    }
+#else
+    socklen_t len = sizeof(addr[0]);
+    ssize_t r;
+    do {
+        r = recvfrom( ucx->sock, ucx->buf[0], ucx->buf_size[0], MSG_TRUNC,
+                      (struct sockaddr*) &addr[0], &len );
+    } while( r < 0 && EINTR == errno && !cx.sig_received );
+    if( r > 0 && (size_t)r > ucx->buf_size[0] ) {
+        achd_log( LOG_ERR, "Dropping UDP message larger than %" PRIuPTR " bytes\n",
+                  ucx->buf_size[0] );
+    } else if( r >= 0 ) {
+        ucx->len[n++] = (size_t)r;
+    }
+#endif
+    return n;
+}
 
-        /* Poll fds */
-        /* TODO: does O_NONBLOCK make sense? */
-        pfd[0].revents = 0;
-        while( ! (pfd[0].revents & POLLOUT) ) {
-            int r = udp_poll( pfd );
-            if( r < 0 ) {
+/* Whether frame sequence number a is older than b */
+static int seq_before( uint32_t a, uint32_t b ) {
+    return (int32_t)(a - b) < 0;
+}
+
+/* Add one fragment, putting the frame once it is complete */
+static void udp_reassemble( struct achd_conn *conn, struct udp_cx *ucx,
+                            const uint8_t *dgram, size_t len )
+{
+    if( len < FRAG_HEADER_SIZE || memcmp( dgram, FRAG_MAGIC, 4 ) ) {
+        achd_log( LOG_ERR, "Invalid UDP fragment header\n" );
+        return;
+    }
+    uint32_t seq = (uint32_t)get_le( dgram+12, 4 );
+    uint16_t index = (uint16_t)get_le( dgram+16, 2 );
+    uint16_t count = (uint16_t)get_le( dgram+18, 2 );
+    uint32_t size = (uint32_t)get_le( dgram+20, 4 );
+    const uint8_t *data = dgram + FRAG_HEADER_SIZE;
+    size_t data_len = len - FRAG_HEADER_SIZE;
+    size_t off = (size_t)index * FRAG_PAYLOAD_MAX;
+
+    if( index >= count || off + data_len > size ||
+        (size_t)count != (size ? (size + FRAG_PAYLOAD_MAX - 1) / FRAG_PAYLOAD_MAX : 1) ||
+        (index + 1 < count && FRAG_PAYLOAD_MAX != data_len) )
+    {
+        achd_log( LOG_ERR, "Inconsistent UDP fragment\n" );
+        return;
+    }
+    if( size > conn->channel.shm->data_size ) {
+        achd_log( LOG_ERR, "Frame of %" PRIu32 " bytes exceeds channel\n", size );
+        return;
+    }
+
+    /* a newer frame already went in, unless the sender restarted */
+    if( ucx->have_seq && !seq_before( ucx->last_seq, seq ) &&
+        ucx->last_seq - seq < FRAG_STALE_WINDOW )
+    {
+        achd_log( LOG_DEBUG, "Dropping stale fragment of frame %" PRIu32 "\n", seq );
+        return;
+    }
+
+    /* whole frame in one datagram */
+    if( 1 == count ) {
+        ucx->have_seq = 1;
+        ucx->last_seq = seq;
+        put_buf( conn, data, data_len );
+        return;
+    }
+
+    /* find the frame, or take the free or oldest slot */
+    struct udp_reasm *ra = NULL;
+    size_t i;
+    for( i = 0; i < FRAG_SLOTS; i ++ ) {
+        struct udp_reasm *x = &ucx->reasm[i];
+        if( x->busy && x->seq == seq ) {
+            ra = x;
+            break;
+        } else if( NULL == ra || (ra->busy && (!x->busy || seq_before(x->seq, ra->seq))) ) {
+            ra = x;
+        }
+    }
+    if( ra->busy && seq_before( seq, ra->seq ) && ra->seq != seq ) {
+        /* older than everything we are assembling */
+        return;
+    }
+    if( !ra->busy || ra->seq != seq ) {
+        if( ra->busy ) {
+            achd_log( LOG_DEBUG, "Dropping incomplete frame %" PRIu32 "\n", ra->seq );
+        }
+        ra->busy = 0;
+        if( size > ra->max ) {
+            free( ra->buf );
+            ra->max = 0;
+            if( NULL == (ra->buf = (uint8_t*)malloc( size )) ) {
+                achd_log( LOG_ERR, "Couldn't allocate %" PRIu32 " bytes, dropping frame %" PRIu32 "\n",
+                          size, seq );
                 return;
-            } else if( cx.sig_received ) {
+            }
+            ra->max = size;
+        }
+        if( count > ra->have_max ) {
+            free( ra->have );
+            ra->have_max = 0;
+            if( NULL == (ra->have = (uint8_t*)malloc( count )) ) {
+                achd_log( LOG_ERR, "Couldn't allocate %" PRIu16 " fragment flags, dropping frame %" PRIu32 "\n",
+                          count, seq );
                 return;
-            } else if ( ! (pfd[0].revents & POLLOUT) ) {
-                achd_log(LOG_ERR, "No output possible after poll\n");
             }
+            ra->have_max = count;
         }
+        memset( ra->have, 0, count );
+        ra->busy = 1;
+        ra->seq = seq;
+        ra->size = size;
+        ra->count = count;
+        ra->got = 0;
+    } else if( ra->size != size || ra->count != count ) {
+        achd_log( LOG_ERR, "Inconsistent UDP fragment\n" );
+        return;
+    }
 
+    if( ra->have[index] ) return;
+    ra->have[index] = 1;
+    ra->got ++;
+    memcpy( ra->buf + off, data, data_len );
+    if( ra->got < ra->count ) return;
 
-        /* UDP Send */
-        ssize_t r = -1;
-        achd_log( LOG_DEBUG, "Sending %"PRIuPTR" UDP bytes\n", cnt );
-        do {
-            r = sendto( ucx->sock, conn->pipeframe->data, cnt, 0,
-                        (struct sockaddr*) &addr_udp, sizeof(addr_udp) );
-        } while( r < 0 && !cx.sig_received && EINTR == errno );
+    /* complete, so older partial frames are obsolete */
+    ucx->have_seq = 1;
+    ucx->last_seq = seq;
+    put_buf( conn, ra->buf, ra->size );
+    for( i = 0; i < FRAG_SLOTS; i ++ ) {
+        struct udp_reasm *x = &ucx->reasm[i];
+        if( x->busy && !seq_before( seq, x->seq ) ) {
+            if( x != ra ) {
+                achd_log( LOG_DEBUG, "Dropping incomplete frame %" PRIu32 "\n", x->seq );
+            }
+            x->busy = 0;
+        }
+    }
+}
 
-        if( r < 0 || (size_t)r != cnt ) {
-            cx.error( ACH_FAILED_SYSCALL, "Couldn't send UDP message to %s:%d, %s (%d)\n",
-                      inet_ntoa(addr_udp.sin_addr), ntohs(addr_udp.sin_port), strerror(errno), errno );
+static int64_t mono_ms( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Feed held datagrams before upto to reassembly, in order */
+static void udp_release( struct achd_conn *conn, struct udp_cx *ucx, uint32_t upto ) {
+    if( ucx->fec_next - upto < 0x80000000u ) return;  /* already released */
+    if( upto - ucx->fec_next > FEC_RING ) ucx->fec_next = upto - FEC_RING;
+    for( ; ucx->fec_next != upto; ucx->fec_next ++ ) {
+        struct udp_kept *k = &ucx->kept[ucx->fec_next & (FEC_RING-1)];
+        if( k->valid && k->pkt == ucx->fec_next && !k->fed ) {
+            uint8_t buf[FRAG_BODY_OFFSET + FRAG_BODY_MAX];
+            memcpy( buf, FRAG_MAGIC, 4 );
+            put_le( buf+4, ucx->token, 4 );
+            put_le( buf+8, k->pkt, 4 );
+            memcpy( buf + FRAG_BODY_OFFSET, k->body, k->len );
+            k->fed = 1;
+            udp_reassemble( conn, ucx, buf, FRAG_BODY_OFFSET + k->len );
         }
     }
 }
 
-void achd_pull_udp( struct achd_conn *conn ) {
-    struct udp_cx *ucx = (struct udp_cx*)conn->cx;
-    assert(ucx);
+/* Hold a datagram till its group's parity arrives */
+static void udp_keep( struct achd_conn *conn, struct udp_cx *ucx,
+                      const uint8_t *dgram, size_t len )
+{
+    uint32_t pkt = (uint32_t)get_le( dgram+8, 4 );
+    if( pkt - ucx->fec_next >= 0x80000000u ) {
+        if( ucx->fec_next - pkt <= FEC_RING ) {
+            /* late, its group is done */
+            udp_reassemble( conn, ucx, dgram, len );
+            return;
+        }
+        ucx->fec_next = pkt;    /* sender restarted */
+    }
+    /* parity went missing too long, give up waiting */
+    if( pkt - ucx->fec_next >= FEC_RING ) {
+        udp_release( conn, ucx, pkt - FEC_RING + 1 );
+    }
+    struct udp_kept *k = &ucx->kept[pkt & (FEC_RING-1)];
+    k->valid = 1;
+    k->fed = 0;
+    k->pkt = pkt;
+    k->t_ms = mono_ms();
+    k->len = len - FRAG_BODY_OFFSET;
+    memcpy( k->body, dgram + FRAG_BODY_OFFSET, k->len );
+}
 
-    /* Find peer address */
-    struct sockaddr_in addr_peer;
-    memset( &addr_peer, 0, sizeof(addr_peer) );
-    udp_peer( conn, &addr_peer );
+/* Rebuild the one datagram missing from a parity group, if any, then
+ * release the group */
+static void udp_fec_recover( struct achd_conn *conn, struct udp_cx *ucx,
+                             const uint8_t *dgram, size_t len )
+{
+    if( len < PARITY_HEADER_SIZE ) return;
+    uint32_t first = (uint32_t)get_le( dgram+8, 4 );
+    size_t cnt = (size_t)get_le( dgram+12, 2 );
+    uint16_t body_len = (uint16_t)get_le( dgram+14, 2 );
+    size_t parity_len = len - PARITY_HEADER_SIZE;
+    if( 0 == cnt || cnt > ACHD_FEC_GROUP_MAX || parity_len > FRAG_BODY_MAX ) {
+        achd_log( LOG_ERR, "Invalid UDP parity header\n" );
+        return;
+    }
+    if( !ucx->fec_seen ||
+        (first - ucx->fec_next > FEC_RING && ucx->fec_next - first > FEC_RING) )
+    {
+        /* hold datagrams from here on */
+        ucx->fec_seen = 1;
+        ucx->fec_next = first;
+        memset( ucx->kept, 0, sizeof(ucx->kept) );
+        return;
+    }
+
+    size_t i, missing = cnt;
+    for( i = 0; i < cnt; i ++ ) {
+        uint32_t pkt = first + (uint32_t)i;
+        const struct udp_kept *k = &ucx->kept[pkt & (FEC_RING-1)];
+        if( !k->valid || k->pkt != pkt ) {
+            if( missing < cnt ) break;      /* lost two, can't help */
+            missing = i;
+        }
+    }
+
+    if( missing < cnt && i == cnt ) {
+        uint8_t buf[FRAG_BODY_OFFSET + FRAG_BODY_MAX];
+        uint8_t *body = buf + FRAG_BODY_OFFSET;
+        memset( body, 0, FRAG_BODY_MAX );
+        memcpy( body, dgram + PARITY_HEADER_SIZE, parity_len );
+        for( i = 0; i < cnt; i ++ ) {
+            if( i == missing ) continue;
+            const struct udp_kept *k = &ucx->kept[(first + (uint32_t)i) & (FEC_RING-1)];
+            xor_into( body, k->body, k->len );
+            body_len ^= (uint16_t)k->len;
+        }
+        if( body_len < FRAG_HEADER_SIZE - FRAG_BODY_OFFSET || body_len > parity_len ) {
+            achd_log( LOG_ERR, "Inconsistent UDP parity\n" );
+        } else {
+            memcpy( buf, FRAG_MAGIC, 4 );
+            put_le( buf+4, ucx->token, 4 );
+            put_le( buf+8, first + (uint32_t)missing, 4 );
+            achd_log( LOG_DEBUG, "Recovered UDP datagram %" PRIu32 "\n",
+                      first + (uint32_t)missing );
+            udp_keep( conn, ucx, buf, FRAG_BODY_OFFSET + body_len );
+        }
+    }
+    udp_release( conn, ucx, first + (uint32_t)cnt );
+}
+
+/* Release datagrams held longer than FEC_HOLD_MS, whose parity is
+ * presumably lost, returning the milliseconds till the next one
+ * expires or -1 if none are held */
+static int udp_expire( struct achd_conn *conn, struct udp_cx *ucx ) {
+    if( !ucx->fec_seen ) return -1;
+    int64_t now = mono_ms();
+    uint32_t upto = ucx->fec_next, pkt;
+    for( pkt = ucx->fec_next; pkt != ucx->fec_next + FEC_RING; pkt ++ ) {
+        const struct udp_kept *k = &ucx->kept[pkt & (FEC_RING-1)];
+        if( k->valid && k->pkt == pkt && !k->fed ) {
+            int64_t age = now - k->t_ms;
+            if( age < FEC_HOLD_MS ) {
+                udp_release( conn, ucx, upto );
+                return (int)(FEC_HOLD_MS - age);
+            }
+            upto = pkt + 1;
+        }
+    }
+    udp_release( conn, ucx, upto );
+    return -1;
+}
+
+/* Handle one datagram, data or parity */
+static void udp_receive( struct achd_conn *conn, struct udp_cx *ucx,
+                         const uint8_t *dgram, size_t len )
+{
+    if( ucx->check_token &&
+        (len < 8 || get_le( dgram+4, 4 ) != ucx->token) )
+    {
+        achd_log( LOG_DEBUG, "Dropping datagram from another channel\n" );
+        return;
+    }
+    if( len >= 4 && 0 == memcmp( dgram, PARITY_MAGIC, 4 ) ) {
+        udp_fec_recover( conn, ucx, dgram, len );
+    } else if( ucx->fec_seen && len >= FRAG_HEADER_SIZE &&
+               0 == memcmp( dgram, FRAG_MAGIC, 4 ) ) {
+        udp_keep( conn, ucx, dgram, len );
+    } else {
+        udp_reassemble( conn, ucx, dgram, len );
+    }
+}
 
+/* Receive frames from peer, or from anyone if peer is NULL, till the
+ * TCP connection closes */
+static void udp_pull( struct achd_conn *conn, struct udp_cx *ucx,
+                      const struct sockaddr_in *addr_peer )
+{
     /* setup for poll */
     struct pollfd pfd[] = {{ .fd = ucx->sock,
                              .events = POLLIN},
@@ -421,50 +1304,276 @@ void achd_pull_udp( struct achd_conn *conn ) {
                              .events = POLLIN } };
 
     /* Get the packets */
+    int timeout = -1;
     while( !cx.sig_received ) {
-        /* Poll FDs */
+        /* Poll FDs, waking to release datagrams held for parity */
         {
-            int r = udp_poll( pfd );
+            int r = udp_poll( pfd, timeout );
             if( cx.sig_received ) {
                 break;
             } else if( r < 0 ) {
                 break;
             } else if ( ! (pfd[0].revents & POLLIN) ) {
-                achd_log(LOG_ERR, "No input avaiable after poll\n");
+                if( timeout < 0 ) achd_log(LOG_ERR, "No input avaiable after poll\n");
+                timeout = udp_expire( conn, ucx );
                 continue;
             }
         }
 
-        /* Read packet */
-        struct sockaddr_in addr_udp;
-        memset( &addr_udp, 0, sizeof(addr_udp) );
-        socklen_t len = sizeof(addr_udp);
-        ssize_t r = -1;
-        do {
-            /* TODO: handle too small buffers */
-            r = recvfrom( ucx->sock, conn->pipeframe->data, conn->pipeframe_size,
-                          0, (struct sockaddr*) &addr_udp, &len );
-        } while( r < 0 && EINTR == errno && !cx.sig_received );
+        /* Read packets */
+        struct sockaddr_in addr_udp[UDP_BATCH];
+        size_t n = udp_recv_batch( ucx, addr_udp );
 
         if( cx.sig_received ) break;
 
-        /* Check that peer matches */
-        if( 0 != memcmp( &(addr_udp.sin_addr), &(addr_peer.sin_addr),
-                         sizeof(addr_udp.sin_addr) ) ||
-            addr_udp.sin_port != addr_peer.sin_port )
-        {
-            achd_log( LOG_WARNING, "Stray packet from %s:%d, wanted %s:%d\n",
-                      inet_ntoa(addr_udp.sin_addr), ntohs(addr_udp.sin_port),
-                      inet_ntoa(addr_peer.sin_addr), ntohs(addr_peer.sin_port) );
-            continue;
+        size_t i;
+        for( i = 0; i < n; i ++ ) {
+            /* Check that peer matches */
+            if( addr_peer &&
+                ( 0 != memcmp( &(addr_udp[i].sin_addr), &(addr_peer->sin_addr),
+                               sizeof(addr_udp[i].sin_addr) ) ||
+                  addr_udp[i].sin_port != addr_peer->sin_port ) )
+            {
+                achd_log( LOG_WARNING, "Stray packet from %s:%d, wanted %s:%d\n",
+                          inet_ntoa(addr_udp[i].sin_addr), ntohs(addr_udp[i].sin_port),
+                          inet_ntoa(addr_peer->sin_addr), ntohs(addr_peer->sin_port) );
+                continue;
+            }
+
+            achd_log( LOG_DEBUG, "Received %" PRIuPTR " UDP bytes from %s:%d\n",
+                      ucx->len[i], inet_ntoa(addr_udp[i].sin_addr), ntohs(addr_udp[i].sin_port) );
+
+            /* Put the frame once complete */
+            udp_receive( conn, ucx, ucx->buf[i], ucx->len[i] );
         }
+        timeout = udp_expire( conn, ucx );
+    }
 
-        achd_log( LOG_DEBUG, "Received %" PRIdPTR " UDP bytes from %s:%d\n",
-                  r, inet_ntoa(addr_udp.sin_addr), ntohs(addr_udp.sin_port) );
+}
 
-        /* Put the frame */
-        ach_pipe_set_size( conn->pipeframe, (size_t)r );
-        put_frame(conn);
+void achd_pull_udp( struct achd_conn *conn ) {
+    struct udp_cx *ucx = (struct udp_cx*)conn->cx;
+    assert(ucx);
+
+    /* Find peer address */
+    struct sockaddr_in addr_peer;
+    memset( &addr_peer, 0, sizeof(addr_peer) );
+    udp_peer( conn, &addr_peer );
+
+    udp_pull( conn, ucx, &addr_peer );
+}
+
+
+/* Multicast
+ *
+ * The server publishes each channel once to a multicast group, however
+ * many clients subscribe.  Every subscriber still holds a TCP
+ * connection, served by its own achd process, for setup and liveness.
+ * Those processes elect the one sender per channel by locking the
+ * channel's shm file; when the sender's client leaves, another process
+ * takes over.
+ * Frames use the UDP fragment format and are numbered by channel
+ * sequence number, so receivers drop any the new sender repeats.
+ */
+
+/* How often a standby server checks whether it should send */
+#define MCAST_STANDBY_MS 250
+
+/* Pick the group for a channel: the -g option, else one hashed from
+ * the name in the administratively scoped range */
+static void mcast_group( const char *chan_name, struct in_addr *group ) {
+    if( cx.mcast_group ) {
+        if( 0 == inet_aton( cx.mcast_group, group ) ) {
+            cx.error( ACH_BAD_HEADER, "Invalid multicast group %s\n", cx.mcast_group );
+        }
+        return;
+    }
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    const char *c;
+    for( c = chan_name; *c; c++ ) {
+        h ^= (uint8_t)*c;
+        h *= 16777619u;
+    }
+    group->s_addr = htonl( 0xEFFF0000u | (h & 0xFFFF) );  /* 239.255.x.y */
+}
+
+static uint32_t fnv1a( uint32_t h, const void *p, size_t n ) {
+    const uint8_t *b = (const uint8_t*)p;
+    size_t i;
+    for( i = 0; i < n; i++ ) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Token for the channel's datagrams: the same from every server
+ * process on this host, different for another host's or another
+ * channel's sender to the same group and port. */
+static uint32_t mcast_token( struct achd_conn *conn ) {
+    char host[256] = {0};
+    struct stat st;
+    memset( &st, 0, sizeof(st) );
+    if( gethostname( host, sizeof(host) - 1 ) ) {
+        achd_log( LOG_WARNING, "Couldn't get hostname: %s\n", strerror(errno) );
+    }
+    if( fstat( conn->channel.fd, &st ) ) {
+        achd_log( LOG_WARNING, "Couldn't stat channel: %s\n", strerror(errno) );
+    }
+    uint32_t h = 2166136261u;
+    h = fnv1a( h, host, strlen(host) + 1 );
+    h = fnv1a( h, conn->recv_hdr.chan_name, strlen(conn->recv_hdr.chan_name) + 1 );
+    h = fnv1a( h, &st.st_dev, sizeof(st.st_dev) );
+    h = fnv1a( h, &st.st_ino, sizeof(st.st_ino) );
+    return h;
+}
+
+int achd_mcast_sock( struct achd_conn *conn ) {
+    struct udp_cx *ucx;
+    if( conn->cx ) {
+        /* reconnecting, replace the socket */
+        ucx = (struct udp_cx*)conn->cx;
+        close( ucx->sock );
+    } else {
+        conn->cx = ucx = (struct udp_cx*)calloc(1, sizeof(struct udp_cx));
+    }
+
+    ucx->sock = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    if( ucx->sock < 0 ) {
+        cx.error(ACH_FAILED_SYSCALL, "Couldn't create UDP socket: %s\n", strerror(errno) );
+    }
+
+    memset( &ucx->addr, 0, sizeof(ucx->addr) );
+    ucx->addr.sin_family = AF_INET;
+    ucx->addr.sin_port = htons( (uint16_t)cx.port );
+    mcast_group( conn->recv_hdr.chan_name, &ucx->addr.sin_addr );
+    ucx->token = mcast_token( conn );
+
+    /* Tell peer the group */
+    if( ACH_OK != achd_printf( conn->out,
+                               "multicast-group: %s\n"
+                               "multicast-token: %" PRIu32 "\n"
+                               "remote-port: %d\n",
+                               inet_ntoa(ucx->addr.sin_addr), ucx->token,
+                               ntohs(ucx->addr.sin_port) ) )
+    {
+        cx.error(ACH_FAILED_SYSCALL, "Couldn't write multicast group: %s\n", strerror(errno) );
+    }
+
+    return 0;
+}
+
+/* Wait till we may send the channel, returning -1 if the client left */
+static int mcast_elect( struct achd_conn *conn, int lock ) {
+    while( !cx.sig_received ) {
+        if( 0 == flock( lock, LOCK_EX | LOCK_NB ) ) return 0;
+        if( EWOULDBLOCK != errno && EINTR != errno ) {
+            achd_log( LOG_ERR, "Couldn't lock multicast sender: %s\n", strerror(errno) );
+            return -1;
+        }
+        /* standby, watching the client */
+        struct pollfd pfd = { .fd = conn->in, .events = POLLIN };
+        int r = poll( &pfd, 1, MCAST_STANDBY_MS );
+        if( r > 0 ) {
+            achd_log( LOG_DEBUG, "TCP closed\n" );
+            return -1;
+        } else if( r < 0 && EINTR != errno ) {
+            cx.error( ACH_FAILED_SYSCALL, "Couldn't poll : %s\n", strerror(errno) );
+        }
+    }
+    return -1;
+}
+
+void achd_push_mcast( struct achd_conn *conn ) {
+    struct udp_cx *ucx = (struct udp_cx*)conn->cx;
+    assert(ucx);
+
+    /* Lock our own open of the channel file, not a file anyone else
+     * could create or replace.  flock() conflicts between separate
+     * opens, so every server process contends for it. */
+    char path[ACH_CHAN_NAME_MAX + 16];
+    snprintf( path, sizeof(path), "%s%s", ACH_CHAN_NAME_PREFIX, conn->recv_hdr.chan_name );
+    int lock = shm_open( path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0 );
+    if( lock < 0 ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't open %s: %s\n", path, strerror(errno) );
+        return;
+    }
+
+    if( 0 == mcast_elect( conn, lock ) ) {
+        achd_log( LOG_NOTICE, "publishing %s to %s:%d\n", conn->recv_hdr.chan_name,
+                  inet_ntoa(ucx->addr.sin_addr), ntohs(ucx->addr.sin_port) );
+        /* Resend what arrived since our client connected, which
+         * covers frames the last sender missed while it died.
+         * Receivers drop the ones they have by sequence number, as
+         * long as we are within their stale window. */
+        if( conn->channel.shm->last_seq - conn->channel.seq_num > FRAG_STALE_WINDOW / 2 ) {
+            ach_flush( &conn->channel );
+        }
+        udp_push( conn, ucx, &ucx->addr );
+    }
+    close( lock );
+}
+
+void achd_pull_mcast( struct achd_conn *conn ) {
+    if( ACHD_MODE_SERVE == conn->mode ) {
+        cx.error( ACH_BAD_HEADER, "Multicast only publishes from the server\n" );
+    }
+
+    struct udp_cx *ucx;
+    if( conn->cx ) {
+        /* reconnecting, replace the socket */
+        ucx = (struct udp_cx*)conn->cx;
+        close( ucx->sock );
+    } else {
+        conn->cx = ucx = (struct udp_cx*)calloc(1, sizeof(struct udp_cx));
     }
 
+    struct in_addr group;
+    if( !conn->recv_hdr.multicast_group ||
+        0 == inet_aton( conn->recv_hdr.multicast_group, &group ) )
+    {
+        cx.error( ACH_BAD_HEADER, "No valid multicast group from server\n" );
+        return;
+    }
+    if( !conn->recv_hdr.has_multicast_token ) {
+        cx.error( ACH_BAD_HEADER, "No multicast token from server\n" );
+        return;
+    }
+    ucx->token = (uint32_t)conn->recv_hdr.multicast_token;
+    ucx->check_token = 1;
+
+    /* Several subscribers on this host share the group port */
+    ucx->sock = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    if( ucx->sock < 0 ) {
+        cx.error(ACH_FAILED_SYSCALL, "Couldn't create UDP socket: %s\n", strerror(errno) );
+    }
+    int yes = 1;
+    if( setsockopt( ucx->sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes) ) ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't set SO_REUSEADDR: %s\n", strerror(errno) );
+    }
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( (uint16_t)conn->recv_hdr.remote_port );
+    addr.sin_addr = group;
+    if( bind( ucx->sock, (struct sockaddr*)&addr, sizeof(addr) ) ) {
+        cx.error( ACH_FAILED_SYSCALL, "Could not bind udp socket: %s\n", strerror(errno) );
+    }
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr = group;
+    mreq.imr_interface.s_addr = htonl( INADDR_ANY );
+    if( setsockopt( ucx->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq) ) ) {
+        cx.error( ACH_FAILED_SYSCALL, "Couldn't join group %s: %s\n",
+                  conn->recv_hdr.multicast_group, strerror(errno) );
+    }
+    achd_log( LOG_INFO, "receiving UDP from group %s:%d\n",
+              inet_ntoa(group), conn->recv_hdr.remote_port );
+
+    /* The sending server process may change, and its source address
+     * depends on its route to the group, so take any sender with the
+     * channel's token */
+    udp_pull( conn, ucx, NULL );
+
+    close( ucx->sock );
 }
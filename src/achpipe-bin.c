@@ -373,6 +373,22 @@ void publish( FILE *fin, char *chan_name )  {
 }
 
 
+/** growable frame buffer for ach_get_alloc() */
+struct frame_buf {
+    ach_pipe_frame_t *frame;
+    size_t max;
+};
+
+static void *frame_buf_alloc( void *cx, size_t size ) {
+    struct frame_buf *buf = (struct frame_buf*)cx;
+    if( size > buf->max ) {
+        free( buf->frame );
+        buf->max = size;
+        buf->frame = ach_pipe_alloc( buf->max );
+    }
+    return buf->frame->data;
+}
+
 /** subscribing loop */
 void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
     verbprintf(1, "Subscribing()\n");
@@ -390,8 +406,9 @@ void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
                      chan_name, ach_result_to_string(r) );
     }
     /* frame buffer */
-    size_t max = INIT_BUF_SIZE;
-    ach_pipe_frame_t *frame = ach_pipe_alloc( max );
+    struct frame_buf buf;
+    buf.max = INIT_BUF_SIZE;
+    buf.frame = ach_pipe_alloc( buf.max );
     int t0 = 1;
 
 
@@ -421,13 +438,13 @@ void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
             if( opt_sync ) {
                 /* parse command */
                 if ( 0 == memcmp("next", cmd, 4) ) {
-                    r = ach_get(&chan, frame->data, max, &frame_size,  NULL,
+                    r = ach_get_alloc(&chan, frame_buf_alloc, &buf, &frame_size,  NULL,
                                 ACH_O_WAIT );
                 }else if ( 0 == memcmp("last", cmd, 4) ){
-                    r = ach_get(&chan, frame->data, max, &frame_size,  NULL,
+                    r = ach_get_alloc(&chan, frame_buf_alloc, &buf, &frame_size,  NULL,
                                 ACH_O_WAIT | ACH_O_LAST );
                 } else if ( 0 == memcmp("poll", cmd, 4) ) {
-                    r = ach_get( &chan, frame->data, max, &frame_size, NULL,
+                    r = ach_get_alloc( &chan, frame_buf_alloc, &buf, &frame_size, NULL,
                                  ACH_O_COPY | ACH_O_LAST );
                 } else {
                     hard_assert(0, "Invalid command: %s\n", cmd );
@@ -435,19 +452,13 @@ void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
             } else {
                 /* push the data */
                 r = (opt_last || is_freq) ?
-                    ach_get( &chan, frame->data, max, &frame_size,  NULL, ACH_O_WAIT | ACH_O_LAST ) :
-                    ach_get( &chan, frame->data, max, &frame_size,  NULL, ACH_O_WAIT ) ;
+                    ach_get_alloc( &chan, frame_buf_alloc, &buf, &frame_size,  NULL, ACH_O_WAIT | ACH_O_LAST ) :
+                    ach_get_alloc( &chan, frame_buf_alloc, &buf, &frame_size,  NULL, ACH_O_WAIT ) ;
             }
             /* check return code */
-            if( ACH_OVERFLOW == r ) {
-                /* enlarge buffer and retry on overflow */
-                assert(frame_size > max );
-                max = frame_size;
-                free(frame);
-                frame = ach_pipe_alloc( max );
-            } else if (ACH_OK == r || ACH_MISSED_FRAME == r || t0 ) {
+            if (ACH_OK == r || ACH_MISSED_FRAME == r || t0 ) {
                 got_frame = 1;
-                ach_pipe_set_size( frame, frame_size );
+                ach_pipe_set_size( buf.frame, frame_size );
                 verbprintf(2, "Got ach frame %d\n", frame_size );
             }else {
                 /* abort on other errors */
@@ -460,8 +471,8 @@ void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
 
         /* stream send */
         {
-            size_t size = sizeof(ach_pipe_frame_t) - 1 + ach_pipe_get_size(frame);
-            size_t r = fwrite( frame, 1, size, fout );
+            size_t size = sizeof(ach_pipe_frame_t) - 1 + ach_pipe_get_size(buf.frame);
+            size_t r = fwrite( buf.frame, 1, size, fout );
             if( r != size ) {
                 break;
             }
@@ -478,7 +489,7 @@ void subscribe( FILE *fin, FILE *fout, char *chan_name ) {
             _relsleep(period);
         }
     }
-    free(frame);
+    free(buf.frame);
     ach_close( &chan );
 }
 
@@ -0,0 +1,192 @@
+/* -*- mode: C++; c-basic-offset: 4 -*- */
+/* ex: set shiftwidth=4 tabstop=4 expandtab: */
+/*
+ * Copyright (c) 2011, Georgia Tech Research Corporation
+ * All rights reserved.
+ *
+ * Author(s): Neil T. Dantam <ntd@gatech.edu>
+ * Georgia Tech Humanoid Robotics Lab
+ * Under Direction of Prof. Mike Stilman <mstilman@cc.gatech.edu>
+ *
+ *
+ * This file is provided under the following "BSD-style" License:
+ *
+ *
+ *   Redistribution and use in source and binary forms, with or
+ *   without modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *   USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ *   AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/** \file achtest-hpp.cpp
+ *
+ * Tests for the typed C++ interface in ach.hpp.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ach.hpp"
+
+#define CHAN_NAME "achtest-hpp"
+
+/* A frame type without a default constructor */
+struct point {
+    point( int x_, int y_ ) : x(x_), y(y_) {}
+    int x, y;
+};
+
+static void test( enum ach_status r, enum ach_status expected, const char *thing ) {
+    if( r != expected ) {
+        fprintf(stderr, "%s: %s, expected %s\n", thing,
+                ach_result_to_string(r), ach_result_to_string(expected));
+        exit(-1);
+    }
+}
+
+static void check( bool ok, const char *thing ) {
+    if( !ok ) {
+        fprintf(stderr, "%s failed\n", thing);
+        exit(-1);
+    }
+}
+
+/* A frame that is not the size of a T is refused without touching
+ * the caller's T */
+static void test_short_frame() {
+    ach_unlink( CHAN_NAME );
+    test( ach_create( CHAN_NAME, 16, 64, NULL ), ACH_OK, "ach_create" );
+    {
+        ach::channel<point> c( CHAN_NAME );
+        point p(0, 0);
+        int v = 5;
+
+        test( c.put( point(1, 2) ), ACH_OK, "put" );
+        test( c.get( p, 0 ), ACH_OK, "get" );
+        check( 1 == p.x && 2 == p.y, "get value" );
+
+        test( ach_put( c.handle(), &v, sizeof(v) ), ACH_OK, "ach_put short" );
+        p = point(7, 7);
+        test( c.get( p, 0 ), ACH_OVERFLOW, "get short" );
+        check( 7 == p.x && 7 == p.y, "get short unchanged" );
+
+        test( ach_put( c.handle(), &v, sizeof(v) ), ACH_OK, "ach_put short" );
+        test( c.latest( p ), ACH_OVERFLOW, "latest short" );
+        check( 7 == p.x && 7 == p.y, "latest short unchanged" );
+
+        /* other channels are viewed through a copy */
+        test( c.put( point(3, 4) ), ACH_OK, "put" );
+        int seen = 0;
+        test( c.view( [&]( const point &q ) { seen = q.x * 10 + q.y; } ),
+              ACH_OK, "view" );
+        check( 34 == seen, "view value" );
+    }
+    test( ach_unlink( CHAN_NAME ), ACH_OK, "ach_unlink" );
+}
+
+/* Fixed-size channels are viewed in place */
+static void test_fixed() {
+    ach_unlink( CHAN_NAME );
+    ach::channel<point>::create( CHAN_NAME, 8 );
+    {
+        ach::channel<point> c( CHAN_NAME );
+        point p(0, 0);
+        int seen = 0;
+
+        test( c.put( point(5, 6) ), ACH_OK, "put fixed" );
+        test( c.view( [&]( const point &q ) { seen = q.x * 10 + q.y; } ),
+              ACH_OK, "view fixed" );
+        check( 56 == seen, "view fixed value" );
+        test( c.latest( p ), ACH_STALE_FRAMES, "latest fixed" );
+        test( c.put( point(7, 8) ), ACH_OK, "put fixed" );
+        test( c.latest( p ), ACH_OK, "latest fixed" );
+        check( 7 == p.x && 8 == p.y, "latest fixed value" );
+
+        /* a throwing f leaves the channel unlocked */
+        bool caught = false;
+        test( c.put( point(1, 1) ), ACH_OK, "put fixed" );
+        try {
+            c.view( []( const point & ) { throw std::runtime_error("view"); } );
+        } catch( const std::runtime_error & ) {
+            caught = true;
+        }
+        check( caught, "view exception" );
+        test( c.put( point(9, 9) ), ACH_OK, "put after exception" );
+        test( c.latest( p ), ACH_OK, "latest after exception" );
+        check( 9 == p.x && 9 == p.y, "latest after exception value" );
+    }
+    test( ach_unlink( CHAN_NAME ), ACH_OK, "ach_unlink" );
+}
+
+/* A T aligned past the slots is still viewed aligned */
+struct alignas(32) wide {
+    double v[4];
+};
+
+static void test_aligned() {
+    ach_unlink( CHAN_NAME );
+    ach::channel<wide>::create( CHAN_NAME, 8 );
+    {
+        ach::channel<wide> c( CHAN_NAME );
+        wide w;
+        bool aligned = false;
+        int i;
+        for( i = 0; i < 3; i ++ ) {
+            w.v[0] = i;
+            test( c.put( w ), ACH_OK, "put wide" );
+            test( c.view( [&]( const wide &q ) {
+                        aligned = (0 == reinterpret_cast<uintptr_t>(&q) % alignof(wide)) &&
+                            i == q.v[0];
+                    } ),
+                ACH_OK, "view wide" );
+            check( aligned, "view wide aligned" );
+        }
+    }
+    test( ach_unlink( CHAN_NAME ), ACH_OK, "ach_unlink" );
+}
+
+/* Opening a missing channel throws */
+static void test_error() {
+    ach_unlink( CHAN_NAME );
+    try {
+        ach::channel<point> c( CHAN_NAME );
+    } catch( const ach::error &e ) {
+        test( e.status, ACH_ENOENT, "open missing" );
+        return;
+    }
+    check( false, "open missing throws" );
+}
+
+int main( void ) {
+    test_short_frame();
+    test_fixed();
+    test_aligned();
+    test_error();
+    printf("hpp ok\n");
+    return 0;
+}
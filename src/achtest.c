@@ -50,10 +50,12 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <sched.h>
 #include <pthread.h>
 #include <stdio.h>
 #include "ach.h"
+#include "ach_inline.h"
 
 #define OPT_CHAN  "ach-test"
 
@@ -226,6 +228,1502 @@ int test_basic() {
     return 0;
 }
 
+int test_seq() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    r = ach_create(opt_channel_name, 16ul, 64ul, NULL );
+    test(r, "ach_create");
+
+    ach_channel_t chan;
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    uint64_t oldest, newest;
+    int s, p;
+    size_t frame_size;
+
+    /* empty range */
+    r = ach_seq_range( &chan, &oldest, &newest );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("empty seq range failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    for( p = 1; p <= 40; p ++ ) {
+        r = ach_put( &chan, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+
+    /* only the last 16 are retained */
+    r = ach_seq_range( &chan, &oldest, &newest );
+    test(r, "ach_seq_range");
+    if( 25 != oldest || 40 != newest ) {
+        printf("wrong seq range: %"PRIu64" - %"PRIu64"\n", oldest, newest);
+        exit(-1);
+    }
+
+    /* in range */
+    for( p = 25; p <= 40; p ++ ) {
+        r = ach_get_seq( &chan, (uint64_t)p, &s, sizeof(s), &frame_size );
+        test(r, "ach_get_seq");
+        if( frame_size != sizeof(s) || s != p ) {
+            printf("wrong frame for seq %d: %d\n", p, s);
+            exit(-1);
+        }
+    }
+
+    /* evicted */
+    r = ach_get_seq( &chan, 24, &s, sizeof(s), &frame_size );
+    if( ACH_MISSED_FRAME != r ) {
+        printf("get evicted seq failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* not yet published */
+    r = ach_get_seq( &chan, 41, &s, sizeof(s), &frame_size );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("get future seq failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* random access leaves the handle alone */
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_MISSED_FRAME != r || 25 != s ) {
+        printf("get after seq failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* seek back into the retained frames */
+    r = ach_seek( &chan, 30 );
+    test(r, "ach_seek");
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_OK != r || 31 != s ) {
+        printf("get after seek failed: %s, %d\n", ach_result_to_string(r), s);
+        exit(-1);
+    }
+
+    /* seek past evicted frames */
+    r = ach_seek( &chan, 10 );
+    if( ACH_MISSED_FRAME != r ) {
+        printf("seek evicted failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_MISSED_FRAME != r || 25 != s ) {
+        printf("get after evicted seek failed: %s, %d\n", ach_result_to_string(r), s);
+        exit(-1);
+    }
+
+    /* seek to the end */
+    r = ach_seek( &chan, 40 );
+    test(r, "ach_seek");
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("get after end seek failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_seek( &chan, 41 );
+    if( ACH_EINVAL != r ) {
+        printf("seek future failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "seq ok\n");
+    return 0;
+}
+
+int test_window() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    r = ach_create(opt_channel_name, 16ul, 64ul, NULL );
+    test(r, "ach_create");
+
+    ach_channel_t chan;
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    int p, s[16];
+    ach_frame_info_t info[16];
+    size_t frame_cnt, frame_bytes;
+
+    /* empty channel */
+    r = ach_get_window( &chan, NULL, NULL, s, sizeof(s), info, 16,
+                        &frame_cnt, &frame_bytes );
+    if( ACH_STALE_FRAMES != r || 0 != frame_cnt ) {
+        printf("empty window failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    for( p = 1; p <= 10; p ++ ) {
+        r = ach_put( &chan, &p, sizeof(p) );
+        test(r, "ach_put");
+        usleep(1000);
+    }
+
+    /* everything */
+    r = ach_get_window( &chan, NULL, NULL, s, sizeof(s), info, 16,
+                        &frame_cnt, &frame_bytes );
+    test(r, "ach_get_window");
+    if( 10 != frame_cnt || 10*sizeof(int) != frame_bytes ) {
+        printf("wrong full window: %"PRIuPTR"\n", frame_cnt);
+        exit(-1);
+    }
+
+    /* a slice, by the recorded times */
+    struct timespec t0 = info[3].time, t1 = info[6].time;
+    r = ach_get_window( &chan, &t0, &t1, s, sizeof(s), info, 16,
+                        &frame_cnt, &frame_bytes );
+    test(r, "ach_get_window");
+    if( 4 != frame_cnt || 4 != s[0] || 7 != s[3] ||
+        4 != info[0].seq_num || 3*sizeof(int) != info[3].offset ) {
+        printf("wrong window slice: %"PRIuPTR"\n", frame_cnt);
+        exit(-1);
+    }
+
+    /* too small */
+    r = ach_get_window( &chan, &t0, &t1, s, sizeof(s), info, 2,
+                        &frame_cnt, &frame_bytes );
+    if( ACH_OVERFLOW != r || 4 != frame_cnt ) {
+        printf("window overflow failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "window ok\n");
+    return 0;
+}
+
+int test_reliable() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.reliable = 1;
+    r = ach_create(opt_channel_name, 4ul, 64ul, &attr );
+    test(r, "ach_create");
+
+    ach_channel_t pub, sub;
+    r = ach_open(&pub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_open(&sub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_subscribe(&sub);
+    test(r, "ach_subscribe");
+
+    int p, s;
+    size_t frame_size;
+
+    for( p = 1; p <= 4; p ++ ) {
+        r = ach_put( &pub, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+
+    /* full, subscriber has read nothing */
+    r = ach_put( &pub, &p, sizeof(p) );
+    if( ACH_EAGAIN != r ) {
+        printf("put to full reliable channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    struct timespec abstime;
+    clock_gettime( ACH_DEFAULT_CLOCK, &abstime );
+    abstime.tv_nsec += 10*1000*1000;
+    if( abstime.tv_nsec >= 1000*1000*1000 ) {
+        abstime.tv_nsec -= 1000*1000*1000;
+        abstime.tv_sec ++;
+    }
+    r = ach_put_wait( &pub, &p, sizeof(p), &abstime );
+    if( ACH_TIMEOUT != r ) {
+        printf("put_wait to full reliable channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* reading one frame makes room for one */
+    r = ach_get( &sub, &s, sizeof(s), &frame_size, NULL, 0 );
+    test(r, "ach_get");
+    if( 1 != s ) {
+        printf("reliable get wrong frame: %d\n", s);
+        exit(-1);
+    }
+    r = ach_put( &pub, &p, sizeof(p) );
+    test(r, "ach_put");
+    p++;
+    r = ach_put( &pub, &p, sizeof(p) );
+    if( ACH_EAGAIN != r ) {
+        printf("put to refilled reliable channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* nothing missed */
+    for( p = 2; p <= 5; p ++ ) {
+        r = ach_get( &sub, &s, sizeof(s), &frame_size, NULL, 0 );
+        test(r, "ach_get");
+        if( p != s ) {
+            printf("reliable get wrong frame: %d, wanted %d\n", s, p);
+            exit(-1);
+        }
+    }
+
+    /* no subscribers, no backpressure */
+    r = ach_unsubscribe(&sub);
+    test(r, "ach_unsubscribe");
+    for( p = 0; p < 8; p ++ ) {
+        r = ach_put( &pub, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+
+    r = ach_close(&sub);
+    test(r, "ach_close");
+    r = ach_close(&pub);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "reliable ok\n");
+    return 0;
+}
+
+int test_ref() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.reliable = 1;
+    r = ach_create(opt_channel_name, 4ul, 64ul, &attr );
+    test(r, "ach_create");
+
+    ach_channel_t pub, sub;
+    r = ach_open(&pub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_open(&sub, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    uint8_t buf[100], out[100];
+    ach_frame_ref_t ref;
+
+    /* only safe for subscribers */
+    r = ach_get_ref( &sub, &ref, NULL, 0 );
+    if( ACH_EINVAL != r ) {
+        printf("ref unsubscribed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_subscribe(&sub);
+    test(r, "ach_subscribe");
+    r = ach_get_ref( &sub, &ref, NULL, 0 );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("ref empty: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* 256 data bytes, so the third frame wraps */
+    int i;
+    for( i = 0; i < 3; i ++ ) {
+        memset( buf, 'a' + i, sizeof(buf) );
+        r = ach_put( &pub, buf, sizeof(buf) );
+        if( 2 == i ) {
+            /* the referenced frames are still unread */
+            if( ACH_EAGAIN != r ) {
+                printf("put over referenced frames: %s\n", ach_result_to_string(r));
+                exit(-1);
+            }
+            r = ach_get_ref( &sub, &ref, NULL, 0 );
+            test(r, "ach_get_ref");
+            r = ach_seek( &sub, ref.seq_num );
+            test(r, "ach_seek");
+            r = ach_get_ref( &sub, &ref, NULL, 0 );
+            test(r, "ach_get_ref");
+            r = ach_seek( &sub, ref.seq_num );
+            test(r, "ach_seek");
+            r = ach_put( &pub, buf, sizeof(buf) );
+        }
+        test(r, "ach_put");
+    }
+
+    r = ach_get_ref( &sub, &ref, NULL, 0 );
+    test(r, "ach_get_ref");
+    if( 3 != ref.seq_num || 0 == ref.size[1] || sizeof(out) != ref.size[0] + ref.size[1] ) {
+        printf("ref not wrapped: %"PRIuPTR" + %"PRIuPTR"\n", ref.size[0], ref.size[1]);
+        exit(-1);
+    }
+    memcpy( out, ref.data[0], ref.size[0] );
+    memcpy( out + ref.size[0], ref.data[1], ref.size[1] );
+    if( memcmp( out, buf, sizeof(out) ) ) {
+        printf("ref wrong data\n");
+        exit(-1);
+    }
+    /* the handle did not move */
+    size_t frame_size;
+    r = ach_get( &sub, out, sizeof(out), &frame_size, NULL, 0 );
+    test(r, "ach_get");
+    if( sizeof(out) != frame_size || 'c' != out[0] ) {
+        printf("get after ref wrong frame\n");
+        exit(-1);
+    }
+
+    r = ach_close(&sub);
+    test(r, "ach_close");
+    r = ach_close(&pub);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "ref ok\n");
+    return 0;
+}
+
+int test_subs() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.sub_cnt = 2;
+    r = ach_create(opt_channel_name, 4ul, 64ul, &attr );
+    test(r, "ach_create");
+
+    ach_channel_t pub, sub;
+    r = ach_open(&pub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_open(&sub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_subscribe(&sub);
+    test(r, "ach_subscribe");
+
+    /* a subscriber that dies without unsubscribing */
+    pid_t pid = fork();
+    if( 0 == pid ) {
+        ach_channel_t dead;
+        r = ach_open(&dead, opt_channel_name, NULL);
+        test(r, "ach_open");
+        r = ach_subscribe(&dead);
+        test(r, "ach_subscribe");
+        _exit(0);
+    } else if( pid < 0 ) {
+        perror("fork");
+        exit(-1);
+    }
+    waitpid( pid, NULL, 0 );
+
+    int p, s;
+    size_t frame_size;
+    for( p = 1; p <= 10; p ++ ) {
+        r = ach_put( &pub, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+
+    /* frames 1 through 6 were overwritten */
+    r = ach_get( &sub, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_MISSED_FRAME != r || 7 != s ) {
+        printf("subs get failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    ach_sub_t subs[2];
+    size_t n;
+    uint64_t last_seq;
+    r = ach_get_subs( &pub, subs, 2, &n, &last_seq );
+    test(r, "ach_get_subs");
+    if( 1 != n || getpid() != subs[0].pid ||
+        7 != subs[0].seq_num || 6 != subs[0].missed ||
+        3 != last_seq - subs[0].seq_num ) {
+        printf("wrong subs: %"PRIuPTR"\n", n);
+        exit(-1);
+    }
+
+    /* skipping 8 and 9 misses them, re-reading 10 misses nothing */
+    r = ach_get( &sub, &s, sizeof(s), &frame_size, NULL, ACH_O_LAST );
+    if( ACH_MISSED_FRAME != r || 10 != s ) {
+        printf("subs get last failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_get( &sub, &s, sizeof(s), &frame_size, NULL, ACH_O_LAST | ACH_O_COPY );
+    if( ACH_OK != r || 10 != s ) {
+        printf("subs copy failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_get_subs( &pub, subs, 2, &n, &last_seq );
+    test(r, "ach_get_subs");
+    if( 1 != n || 10 != subs[0].seq_num || 8 != subs[0].missed ) {
+        printf("wrong subs after copy: missed %"PRIu64"\n", subs[0].missed);
+        exit(-1);
+    }
+
+    r = ach_close(&sub);
+    test(r, "ach_close");
+    r = ach_get_subs( &pub, subs, 2, &n, &last_seq );
+    test(r, "ach_get_subs");
+    if( 0 != n ) {
+        printf("subs left after close: %"PRIuPTR"\n", n);
+        exit(-1);
+    }
+
+    r = ach_close(&pub);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "subs ok\n");
+    return 0;
+}
+
+int test_fixed() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.fixed_size = 1;
+    r = ach_create(opt_channel_name, 4ul, 10ul, &attr );
+    test(r, "ach_create");
+
+    ach_channel_t chan;
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    char buf[32];
+    size_t frame_size;
+    int p;
+
+    /* bigger than the (aligned) slot */
+    memset( buf, 0, sizeof(buf) );
+    r = ach_put( &chan, buf, 17 );
+    if( ACH_OVERFLOW != r ) {
+        printf("fixed put too big: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    for( p = 1; p <= 10; p ++ ) {
+        memset( buf, p, (size_t)p );
+        r = ach_put( &chan, buf, (size_t)p );
+        test(r, "ach_put");
+    }
+
+    r = ach_get( &chan, buf, sizeof(buf), &frame_size, NULL, 0 );
+    if( ACH_MISSED_FRAME != r || 7 != frame_size || 7 != buf[6] ) {
+        printf("fixed get failed: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    for( p = 8; p <= 10; p ++ ) {
+        r = ach_get( &chan, buf, sizeof(buf), &frame_size, NULL, 0 );
+        test(r, "ach_get");
+        if( (size_t)p != frame_size || p != buf[0] || p != buf[p-1] ) {
+            printf("fixed get wrong frame %d\n", p);
+            exit(-1);
+        }
+    }
+    r = ach_get_seq( &chan, 9, buf, sizeof(buf), &frame_size );
+    test(r, "ach_get_seq");
+    if( 9 != frame_size || 9 != buf[8] ) {
+        printf("fixed get_seq wrong frame\n");
+        exit(-1);
+    }
+
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "fixed ok\n");
+    return 0;
+}
+
+int test_resize() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    r = ach_create(opt_channel_name, 4ul, 8ul, NULL );
+    test(r, "ach_create");
+
+    ach_channel_t pub, sub;
+    r = ach_open(&pub, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_open(&sub, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    int p, s[16];
+    size_t frame_size;
+    for( p = 1; p <= 6; p ++ ) {
+        r = ach_put( &pub, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+    r = ach_get( &sub, s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_MISSED_FRAME != r || 3 != s[0] ) {
+        printf("resize: wrong frame before resize: %d\n", s[0]);
+        exit(-1);
+    }
+
+    /* too big for the channel */
+    memset( s, 0, sizeof(s) );
+    r = ach_put( &pub, s, sizeof(s) );
+    if( ACH_OVERFLOW != r ) {
+        printf("resize: big put before resize: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* no shrinking */
+    r = ach_resize( &pub, 2ul, 8ul );
+    if( ACH_EINVAL != r ) {
+        printf("resize: shrink: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    r = ach_resize( &pub, 16ul, 64ul );
+    test(r, "ach_resize");
+
+    /* now it fits */
+    s[15] = 7;
+    r = ach_put( &pub, s, sizeof(s) );
+    test(r, "ach_put");
+
+    /* the subscriber picks up where it left off */
+    for( p = 4; p <= 7; p ++ ) {
+        r = ach_get( &sub, s, sizeof(s), &frame_size, NULL, 0 );
+        test(r, "ach_get");
+        if( (7 == p) ? (sizeof(s) != frame_size || 7 != s[15]) : p != s[0] ) {
+            printf("resize: wrong frame after resize: %d\n", p);
+            exit(-1);
+        }
+    }
+
+    uint64_t oldest, newest;
+    r = ach_seq_range( &sub, &oldest, &newest );
+    test(r, "ach_seq_range");
+    if( 3 != oldest || 7 != newest ) {
+        printf("resize: wrong range %"PRIu64" - %"PRIu64"\n", oldest, newest);
+        exit(-1);
+    }
+
+    r = ach_close(&sub);
+    test(r, "ach_close");
+    r = ach_close(&pub);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "resize ok\n");
+    return 0;
+}
+
+int test_dedup() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.dedup = 1;
+    r = ach_create(opt_channel_name, 4ul, 6ul, &attr );
+    test(r, "ach_create");
+
+    ach_channel_t chan;
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    int p, s;
+    size_t frame_size;
+    uint64_t oldest, newest;
+    ach_frame_info_t info[4];
+    size_t frame_cnt, frame_bytes;
+    struct timespec t0;
+
+    /* offset by a short frame so the last int wraps around the data area */
+    int16_t h = 0;
+    r = ach_put( &chan, &h, sizeof(h) );
+    test(r, "ach_put");
+    for( p = 1; p <= 6; p ++ ) {
+        r = ach_put( &chan, &p, sizeof(p) );
+        test(r, "ach_put");
+    }
+    r = ach_flush( &chan );
+    test(r, "ach_flush");
+    clock_gettime( ACH_DEFAULT_CLOCK, &t0 );
+    usleep(1000);
+
+    /* same again, no new frame */
+    p = 6;
+    r = ach_put( &chan, &p, sizeof(p) );
+    test(r, "ach_put");
+    r = ach_seq_range( &chan, &oldest, &newest );
+    test(r, "ach_seq_range");
+    if( 7 != newest ) {
+        printf("dedup put made a frame: %"PRIu64"\n", newest);
+        exit(-1);
+    }
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("dedup get: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* but it was refreshed */
+    int ss[4];
+    r = ach_get_window( &chan, &t0, NULL, ss, sizeof(ss), info, 4,
+                        &frame_cnt, &frame_bytes );
+    test(r, "ach_get_window");
+    if( 1 != frame_cnt || 7 != info[0].seq_num || 6 != ss[0] ) {
+        printf("dedup not refreshed\n");
+        exit(-1);
+    }
+
+    /* different frame */
+    p = 7;
+    r = ach_put( &chan, &p, sizeof(p) );
+    test(r, "ach_put");
+    r = ach_get( &chan, &s, sizeof(s), &frame_size, NULL, 0 );
+    test(r, "ach_get");
+    if( 7 != s ) {
+        printf("dedup wrong frame: %d\n", s);
+        exit(-1);
+    }
+
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "dedup ok\n");
+    return 0;
+}
+
+static void check_patch( ach_channel_t *chan, size_t len, uint64_t seq ) {
+    char buf[256];
+    size_t frame_size, n, i;
+    ach_range_t ranges[4];
+    ach_patch_t patch[2] = { {10, 4, "abcd"}, {len-2, 2, "xy"} };
+
+    ach_status_t r = ach_put_patch( chan, patch, 2 );
+    test(r, "ach_put_patch");
+    r = ach_get_seq( chan, seq, buf, sizeof(buf), &frame_size );
+    test(r, "ach_get_seq");
+    if( len != frame_size || 0 != memcmp(buf+10, "abcd", 4) ||
+        0 != memcmp(buf+len-2, "xy", 2) || 'z' != buf[0] || 'z' != buf[14] ) {
+        printf("patched frame wrong\n");
+        exit(-1);
+    }
+    for( i = 0; i < len; i ++ ) {
+        if( (i >= 10 && i < 14) || i >= len-2 ) continue;
+        if( 'z' != buf[i] ) {
+            printf("patched frame wrong at %"PRIuPTR"\n", i);
+            exit(-1);
+        }
+    }
+    r = ach_get_ranges( chan, seq, ranges, 4, &n );
+    test(r, "ach_get_ranges");
+    if( 2 != n || 10 != ranges[0].offset || 4 != ranges[0].size ||
+        len-2 != ranges[1].offset || 2 != ranges[1].size ) {
+        printf("patch ranges wrong\n");
+        exit(-1);
+    }
+    r = ach_get_ranges( chan, seq, ranges, 1, &n );
+    if( ACH_OVERFLOW != r || 2 != n ) {
+        printf("patch ranges overflow: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+}
+
+int test_patch() {
+    size_t k;
+    for( k = 0; k < 3; k ++ ) {
+        ach_status_t r = ach_unlink(opt_channel_name);
+        if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+            fprintf(stderr, "ach_unlink failed\n: %s",
+                    ach_result_to_string(r));
+            return -1;
+        }
+        /* room for copying in place, a single frame that must be
+         * staged, and fixed-size slots */
+        ach_create_attr_t attr;
+        ach_create_attr_init( &attr );
+        size_t cnt = 8, size = 64, len = 150;
+        if( 1 == k ) { cnt = 2; size = 100; }
+        if( 2 == k ) { attr.fixed_size = 1; cnt = 4; size = 100; len = 64; }
+        r = ach_create(opt_channel_name, cnt, size, &attr );
+        test(r, "ach_create");
+
+        ach_channel_t chan;
+        r = ach_open(&chan, opt_channel_name, NULL);
+        test(r, "ach_open");
+
+        ach_range_t ranges[4];
+        size_t n;
+        char buf[256];
+
+        r = ach_put_patch( &chan, NULL, 0 );
+        if( ACH_STALE_FRAMES != r ) {
+            printf("patch empty channel: %s\n", ach_result_to_string(r));
+            exit(-1);
+        }
+
+        memset( buf, 'z', sizeof(buf) );
+        r = ach_put( &chan, buf, len );
+        test(r, "ach_put");
+        r = ach_get_ranges( &chan, 1, ranges, 4, &n );
+        test(r, "ach_get_ranges");
+        if( 1 != n || 0 != ranges[0].offset || len != ranges[0].size ) {
+            printf("whole frame range wrong\n");
+            exit(-1);
+        }
+
+        ach_patch_t bad = { len-1, 2, "xy" };
+        r = ach_put_patch( &chan, &bad, 1 );
+        if( ACH_EINVAL != r ) {
+            printf("patch past end: %s\n", ach_result_to_string(r));
+            exit(-1);
+        }
+
+        check_patch( &chan, len, 2 );
+
+        /* growing the channel keeps the changed ranges */
+        r = ach_resize( &chan, cnt*2, size*2 );
+        test(r, "ach_resize");
+        r = ach_get_ranges( &chan, 2, ranges, 4, &n );
+        test(r, "ach_get_ranges");
+        if( 2 != n || 10 != ranges[0].offset || 4 != ranges[0].size ||
+            len-2 != ranges[1].offset || 2 != ranges[1].size ) {
+            printf("patch ranges lost by resize\n");
+            exit(-1);
+        }
+
+        r = ach_close(&chan);
+        test(r, "ach_close");
+        r = ach_unlink(opt_channel_name);
+        test(r, "ach_unlink");
+    }
+
+    /* a dead subscriber of a reliable channel doesn't block patches */
+    {
+        ach_create_attr_t attr;
+        ach_create_attr_init( &attr );
+        attr.reliable = 1;
+        ach_status_t r = ach_create(opt_channel_name, 2ul, 64ul, &attr );
+        test(r, "ach_create");
+        ach_channel_t chan;
+        r = ach_open(&chan, opt_channel_name, NULL);
+        test(r, "ach_open");
+        pid_t pid = fork();
+        if( 0 == pid ) {
+            ach_channel_t dead;
+            r = ach_open(&dead, opt_channel_name, NULL);
+            test(r, "ach_open");
+            r = ach_subscribe(&dead);
+            test(r, "ach_subscribe");
+            _exit(0);
+        } else if( pid < 0 ) {
+            perror("fork");
+            exit(-1);
+        }
+        waitpid( pid, NULL, 0 );
+        int x = 1;
+        r = ach_put( &chan, &x, sizeof(x) );
+        test(r, "ach_put");
+        r = ach_put( &chan, &x, sizeof(x) );
+        test(r, "ach_put");
+        ach_patch_t patch = { 0, 1, "y" };
+        r = ach_put_patch( &chan, &patch, 1 );
+        test(r, "ach_put_patch dead subscriber");
+        r = ach_close(&chan);
+        test(r, "ach_close");
+        r = ach_unlink(opt_channel_name);
+        test(r, "ach_unlink");
+    }
+
+    fprintf(stderr, "patch ok\n");
+    return 0;
+}
+
+int test_snapshot() {
+    char name_b[ACH_CHAN_NAME_MAX];
+    snprintf( name_b, sizeof(name_b), "%s-b", opt_channel_name );
+    const char *names[2] = {opt_channel_name, name_b};
+    ach_channel_t chan[2];
+    ach_status_t r;
+    size_t i;
+
+    for( i = 0; i < 2; i ++ ) {
+        r = ach_unlink(names[i]);
+        if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+            fprintf(stderr, "ach_unlink failed\n: %s",
+                    ach_result_to_string(r));
+            return -1;
+        }
+        r = ach_create(names[i], 16ul, 64ul, NULL );
+        test(r, "ach_create");
+        r = ach_open(&chan[i], names[i], NULL);
+        test(r, "ach_open");
+    }
+
+    int a = 1, b = 10;
+    r = ach_put( &chan[0], &a, sizeof(a) );
+    test(r, "ach_put");
+    r = ach_put( &chan[1], &b, sizeof(b) );
+    test(r, "ach_put");
+
+    int s[2];
+    ach_snapshot_t snap[2];
+    memset( snap, 0, sizeof(snap) );
+    /* in reverse name order */
+    for( i = 0; i < 2; i ++ ) {
+        snap[i].chan = &chan[1-i];
+        snap[i].buf = &s[i];
+        snap[i].size = sizeof(s[i]);
+    }
+    r = ach_get_snapshot( snap, 2, 0 );
+    test(r, "ach_get_snapshot");
+    if( 10 != s[0] || 1 != s[1] || ACH_OK != snap[0].result ) {
+        printf("snapshot wrong: %d %d\n", s[0], s[1]);
+        exit(-1);
+    }
+
+    /* nothing new in one */
+    a = 2;
+    r = ach_put( &chan[0], &a, sizeof(a) );
+    test(r, "ach_put");
+    r = ach_get_snapshot( snap, 2, 0 );
+    if( ACH_STALE_FRAMES != r || ACH_STALE_FRAMES != snap[0].result ||
+        ACH_OK != snap[1].result || 2 != s[1] ) {
+        printf("snapshot stale: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* the same channel twice */
+    snap[1].chan = &chan[1];
+    r = ach_get_snapshot( snap, 2, ACH_O_COPY );
+    if( ACH_EINVAL != r ) {
+        printf("snapshot repeated channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    snap[1].chan = &chan[0];
+
+    /* ...even through a second handle */
+    ach_channel_t again;
+    r = ach_open(&again, names[0], NULL);
+    test(r, "ach_open");
+    snap[0].chan = &again;
+    r = ach_get_snapshot( snap, 2, ACH_O_COPY );
+    if( ACH_EINVAL != r ) {
+        printf("snapshot reopened channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    snap[0].chan = &chan[1];
+    r = ach_close(&again);
+    test(r, "ach_close");
+
+    /* distinct anonymous channels may share a name */
+    ach_channel_t anon[2];
+    ach_snapshot_t anon_snap[2];
+    int t[2];
+    memset( anon_snap, 0, sizeof(anon_snap) );
+    for( i = 0; i < 2; i ++ ) {
+        ach_create_attr_t cattr;
+        ach_attr_t attr;
+        ach_create_attr_init(&cattr);
+        cattr.map_anon = 1;
+        r = ach_create("anon", 4ul, sizeof(int), &cattr );
+        test(r, "ach_create");
+        ach_attr_init(&attr);
+        attr.map_anon = 1;
+        attr.shm = cattr.shm;
+        r = ach_open(&anon[i], "anon", &attr);
+        test(r, "ach_open");
+        int v = (int)i + 20;
+        r = ach_put( &anon[i], &v, sizeof(v) );
+        test(r, "ach_put");
+        anon_snap[i].chan = &anon[i];
+        anon_snap[i].buf = &t[i];
+        anon_snap[i].size = sizeof(t[i]);
+    }
+    r = ach_get_snapshot( anon_snap, 2, 0 );
+    test(r, "ach_get_snapshot anon");
+    if( 20 != t[0] || 21 != t[1] ) {
+        printf("anon snapshot wrong: %d %d\n", t[0], t[1]);
+        exit(-1);
+    }
+    for( i = 0; i < 2; i ++ ) {
+        r = ach_close(&anon[i]);
+        test(r, "ach_close");
+    }
+
+    /* a publisher always puts a then b, so a snapshot never sees b ahead */
+    a = b = -1;
+    r = ach_put( &chan[0], &a, sizeof(a) );
+    test(r, "ach_put");
+    r = ach_put( &chan[1], &b, sizeof(b) );
+    test(r, "ach_put");
+    pid_t pid = fork();
+    if( 0 == pid ) {
+        int k;
+        for( k = 0; k < 20000; k ++ ) {
+            ach_put( &chan[0], &k, sizeof(k) );
+            ach_put( &chan[1], &k, sizeof(k) );
+        }
+        _exit(0);
+    } else if( pid < 0 ) {
+        perror("fork");
+        exit(-1);
+    }
+    int k;
+    for( k = 0; k < 20000; k ++ ) {
+        r = ach_get_snapshot( snap, 2, ACH_O_COPY );
+        if( ACH_OK != r && ACH_MISSED_FRAME != r ) test(r, "ach_get_snapshot");
+        if( s[1] != s[0] && s[1] != s[0] + 1 ) {
+            printf("inconsistent snapshot: a %d, b %d\n", s[1], s[0]);
+            exit(-1);
+        }
+    }
+    waitpid( pid, NULL, 0 );
+
+    for( i = 0; i < 2; i ++ ) {
+        r = ach_close(&chan[i]);
+        test(r, "ach_close");
+        r = ach_unlink(names[i]);
+        test(r, "ach_unlink");
+    }
+
+    fprintf(stderr, "snapshot ok\n");
+    return 0;
+}
+
+int test_group() {
+    char name_b[ACH_CHAN_NAME_MAX];
+    snprintf( name_b, sizeof(name_b), "%s-b", opt_channel_name );
+    const char *names[2] = {opt_channel_name, name_b};
+    ach_channel_t chan[2];
+    ach_status_t r;
+    size_t i;
+
+    for( i = 0; i < 2; i ++ ) {
+        r = ach_unlink(names[i]);
+        if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+            fprintf(stderr, "ach_unlink failed\n: %s",
+                    ach_result_to_string(r));
+            return -1;
+        }
+        r = ach_create(names[i], 16ul, 64ul, NULL );
+        test(r, "ach_create");
+        r = ach_open(&chan[i], names[i], NULL);
+        test(r, "ach_open");
+    }
+
+    int k, s[2];
+    char big[2048];
+    ach_put_item_t item[2];
+    uint64_t oldest, newest;
+
+    /* one put can't succeed, so neither happens */
+    memset( big, 0, sizeof(big) );
+    k = 1;
+    item[0].chan = &chan[0]; item[0].buf = &k;  item[0].len = sizeof(k);
+    item[1].chan = &chan[1]; item[1].buf = big; item[1].len = sizeof(big);
+    r = ach_put_group( item, 2 );
+    if( ACH_OVERFLOW != r ) {
+        printf("group overflow: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_seq_range( &chan[0], &oldest, &newest );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("group partly written\n");
+        exit(-1);
+    }
+
+    /* readers see whole groups */
+    item[1].buf = &k;
+    item[1].len = sizeof(k);
+    pid_t pid = fork();
+    if( 0 == pid ) {
+        for( k = 0; k < 20000; k ++ ) {
+            r = ach_put_group( item, 2 );
+            test(r, "ach_put_group");
+        }
+        _exit(0);
+    } else if( pid < 0 ) {
+        perror("fork");
+        exit(-1);
+    }
+
+    ach_snapshot_t snap[2];
+    memset( snap, 0, sizeof(snap) );
+    for( i = 0; i < 2; i ++ ) {
+        snap[i].chan = &chan[i];
+        snap[i].buf = &s[i];
+        snap[i].size = sizeof(s[i]);
+    }
+    for( k = 0; k < 20000; k ++ ) {
+        r = ach_get_snapshot( snap, 2, ACH_O_COPY );
+        if( ACH_STALE_FRAMES == r ) continue;
+        if( ACH_OK != r && ACH_MISSED_FRAME != r ) test(r, "ach_get_snapshot");
+        if( s[0] != s[1] ) {
+            printf("torn group: %d %d\n", s[0], s[1]);
+            exit(-1);
+        }
+    }
+    waitpid( pid, NULL, 0 );
+
+    /* two handles on one channel can't be locked together */
+    ach_channel_t again;
+    r = ach_open(&again, names[0], NULL);
+    test(r, "ach_open");
+    item[1].chan = &again;
+    r = ach_put_group( item, 2 );
+    if( ACH_EINVAL != r ) {
+        printf("group reopened channel: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_close(&again);
+    test(r, "ach_close");
+
+    for( i = 0; i < 2; i ++ ) {
+        r = ach_close(&chan[i]);
+        test(r, "ach_close");
+        r = ach_unlink(names[i]);
+        test(r, "ach_unlink");
+    }
+
+    /* a dead subscriber of a reliable channel doesn't block groups */
+    ach_create_attr_t attr;
+    ach_create_attr_init( &attr );
+    attr.reliable = 1;
+    r = ach_create(names[0], 2ul, 64ul, &attr );
+    test(r, "ach_create");
+    r = ach_open(&chan[0], names[0], NULL);
+    test(r, "ach_open");
+    pid = fork();
+    if( 0 == pid ) {
+        ach_channel_t dead;
+        r = ach_open(&dead, names[0], NULL);
+        test(r, "ach_open");
+        r = ach_subscribe(&dead);
+        test(r, "ach_subscribe");
+        _exit(0);
+    } else if( pid < 0 ) {
+        perror("fork");
+        exit(-1);
+    }
+    waitpid( pid, NULL, 0 );
+    item[0].chan = &chan[0];
+    for( k = 0; k < 3; k ++ ) {
+        r = ach_put_group( item, 1 );
+        test(r, "ach_put_group dead subscriber");
+    }
+    r = ach_close(&chan[0]);
+    test(r, "ach_close");
+    r = ach_unlink(names[0]);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "group ok\n");
+    return 0;
+}
+
+int test_memfd() {
+#ifdef HAVE_MEMFD_CREATE
+    ach_create_attr_t cattr;
+    ach_channel_t chan;
+    ach_status_t r;
+    int sv[2];
+
+    ach_create_attr_init(&cattr);
+    cattr.map_memfd = 1;
+    r = ach_create(opt_channel_name, 16ul, 64ul, &cattr );
+    test(r, "ach_create");
+
+    /* nothing in the shm namespace */
+    r = ach_open(&chan, opt_channel_name, NULL);
+    if( ACH_ENOENT != r ) {
+        printf("memfd channel is named: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) ) {
+        perror("socketpair");
+        exit(-1);
+    }
+    pid_t pid = fork();
+    if( 0 == pid ) {
+        int fd, k = 42;
+        close( sv[0] );
+        r = ach_recv_fd( sv[1], &fd );
+        test(r, "ach_recv_fd");
+        r = ach_open_fd( &chan, fd, NULL );
+        test(r, "ach_open_fd");
+        close( fd );
+        r = ach_put( &chan, &k, sizeof(k) );
+        test(r, "ach_put");
+        r = ach_close( &chan );
+        test(r, "ach_close");
+        _exit(0);
+    } else if( pid < 0 ) {
+        perror("fork");
+        exit(-1);
+    }
+    close( sv[1] );
+    r = ach_send_fd( sv[0], cattr.fd );
+    test(r, "ach_send_fd");
+    r = ach_open_fd( &chan, cattr.fd, NULL );
+    test(r, "ach_open_fd");
+    close( cattr.fd );
+    waitpid( pid, NULL, 0 );
+
+    int k = 0;
+    size_t frame_size;
+    r = ach_get( &chan, &k, sizeof(k), &frame_size, NULL, ACH_O_LAST );
+    test(r, "ach_get");
+    if( 42 != k ) {
+        printf("memfd frame wrong: %d\n", k);
+        exit(-1);
+    }
+
+    /* peer is gone */
+    r = ach_recv_fd( sv[0], &k );
+    if( ACH_CLOSED != r ) {
+        printf("ach_recv_fd on closed socket: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    close( sv[0] );
+    r = ach_open_fd( &chan, -1, NULL );
+    if( ACH_OK == r ) {
+        printf("ach_open_fd on bad fd\n");
+        exit(-1);
+    }
+
+    r = ach_close( &chan );
+    test(r, "ach_close");
+
+    fprintf(stderr, "memfd ok\n");
+#endif
+    return 0;
+}
+
+/* Puts frames whose words all hold the frame number */
+static void *anon_writer( void *cx ) {
+    ach_channel_t *chan = (ach_channel_t*)cx;
+    int32_t frame[16];
+    int32_t k;
+    size_t j;
+    for( k = 1; k <= 20000; k ++ ) {
+        for( j = 0; j < 16; j ++ ) frame[j] = k;
+        ach_status_t r = ach_put( chan, frame, sizeof(frame) );
+        test(r, "ach_put");
+    }
+    return NULL;
+}
+
+int test_anon() {
+    ach_create_attr_t cattr;
+    ach_attr_t attr;
+    ach_channel_t pub, sub;
+    ach_status_t r;
+    int32_t frame[16];
+    size_t frame_size, j;
+
+    ach_create_attr_init(&cattr);
+    cattr.map_anon = 1;
+    r = ach_create("anon", 8ul, sizeof(frame), &cattr );
+    test(r, "ach_create");
+    ach_attr_init(&attr);
+    attr.map_anon = 1;
+    attr.shm = cattr.shm;
+    r = ach_open(&pub, "anon", &attr);
+    test(r, "ach_open");
+    r = ach_open(&sub, "anon", &attr);
+    test(r, "ach_open");
+
+    r = ach_get( &sub, frame, sizeof(frame), &frame_size, NULL, ACH_O_LAST );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("anon empty get: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* lock-free gets never see a partly written frame */
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, anon_writer, &pub ) ) {
+        perror("pthread_create");
+        exit(-1);
+    }
+    int32_t last = 0;
+    while( last < 20000 ) {
+        r = ach_get( &sub, frame, sizeof(frame), &frame_size, NULL, ACH_O_LAST );
+        if( ACH_STALE_FRAMES == r ) continue;
+        if( ACH_OK != r && ACH_MISSED_FRAME != r ) test(r, "ach_get");
+        for( j = 1; j < 16; j ++ ) {
+            if( frame[j] != frame[0] ) {
+                printf("torn anon frame: %d %d\n", frame[0], frame[j]);
+                exit(-1);
+            }
+        }
+        if( frame[0] < last || (uint64_t)frame[0] != sub.seq_num ) {
+            printf("anon frame out of order: %d after %d\n", frame[0], last);
+            exit(-1);
+        }
+        last = frame[0];
+    }
+    pthread_join( thread, NULL );
+
+    r = ach_get( &sub, frame, 4, &frame_size, NULL, ACH_O_LAST | ACH_O_COPY );
+    if( ACH_OVERFLOW != r || sizeof(frame) != frame_size ) {
+        printf("anon overflow: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    /* the last close frees it */
+    r = ach_close(&pub);
+    test(r, "ach_close");
+    r = ach_close(&sub);
+    test(r, "ach_close");
+
+    fprintf(stderr, "anon ok\n");
+    return 0;
+}
+
+int test_inline() {
+    ach_create_attr_t cattr;
+    ach_attr_t attr;
+    ach_status_t r;
+    int k, x;
+    size_t frame_size, i;
+
+    /* fixed-size, variable-size and anonymous channels */
+    for( i = 0; i < 3; i ++ ) {
+        ach_channel_t chan;
+        ach_create_attr_init(&cattr);
+        ach_attr_init(&attr);
+        cattr.fixed_size = (0 == i || 2 == i);
+        cattr.map_anon = (2 == i);
+        if( ! cattr.map_anon ) {
+            r = ach_unlink(opt_channel_name);
+            if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+                fprintf(stderr, "ach_unlink failed\n: %s",
+                        ach_result_to_string(r));
+                return -1;
+            }
+        }
+        r = ach_create(opt_channel_name, 4ul, sizeof(int), &cattr );
+        test(r, "ach_create");
+        attr.map_anon = cattr.map_anon;
+        attr.shm = cattr.shm;
+        r = ach_open(&chan, opt_channel_name, &attr);
+        test(r, "ach_open");
+
+        r = ach_get_last_inline( &chan, &x, sizeof(x), &frame_size );
+        if( ACH_STALE_FRAMES != r ) {
+            printf("inline empty get: %s\n", ach_result_to_string(r));
+            exit(-1);
+        }
+        for( k = 1; k <= 6; k ++ ) {
+            r = ach_put_inline( &chan, &k, sizeof(k) );
+            test(r, "ach_put_inline");
+        }
+        r = ach_get_last_inline( &chan, &x, 1, &frame_size );
+        if( ACH_OVERFLOW != r || sizeof(x) != frame_size ) {
+            printf("inline overflow: %s\n", ach_result_to_string(r));
+            exit(-1);
+        }
+        r = ach_get_last_inline( &chan, &x, sizeof(x), &frame_size );
+        if( ACH_MISSED_FRAME != r || 6 != x || 6 != chan.seq_num ) {
+            printf("inline get: %s, %d\n", ach_result_to_string(r), x);
+            exit(-1);
+        }
+        r = ach_get_last_inline( &chan, &x, sizeof(x), &frame_size );
+        if( ACH_STALE_FRAMES != r ) {
+            printf("inline stale: %s\n", ach_result_to_string(r));
+            exit(-1);
+        }
+
+        /* the library sees inline puts */
+        k = 7;
+        r = ach_put_inline( &chan, &k, sizeof(k) );
+        test(r, "ach_put_inline");
+        r = ach_get( &chan, &x, sizeof(x), &frame_size, NULL, 0 );
+        if( ACH_OK != r || 7 != x ) {
+            printf("inline then get: %s, %d\n", ach_result_to_string(r), x);
+            exit(-1);
+        }
+        r = ach_put( &chan, &k, sizeof(k) );
+        test(r, "ach_put");
+        r = ach_get_last_inline( &chan, &x, sizeof(x), &frame_size );
+        test(r, "ach_get_last_inline");
+
+        r = ach_close(&chan);
+        test(r, "ach_close");
+    }
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "inline ok\n");
+    return 0;
+}
+
+static void view_int( void *cx, const void *frame, size_t size ) {
+    if( sizeof(int) == size ) memcpy( cx, frame, size );
+}
+
+int test_view() {
+    ach_create_attr_t cattr;
+    ach_channel_t chan;
+    ach_status_t r;
+    int k, x = 0;
+
+    r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    ach_create_attr_init(&cattr);
+    cattr.fixed_size = 1;
+    r = ach_create(opt_channel_name, 4ul, sizeof(int), &cattr );
+    test(r, "ach_create");
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    r = ach_get_view( &chan, view_int, &x, NULL, 0 );
+    if( ACH_STALE_FRAMES != r ) {
+        printf("view empty: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    for( k = 1; k <= 3; k ++ ) {
+        r = ach_put( &chan, &k, sizeof(k) );
+        test(r, "ach_put");
+    }
+    r = ach_get_view( &chan, view_int, &x, NULL, 0 );
+    if( ACH_OK != r || 1 != x ) {
+        printf("view next: %s, %d\n", ach_result_to_string(r), x);
+        exit(-1);
+    }
+    r = ach_get_view( &chan, view_int, &x, NULL, ACH_O_LAST );
+    if( ACH_MISSED_FRAME != r || 3 != x ) {
+        printf("view last: %s, %d\n", ach_result_to_string(r), x);
+        exit(-1);
+    }
+    r = ach_close(&chan);
+    test(r, "ach_close");
+
+    /* variable-size frames may be split */
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+    r = ach_create(opt_channel_name, 4ul, sizeof(int), NULL );
+    test(r, "ach_create");
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+    r = ach_put( &chan, &k, sizeof(k) );
+    test(r, "ach_put");
+    r = ach_get_view( &chan, view_int, &x, NULL, 0 );
+    if( ACH_EINVAL != r ) {
+        printf("view variable: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "view ok\n");
+    return 0;
+}
+
+struct test_buf {
+    char *data;
+    size_t max;
+};
+
+static void *test_buf_alloc( void *cx, size_t size ) {
+    struct test_buf *buf = (struct test_buf*)cx;
+    if( size > buf->max ) {
+        buf->data = (char*)realloc( buf->data, size );
+        buf->max = size;
+    }
+    return buf->data;
+}
+
+static void *test_null_alloc( void *cx, size_t size ) {
+    (void)cx; (void)size;
+    return NULL;
+}
+
+int test_alloc() {
+    ach_status_t r = ach_unlink(opt_channel_name);
+    if( ! (ACH_OK==r || ACH_ENOENT == r) ) {
+        fprintf(stderr, "ach_unlink failed\n: %s",
+                ach_result_to_string(r));
+        return -1;
+    }
+    r = ach_create(opt_channel_name, 8ul, 512ul, NULL );
+    test(r, "ach_create");
+
+    ach_channel_t chan;
+    r = ach_open(&chan, opt_channel_name, NULL);
+    test(r, "ach_open");
+
+    char big[2048];
+    size_t sizes[] = {4, 100, 2048};
+    size_t i, frame_size;
+    for( i = 0; i < 3; i ++ ) {
+        memset( big, (int)i+1, sizes[i] );
+        r = ach_put( &chan, big, sizes[i] );
+        test(r, "ach_put");
+    }
+
+    /* no memory, frame stays put */
+    r = ach_get_alloc( &chan, test_null_alloc, NULL, &frame_size, NULL, 0 );
+    if( ACH_OVERFLOW != r || 4 != frame_size ) {
+        printf("alloc null: %s\n", ach_result_to_string(r));
+        exit(-1);
+    }
+
+    struct test_buf buf = {NULL, 0};
+    for( i = 0; i < 3; i ++ ) {
+        r = ach_get_alloc( &chan, test_buf_alloc, &buf, &frame_size, NULL, 0 );
+        test(r, "ach_get_alloc");
+        if( sizes[i] != frame_size || sizes[i] > buf.max ||
+            (char)(i+1) != buf.data[sizes[i]-1] ) {
+            printf("alloc wrong frame %"PRIuPTR"\n", i);
+            exit(-1);
+        }
+    }
+    free( buf.data );
+
+    r = ach_close(&chan);
+    test(r, "ach_close");
+    r = ach_unlink(opt_channel_name);
+    test(r, "ach_unlink");
+
+    fprintf(stderr, "alloc ok\n");
+    return 0;
+}
 
 static int publisher( int32_t i ) {
     ach_channel_t chan;
@@ -416,6 +1914,54 @@ int main( int argc, char **argv ){
         r = test_basic();
         if( 0 != r ) return r;
 
+        r = test_seq();
+        if( 0 != r ) return r;
+
+        r = test_window();
+        if( 0 != r ) return r;
+
+        r = test_reliable();
+        if( 0 != r ) return r;
+
+        r = test_ref();
+        if( 0 != r ) return r;
+
+        r = test_subs();
+        if( 0 != r ) return r;
+
+        r = test_fixed();
+        if( 0 != r ) return r;
+
+        r = test_resize();
+        if( 0 != r ) return r;
+
+        r = test_alloc();
+        if( 0 != r ) return r;
+
+        r = test_dedup();
+        if( 0 != r ) return r;
+
+        r = test_patch();
+        if( 0 != r ) return r;
+
+        r = test_snapshot();
+        if( 0 != r ) return r;
+
+        r = test_group();
+        if( 0 != r ) return r;
+
+        r = test_memfd();
+        if( 0 != r ) return r;
+
+        r = test_anon();
+        if( 0 != r ) return r;
+
+        r = test_inline();
+        if( 0 != r ) return r;
+
+        r = test_view();
+        if( 0 != r ) return r;
+
         r = test_multi();
         if( 0 != r ) return r;
 
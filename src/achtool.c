@@ -64,6 +64,7 @@
 
 size_t opt_msg_cnt = ACH_DEFAULT_FRAME_COUNT;
 int opt_truncate = 0;
+int opt_reliable = 0;
 size_t opt_msg_size = ACH_DEFAULT_FRAME_SIZE;
 char *opt_chan_name = NULL;
 int opt_verbosity = 0;
@@ -93,6 +94,7 @@ int cmd_dump(void);
 int cmd_unlink(void);
 int cmd_create(void);
 int cmd_chmod(void);
+int cmd_resize(void);
 
 void cleanup() {
     if(opt_chan_name) free(opt_chan_name);
@@ -118,6 +120,8 @@ static void posarg(int i, const char *arg) {
                    0 == strcasecmp(arg, "remove") )
         {
             set_cmd( cmd_unlink );
+        } else if( 0 == strcasecmp(arg, "resize") ) {
+            set_cmd( cmd_resize );
         } else if( 0 == strcasecmp(arg, "dump") ) {
             set_cmd( cmd_dump );
         } else if( 0 == strcasecmp(arg, "file") ) {
@@ -166,7 +170,7 @@ int main( int argc, char **argv ) {
     /* Parse Options */
     int c, i = 0;
     opterr = 0;
-    while( (c = getopt( argc, argv, "C:U:D:F:vn:m:o:1thH?V")) != -1 ) {
+    while( (c = getopt( argc, argv, "C:U:D:F:vn:m:o:1tRhH?V")) != -1 ) {
         switch(c) {
         case 'C':   /* create   */
             parse_cmd( cmd_create, optarg );
@@ -192,6 +196,9 @@ int main( int argc, char **argv ) {
         case 't':   /* truncate */
             opt_truncate++;
             break;
+        case 'R':   /* reliable */
+            opt_reliable++;
+            break;
         case 'v':   /* verbose  */
             opt_verbosity++;
             break;
@@ -204,7 +211,7 @@ int main( int argc, char **argv ) {
         case '?':   /* help     */
         case 'h':
         case 'H':
-            puts( "Usage: ach [OPTION...] [mk|rm|chmod|dump|file] [mode] [channel-name]\n"
+            puts( "Usage: ach [OPTION...] [mk|rm|chmod|resize|dump|file] [mode] [channel-name]\n"
                   "General tool to interact with ach channels\n"
                   "\n"
                   "Options:\n"
@@ -219,6 +226,8 @@ int main( int argc, char **argv ) {
                   "  -t,                       Truncate and reinit newly create channel.\n"
                   "                            WARNING: this will clobber processes\n"
                   "                            Currently using the channel.\n"
+                  "  -R,                       Create a reliable channel: puts fail rather\n"
+                  "                            than overwrite frames subscribers have not read\n"
                   "  -v,                       Make output more verbose\n"
                   "  -?,                       Give program help list\n"
                   "  -V,                       Print program version\n"
@@ -238,6 +247,10 @@ int main( int argc, char **argv ) {
                   "                            for channel access in order to properly\n"
                   "                            synchronize.\n"
                   "  ach chmod 666 foo         Set permissions of channel 'foo' to '666'\n"
+                  "  ach resize foo -m 20 -n 512\n"
+                  "                            Grow channel 'foo' to buffer 20 messages of\n"
+                  "                            nominal size 512 bytes, without disturbing\n"
+                  "                            processes using it.\n"
                   "\n"
                   "Report bugs to <ntd@gatech.edu>"
                 );
@@ -289,6 +302,7 @@ int cmd_create(void) {
         ach_create_attr_t attr;
         ach_create_attr_init(&attr);
         if( opt_truncate ) attr.truncate = 1;
+        if( opt_reliable ) attr.reliable = 1;
         i = ach_create( opt_chan_name, opt_msg_cnt, opt_msg_size, &attr );
     }
 
@@ -302,6 +316,23 @@ int cmd_create(void) {
 
     return i;
 }
+int cmd_resize(void) {
+    if( opt_verbosity > 0 ) {
+        fprintf(stderr, "Resizing Channel %s\n", opt_chan_name);
+    }
+    ach_channel_t chan;
+    ach_status_t r = ach_open( &chan, opt_chan_name, NULL );
+    check_status( r, "Error opening ach channel '%s'", opt_chan_name );
+
+    r = ach_resize( &chan, opt_msg_cnt, opt_msg_size );
+    check_status( r, "Error resizing ach channel '%s'", opt_chan_name );
+
+    r = ach_close( &chan );
+    check_status( r, "Error closing ach channel '%s'", opt_chan_name );
+
+    return r;
+}
+
 int cmd_unlink(void) {
     if( opt_verbosity > 0 ) {
         fprintf(stderr, "Unlinking Channel %s\n", opt_chan_name);